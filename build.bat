@@ -8,9 +8,18 @@ IF NOT EXIST build mkdir build
 pushd build
 
 set files=src/main.c
-set compile_flags=/std:c11 /MT /nologo /GR- /EHa- /Od /Oi /WX /W4 /wd4100 /DDEBUG /FC /Z7 /Fm3drenderer.map
-set linker_flags=/opt:ref /subsystem:windows user32.lib gdi32.lib
+set compile_flags=/std:c11 /MT /nologo /GR- /EHa- /Od /Oi /WX /W4 /wd4100 /DDEBUG /DPROFILER=1 /D_CRT_SECURE_NO_WARNINGS /FC /Z7 /Fm3drenderer.map
+set linker_flags=/opt:ref /subsystem:windows user32.lib gdi32.lib winmm.lib
 
 cl %compile_flags% ../src/main.c /link %linker_flags%
 
+rem headless frame benchmark and microbenchmark for my_math.h, optimized so the numbers mean something
+set bench_flags=/std:c11 /MT /nologo /GR- /EHa- /O2 /Oi /WX /W4 /wd4100 /D_CRT_SECURE_NO_WARNINGS /FC
+cl %bench_flags% ../src/headless.c /link /opt:ref /subsystem:console
+cl %bench_flags% /DPROFILER=1 /Feheadless_profile.exe ../src/headless.c /link /opt:ref /subsystem:console
+cl %bench_flags% ../src/math_bench.c /link /opt:ref /subsystem:console
+
+rem offline OBJ to .mesh converter
+cl %bench_flags% ../src/obj_convert.c /link /opt:ref /subsystem:console
+
 popd
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Linux build of the headless driver, the math and raster benchmarks and the mesh converter, main.c is the Win32 platform layer
+
+set -e
+
+mkdir -p build
+cd build
+
+# gnu89 inline semantics because my_math.h uses plain 'inline' the way MSVC treats it
+compile_flags="-std=c11 -O2 -g -fgnu89-inline -msse2 -D_DEFAULT_SOURCE -DDEBUG=0 -Wall -Wextra -Werror -Wno-unused-parameter -Wno-missing-braces -Wno-missing-field-initializers"
+linker_flags="-lm -lpthread"
+
+cc $compile_flags ../src/headless.c -o headless $linker_flags
+cc $compile_flags -DPROFILER=1 ../src/headless.c -o headless_profile $linker_flags # for -trace
+cc $compile_flags ../src/math_bench.c -o math_bench $linker_flags
+cc $compile_flags ../src/raster_bench.c -o raster_bench $linker_flags
+cc $compile_flags ../src/obj_convert.c -o obj_convert $linker_flags # offline OBJ to .mesh converter
@@ -0,0 +1,121 @@
+/*
+* Linear arenas.
+*
+* An arena reserves a big range of address space up front and commits it
+* in ARENA_COMMIT_SIZE steps as it fills up, so pointers into it never move
+* and pushing is a bump of an offset. Nothing gets freed on its own: the
+* whole arena gets reset, or everything pushed after a marker gets popped.
+*
+*     Arena_Marker marker = BeginArenaTemp(arena);
+*     Transformed_Vertex *transformed = ARENA_PUSH_ARRAY(arena, Transformed_Vertex, count);
+*     ...
+*     EndArenaTemp(marker);
+*
+* The renderer uses a permanent arena for what lives as long as the program
+* (framebuffer, bins, textures, meshes) and frame arenas that get reset
+* every frame for what a frame records (triangles, tile bins, vertex stage
+* scratch). Once the arenas have grown to the biggest frame, a frame does
+* no allocation at all. high_water is the most an arena was ever filled,
+* which is what it really needs.
+*
+* An arena is not thread safe, every one has a single owner at a time.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#define ARENA_COMMIT_SIZE (1024 * 1024) // bytes committed at once, a multiple of the page size
+#define ARENA_DEFAULT_ALIGNMENT 16 // enough for SSE loads
+
+#define PERMANENT_ARENA_RESERVE ((size_t)1 << 32) // address space only, 64 bit builds have plenty
+#define FRAME_ARENA_RESERVE     ((size_t)1 << 32)
+
+typedef struct Tag_Memory_Arena {
+    u8 *base;
+    size_t reserved;
+    size_t committed;
+    size_t used;
+    size_t high_water; // most bytes ever used at once
+    const char *name;
+} Memory_Arena;
+
+typedef struct Tag_Arena_Marker {
+    Memory_Arena *arena;
+    size_t used;
+} Arena_Marker;
+
+b8 CreateArena(Memory_Arena *arena, const char *name, size_t reserve_size) {
+    Memory_Arena zero_arena = {0};
+    *arena = zero_arena;
+    arena->name = name;
+    arena->base = (u8 *)platform_reserve_memory(reserve_size);
+    if (!arena->base) return M_FALSE;
+    arena->reserved = reserve_size;
+    return M_TRUE;
+}
+
+void DestroyArena(Memory_Arena *arena) {
+    if (arena->base) platform_free_memory(arena->base, arena->reserved);
+    arena->base = 0;
+    arena->reserved = arena->committed = arena->used = 0;
+}
+
+b8 CommitArena(Memory_Arena *arena, size_t needed) {
+    if (needed > arena->reserved) return M_FALSE;
+
+    size_t commit_end = MIN((needed + ARENA_COMMIT_SIZE - 1) / ARENA_COMMIT_SIZE * ARENA_COMMIT_SIZE, arena->reserved);
+    if (!platform_commit_memory(arena->base + arena->committed, commit_end - arena->committed)) return M_FALSE;
+    arena->committed = commit_end;
+    return M_TRUE;
+}
+
+// Not zeroed (except the first time the memory gets used). Returns 0 when the reserve is exhausted, for
+// callers that handle that, everyone else uses ArenaPushSize().
+inline void *ArenaTryPushSize(Memory_Arena *arena, size_t size, size_t alignment) {
+    size_t start = (arena->used + alignment - 1) & ~(alignment - 1);
+    size_t end = start + size;
+    if (end > arena->committed && !CommitArena(arena, end)) return 0;
+
+    arena->used = end;
+    arena->high_water = MAX(arena->high_water, end);
+    return arena->base + start;
+}
+
+// like ArenaTryPushSize(), but running out is a bug in debug builds
+inline void *ArenaPushSize(Memory_Arena *arena, size_t size, size_t alignment) {
+    void *result = ArenaTryPushSize(arena, size, alignment);
+    ASSERT(result || !"arena reserve exhausted");
+    return result;
+}
+
+#define ARENA_PUSH_ARRAY(arena, type, count) ((type *)ArenaPushSize((arena), (size_t)(count) * sizeof(type), ARENA_DEFAULT_ALIGNMENT))
+
+// where the next push with alignment 1 goes, arrays at the top can grow with ArenaPushSize(arena, size, 1)
+inline void *ArenaTop(Memory_Arena *arena) {
+    return arena->base + arena->used;
+}
+
+// gives back the last size bytes
+inline void ArenaPop(Memory_Arena *arena, size_t size) {
+    ASSERT(size <= arena->used);
+    arena->used -= size;
+}
+
+// the committed memory stays, so the next frame doesn't commit it again
+inline void ResetArena(Memory_Arena *arena) {
+    arena->used = 0;
+}
+
+inline Arena_Marker BeginArenaTemp(Memory_Arena *arena) {
+    Arena_Marker marker;
+    marker.arena = arena;
+    marker.used = arena->used;
+    return marker;
+}
+
+inline void EndArenaTemp(Arena_Marker marker) {
+    ASSERT(marker.arena->used >= marker.used);
+    marker.arena->used = marker.used;
+}
+
+#endif
@@ -0,0 +1,248 @@
+/*
+* Software audio mixer.
+*
+* Every voice is either an oscillator (phase accumulator in turns) or a mono
+* 16 bit PCM source, with its own gain and pan. All active voices get summed
+* into a small float bus four samples at a time and the bus gets converted
+* to interleaved stereo i16 in one pass at the end. mixer_fill_i16() does
+* that for any number of samples, so the platform layer just calls it once
+* per region of its ring buffer.
+*/
+
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#define MIXER_MAX_VOICES    64
+#define MIXER_BLOCK_SAMPLES 1024 // samples mixed per pass, keeps the bus in L1
+
+typedef enum Tag_Voice_Type {
+    VOICE_OFF,
+    VOICE_OSCILLATOR,
+    VOICE_PCM
+} Voice_Type;
+
+typedef struct Tag_Voice {
+    Voice_Type type;
+    u32 id; // for the caller, the mixer doesn't look at it
+    f32 gain_left;
+    f32 gain_right;
+
+    // VOICE_OSCILLATOR
+    f32 phase;      // in turns, kept in [0, 1)
+    f32 phase_step; // turns per sample
+
+    // VOICE_PCM
+    i16 *pcm_samples;
+    u32 pcm_sample_count;
+    u32 pcm_position;
+    b8 loop;
+} Voice;
+
+typedef struct Tag_Audio_Mixer {
+    int samples_per_second;
+    f32 master_volume;
+    Voice voices[MIXER_MAX_VOICES];
+
+    __m128 bus_left[MIXER_BLOCK_SAMPLES / 4];
+    __m128 bus_right[MIXER_BLOCK_SAMPLES / 4];
+} Audio_Mixer;
+
+void init_audio_mixer(Audio_Mixer *mixer, int samples_per_second) {
+    mixer->samples_per_second = samples_per_second;
+    mixer->master_volume = 1.0f;
+    for (int i = 0; i < MIXER_MAX_VOICES; ++i) {
+        mixer->voices[i].type = VOICE_OFF;
+    }
+}
+
+// pan goes from -1 (left) to 1 (right), constant power
+void set_voice_gain(Voice *voice, f32 gain, f32 pan) {
+    f32 sin_value;
+    f32 cos_value;
+    m_sincos((pan + 1.0f) * 0.125f, &sin_value, &cos_value);
+    voice->gain_left = gain * cos_value;
+    voice->gain_right = gain * sin_value;
+}
+
+// returns the voice index or -1 if all voices are busy
+int find_free_voice(Audio_Mixer *mixer) {
+    for (int i = 0; i < MIXER_MAX_VOICES; ++i) {
+        if (mixer->voices[i].type == VOICE_OFF) return i;
+    }
+    return -1;
+}
+
+int play_tone(Audio_Mixer *mixer, f32 hz, f32 gain, f32 pan) {
+    int index = find_free_voice(mixer);
+    if (index < 0) return index;
+
+    Voice *voice = mixer->voices + index;
+    voice->id = 0;
+    voice->phase = 0.0f;
+    voice->phase_step = hz / (f32)mixer->samples_per_second;
+    set_voice_gain(voice, gain, pan);
+    voice->type = VOICE_OSCILLATOR;
+    return index;
+}
+
+// the samples have to stay alive while the voice plays
+int play_pcm(Audio_Mixer *mixer, i16 *samples, u32 sample_count, f32 gain, f32 pan, b8 loop) {
+    int index = find_free_voice(mixer);
+    if (index < 0 || sample_count == 0) return -1;
+
+    Voice *voice = mixer->voices + index;
+    voice->id = 0;
+    voice->pcm_samples = samples;
+    voice->pcm_sample_count = sample_count;
+    voice->pcm_position = 0;
+    voice->loop = loop;
+    set_voice_gain(voice, gain, pan);
+    voice->type = VOICE_PCM;
+    return index;
+}
+
+// returns -1 if no playing voice has that id
+int find_voice_by_id(Audio_Mixer *mixer, u32 id) {
+    for (int i = 0; i < MIXER_MAX_VOICES; ++i) {
+        if (mixer->voices[i].type != VOICE_OFF && mixer->voices[i].id == id) return i;
+    }
+    return -1;
+}
+
+void stop_voice(Audio_Mixer *mixer, int index) {
+    if (index >= 0 && index < MIXER_MAX_VOICES) {
+        mixer->voices[index].type = VOICE_OFF;
+    }
+}
+
+void mix_oscillator(Voice *voice, f32 *left, f32 *right, u32 count) {
+    __m128 gain_left = _mm_set1_ps(voice->gain_left);
+    __m128 gain_right = _mm_set1_ps(voice->gain_right);
+    __m128 step = _mm_set1_ps(voice->phase_step);
+    __m128 phase_base = _mm_set1_ps(voice->phase);
+    __m128 sample_index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 four = _mm_set1_ps(4.0f);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sin_value;
+        __m128 cos_value;
+        sincos_ps(_mm_add_ps(phase_base, _mm_mul_ps(step, sample_index)), &sin_value, &cos_value);
+        _mm_store_ps(left + i, _mm_add_ps(_mm_load_ps(left + i), _mm_mul_ps(sin_value, gain_left)));
+        _mm_store_ps(right + i, _mm_add_ps(_mm_load_ps(right + i), _mm_mul_ps(sin_value, gain_right)));
+        sample_index = _mm_add_ps(sample_index, four);
+    }
+    for (; i < count; ++i) {
+        f32 sin_value;
+        f32 cos_value;
+        m_sincos(voice->phase + voice->phase_step * (f32)i, &sin_value, &cos_value);
+        left[i] += sin_value * voice->gain_left;
+        right[i] += sin_value * voice->gain_right;
+    }
+
+    f32 phase = voice->phase + voice->phase_step * (f32)count;
+    voice->phase = phase - floorf(phase);
+}
+
+void mix_pcm(Voice *voice, f32 *left, f32 *right, u32 count) {
+    f32 scalar_gain_left = voice->gain_left * (1.0f / 32768.0f);
+    f32 scalar_gain_right = voice->gain_right * (1.0f / 32768.0f);
+    __m128 gain_left = _mm_set1_ps(scalar_gain_left);
+    __m128 gain_right = _mm_set1_ps(scalar_gain_right);
+
+    u32 i = 0;
+    while (i < count && voice->type == VOICE_PCM) {
+        u32 available = voice->pcm_sample_count - voice->pcm_position;
+        u32 run = MIN(count - i, available);
+        i16 *source = voice->pcm_samples + voice->pcm_position;
+
+        // left/right are aligned at multiples of 4 only, so the SIMD part starts at the next one
+        u32 j = 0;
+        for (; j < run && ((i + j) & 3); ++j) {
+            f32 sample = (f32)source[j];
+            left[i + j] += sample * scalar_gain_left;
+            right[i + j] += sample * scalar_gain_right;
+        }
+        for (; j + 4 <= run; j += 4) {
+            __m128i packed = _mm_loadl_epi64((__m128i *)(source + j));
+            __m128 sample = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+            _mm_store_ps(left + i + j, _mm_add_ps(_mm_load_ps(left + i + j), _mm_mul_ps(sample, gain_left)));
+            _mm_store_ps(right + i + j, _mm_add_ps(_mm_load_ps(right + i + j), _mm_mul_ps(sample, gain_right)));
+        }
+        for (; j < run; ++j) {
+            f32 sample = (f32)source[j];
+            left[i + j] += sample * scalar_gain_left;
+            right[i + j] += sample * scalar_gain_right;
+        }
+
+        i += run;
+        voice->pcm_position += run;
+        if (voice->pcm_position == voice->pcm_sample_count) {
+            if (voice->loop) {
+                voice->pcm_position = 0;
+            }
+            else {
+                voice->type = VOICE_OFF;
+            }
+        }
+    }
+}
+
+// bus (floats in [-1, 1]) to interleaved stereo i16, saturating
+void convert_bus_to_i16(Audio_Mixer *mixer, i16 *out, u32 count) {
+    f32 *left = (f32 *)mixer->bus_left;
+    f32 *right = (f32 *)mixer->bus_right;
+    f32 scale = 32767.0f * mixer->master_volume;
+    __m128 scale_wide = _mm_set1_ps(scale);
+    // clamped before the conversion, out of range floats would turn into 0x80000000
+    __m128 low = _mm_set1_ps(-32768.0f);
+    __m128 high = _mm_set1_ps(32767.0f);
+
+    u32 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i left_low = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(left + i), scale_wide), low), high));
+        __m128i left_high = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(left + i + 4), scale_wide), low), high));
+        __m128i right_low = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(right + i), scale_wide), low), high));
+        __m128i right_high = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(right + i + 4), scale_wide), low), high));
+        __m128i left_16 = _mm_packs_epi32(left_low, left_high);
+        __m128i right_16 = _mm_packs_epi32(right_low, right_high);
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(left_16, right_16));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(left_16, right_16));
+    }
+    for (; i < count; ++i) {
+        f32 l = MIN(MAX(left[i] * scale, -32768.0f), 32767.0f);
+        f32 r = MIN(MAX(right[i] * scale, -32768.0f), 32767.0f);
+        out[2 * i] = (i16)_mm_cvtss_si32(_mm_set_ss(l));
+        out[2 * i + 1] = (i16)_mm_cvtss_si32(_mm_set_ss(r));
+    }
+}
+
+// writes sample_count interleaved stereo samples (2 * sample_count i16 values) and advances every voice
+void mixer_fill_i16(Audio_Mixer *mixer, i16 *out, u32 sample_count) {
+    while (sample_count > 0) {
+        u32 count = MIN(sample_count, MIXER_BLOCK_SAMPLES);
+        f32 *left = (f32 *)mixer->bus_left;
+        f32 *right = (f32 *)mixer->bus_right;
+
+        __m128 zero = _mm_setzero_ps();
+        for (u32 i = 0; i < (count + 3) / 4; ++i) {
+            mixer->bus_left[i] = zero;
+            mixer->bus_right[i] = zero;
+        }
+
+        for (int v = 0; v < MIXER_MAX_VOICES; ++v) {
+            Voice *voice = mixer->voices + v;
+            switch (voice->type) {
+                case VOICE_OSCILLATOR: mix_oscillator(voice, left, right, count); break;
+                case VOICE_PCM: mix_pcm(voice, left, right, count); break;
+                case VOICE_OFF: break;
+            }
+        }
+
+        convert_bus_to_i16(mixer, out, count);
+        out += 2 * count;
+        sample_count -= count;
+    }
+}
+
+#endif
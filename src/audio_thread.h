@@ -0,0 +1,313 @@
+/*
+* Audio thread.
+*
+* The game thread never touches the mixer. It only puts commands into a
+* single producer / single consumer ring (play a tone, play a PCM block,
+* stop a voice, set the volume). The audio thread drains that ring, keeps
+* latency_sample_count samples queued ahead of what the sink has played and
+* counts an underrun every time the sink got ahead of it.
+*
+* Where the samples go is up to an Audio_Sink: the platform layer provides
+* one for the sound card, null and WAV file sinks are here so everything
+* also works headless. The null and WAV sinks play back at wall clock speed.
+*/
+
+#ifndef AUDIO_THREAD_H
+#define AUDIO_THREAD_H
+
+#include <stdio.h>
+
+#define AUDIO_COMMAND_RING_SIZE 256 // has to be a power of two
+#define AUDIO_THREAD_SLEEP_MS   2 // on Windows only with timeBeginPeriod(1), see main.c
+
+typedef struct Tag_Audio_Sink Audio_Sink;
+
+// total number of samples the device has played so far
+#define AUDIO_SINK_PLAYED_SAMPLES(name) u64 name(Audio_Sink *sink)
+typedef AUDIO_SINK_PLAYED_SAMPLES(Audio_Sink_Played_Samples);
+
+// position is the total sample index of samples[0], samples are interleaved stereo
+#define AUDIO_SINK_WRITE(name) void name(Audio_Sink *sink, u64 position, i16 *samples, u32 sample_count)
+typedef AUDIO_SINK_WRITE(Audio_Sink_Write);
+
+struct Tag_Audio_Sink {
+    Audio_Sink_Played_Samples *played_samples;
+    Audio_Sink_Write *write;
+    int samples_per_second;
+
+    // null and WAV sinks
+    f64 start_seconds;
+    FILE *file;
+    u32 file_sample_count;
+
+    void *platform; // whatever the platform sink needs
+};
+
+typedef enum Tag_Audio_Command_Type {
+    AUDIO_COMMAND_PLAY_TONE,
+    AUDIO_COMMAND_PLAY_PCM,
+    AUDIO_COMMAND_STOP_VOICE,
+    AUDIO_COMMAND_SET_MASTER_VOLUME
+} Audio_Command_Type;
+
+typedef struct Tag_Audio_Command {
+    Audio_Command_Type type;
+    u32 voice_id;
+    f32 hz;
+    f32 gain;
+    f32 pan;
+    i16 *samples; // has to stay alive while the voice plays
+    u32 sample_count;
+    b8 loop;
+} Audio_Command;
+
+typedef struct Tag_Audio_System {
+    // written by the game thread only
+    volatile u32 command_write;
+    u32 next_voice_id;
+    u32 dropped_command_count;
+
+    // written by the audio thread only
+    volatile u32 command_read;
+    volatile u32 underrun_count;
+    volatile u64 written_sample_count;
+
+    Audio_Command commands[AUDIO_COMMAND_RING_SIZE];
+
+    volatile b8 running;
+    u32 latency_sample_count;
+    Audio_Sink *sink;
+    Audio_Mixer mixer;
+    i16 block[2 * MIXER_BLOCK_SAMPLES];
+    Platform_Thread thread;
+} Audio_System;
+
+//
+// game thread side
+//
+// returns M_FALSE and counts a dropped command if the ring is full
+b8 push_audio_command(Audio_System *audio, Audio_Command *command) {
+    u32 write = audio->command_write;
+    if (write - audio->command_read >= AUDIO_COMMAND_RING_SIZE) {
+        ++audio->dropped_command_count;
+        return M_FALSE;
+    }
+
+    audio->commands[write & (AUDIO_COMMAND_RING_SIZE - 1)] = *command;
+    // the command has to be visible before the new write index
+    COMPILER_BARRIER();
+    audio->command_write = write + 1;
+    return M_TRUE;
+}
+
+// these return the id for audio_stop_voice(), 0 if the command got dropped
+u32 audio_play_tone(Audio_System *audio, f32 hz, f32 gain, f32 pan) {
+    Audio_Command command = {0};
+    command.type = AUDIO_COMMAND_PLAY_TONE;
+    command.voice_id = ++audio->next_voice_id;
+    command.hz = hz;
+    command.gain = gain;
+    command.pan = pan;
+    return push_audio_command(audio, &command) ? command.voice_id : 0;
+}
+
+u32 audio_play_pcm(Audio_System *audio, i16 *samples, u32 sample_count, f32 gain, f32 pan, b8 loop) {
+    Audio_Command command = {0};
+    command.type = AUDIO_COMMAND_PLAY_PCM;
+    command.voice_id = ++audio->next_voice_id;
+    command.samples = samples;
+    command.sample_count = sample_count;
+    command.gain = gain;
+    command.pan = pan;
+    command.loop = loop;
+    return push_audio_command(audio, &command) ? command.voice_id : 0;
+}
+
+void audio_stop_voice(Audio_System *audio, u32 voice_id) {
+    Audio_Command command = {0};
+    command.type = AUDIO_COMMAND_STOP_VOICE;
+    command.voice_id = voice_id;
+    push_audio_command(audio, &command);
+}
+
+void audio_set_master_volume(Audio_System *audio, f32 volume) {
+    Audio_Command command = {0};
+    command.type = AUDIO_COMMAND_SET_MASTER_VOLUME;
+    command.gain = volume;
+    push_audio_command(audio, &command);
+}
+
+//
+// audio thread side
+//
+void process_audio_commands(Audio_System *audio) {
+    u32 read = audio->command_read;
+    u32 write = audio->command_write;
+    // don't read the commands before the write index
+    COMPILER_BARRIER();
+
+    for (; read != write; ++read) {
+        Audio_Command *command = audio->commands + (read & (AUDIO_COMMAND_RING_SIZE - 1));
+        int index = -1;
+        switch (command->type) {
+            case AUDIO_COMMAND_PLAY_TONE: {
+                index = play_tone(&audio->mixer, command->hz, command->gain, command->pan);
+            } break;
+            case AUDIO_COMMAND_PLAY_PCM: {
+                index = play_pcm(&audio->mixer, command->samples, command->sample_count,
+                                 command->gain, command->pan, command->loop);
+            } break;
+            case AUDIO_COMMAND_STOP_VOICE: {
+                stop_voice(&audio->mixer, find_voice_by_id(&audio->mixer, command->voice_id));
+            } break;
+            case AUDIO_COMMAND_SET_MASTER_VOLUME: {
+                audio->mixer.master_volume = command->gain;
+            } break;
+        }
+        if (index >= 0) {
+            audio->mixer.voices[index].id = command->voice_id;
+        }
+    }
+
+    // the game thread may only reuse the slots once we are done reading them
+    COMPILER_BARRIER();
+    audio->command_read = read;
+}
+
+// one round of the audio thread, headless code can also call this directly
+void update_audio(Audio_System *audio) {
+    process_audio_commands(audio);
+
+    Audio_Sink *sink = audio->sink;
+    u64 played = sink->played_samples(sink);
+    u64 written = audio->written_sample_count;
+    if (written < played) {
+        // the sink ran dry, skip what it already played instead of queueing more and more latency.
+        // Not an underrun if nothing was written yet, the sink may have started before the thread.
+        if (written > 0) ++audio->underrun_count;
+        written = played;
+    }
+
+    u64 target = played + audio->latency_sample_count;
+    if (written < target) { // most rounds have nothing to do, those don't get a zone
+        PROFILE_BEGIN("audio");
+        while (written < target) {
+            u32 count = (u32)MIN(target - written, (u64)MIXER_BLOCK_SAMPLES);
+            mixer_fill_i16(&audio->mixer, audio->block, count);
+            sink->write(sink, written, audio->block, count);
+            written += count;
+        }
+        PROFILE_END("audio");
+    }
+    audio->written_sample_count = written;
+}
+
+PLATFORM_THREAD_PROC(AudioThreadProc) {
+    Audio_System *audio = (Audio_System *)parameter;
+    PROFILE_THREAD_NAME("audio");
+    while (audio->running) {
+        update_audio(audio);
+        platform_sleep_ms(AUDIO_THREAD_SLEEP_MS);
+    }
+    return 0;
+}
+
+void init_audio_system(Audio_System *audio, Audio_Sink *sink, u32 latency_sample_count) {
+    audio->command_write = 0;
+    audio->command_read = 0;
+    audio->next_voice_id = 0;
+    audio->dropped_command_count = 0;
+    audio->underrun_count = 0;
+    audio->written_sample_count = 0;
+    audio->latency_sample_count = latency_sample_count;
+    audio->sink = sink;
+    audio->running = M_FALSE;
+    init_audio_mixer(&audio->mixer, sink->samples_per_second);
+}
+
+void start_audio_thread(Audio_System *audio) {
+    audio->running = M_TRUE;
+    audio->thread = platform_create_thread(AudioThreadProc, audio);
+}
+
+void stop_audio_thread(Audio_System *audio) {
+    audio->running = M_FALSE;
+    platform_join_thread(audio->thread);
+}
+
+//
+// null and WAV sinks
+//
+AUDIO_SINK_PLAYED_SAMPLES(ClockPlayedSamples) {
+    f64 elapsed = platform_get_seconds() - sink->start_seconds;
+    return (u64)(elapsed * (f64)sink->samples_per_second);
+}
+
+AUDIO_SINK_WRITE(NullSinkWrite) {
+}
+
+AUDIO_SINK_WRITE(WavSinkWrite) {
+    if (sink->file) {
+        fwrite(samples, 2 * sizeof(i16), sample_count, sink->file);
+        sink->file_sample_count += sample_count;
+    }
+}
+
+void init_null_sink(Audio_Sink *sink, int samples_per_second) {
+    sink->played_samples = ClockPlayedSamples;
+    sink->write = NullSinkWrite;
+    sink->samples_per_second = samples_per_second;
+    sink->start_seconds = platform_get_seconds();
+    sink->file = 0;
+    sink->file_sample_count = 0;
+    sink->platform = 0;
+}
+
+void write_wav_header(FILE *file, int samples_per_second, u32 sample_count) {
+    u32 data_size = sample_count * 2 * sizeof(i16);
+    u32 riff_size = 36 + data_size;
+    u32 format_size = 16;
+    u16 format = 1; // PCM
+    u16 channels = 2;
+    u32 rate = (u32)samples_per_second;
+    u32 bytes_per_second = rate * 2 * sizeof(i16);
+    u16 block_align = 2 * sizeof(i16);
+    u16 bits_per_sample = 16;
+
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&riff_size, 4, 1, file);
+    fwrite("WAVEfmt ", 1, 8, file);
+    fwrite(&format_size, 4, 1, file);
+    fwrite(&format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&rate, 4, 1, file);
+    fwrite(&bytes_per_second, 4, 1, file);
+    fwrite(&block_align, 2, 1, file);
+    fwrite(&bits_per_sample, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&data_size, 4, 1, file);
+}
+
+b8 init_wav_sink(Audio_Sink *sink, char *path, int samples_per_second) {
+    init_null_sink(sink, samples_per_second);
+    sink->write = WavSinkWrite;
+    sink->file = fopen(path, "wb");
+    if (!sink->file) {
+        return M_FALSE;
+    }
+    // sizes get patched in close_wav_sink()
+    write_wav_header(sink->file, samples_per_second, 0);
+    return M_TRUE;
+}
+
+// only after the audio thread is stopped
+void close_wav_sink(Audio_Sink *sink) {
+    if (sink->file) {
+        fseek(sink->file, 0, SEEK_SET);
+        write_wav_header(sink->file, sink->samples_per_second, sink->file_sample_count);
+        fclose(sink->file);
+        sink->file = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,250 @@
+/*
+* Pipelined frames.
+*
+* A frame is recorded into a Frame_Packet first: the clear values and every
+* draw, already transformed, clipped and culled. Rendering the packet
+* (clear, rasterize, present) is a separate step, so it can run on another
+* thread while the next frame gets simulated and recorded:
+*
+*     game thread    | sim + vertex N | sim + vertex N+1 | sim + vertex N+2 |
+*     render thread                   | raster + present N | raster + present N+1 |
+*
+* There are two packets. BeginFrame() waits until the packet of frame N-2 is
+* rendered, so the render thread is never more than one frame behind and
+* the frame time is the slower of the two stages instead of their sum.
+*
+* Every packet owns a frame arena that gets reset when recording into it
+* starts: the triangles of the frame are pushed onto it and the tile bins
+* on top of them while it renders. The vertex stage scratch of a draw is
+* in the pipeline's scratch arena, which only the game thread uses.
+*
+* With pipelining off EndFrame() renders the packet right away on the
+* calling thread, which gives the same pixels. InitFramePipeline() starts
+* with it off, the windowed build turns it on (F2 toggles it) and headless
+* only with -pipelined. While the render thread runs it is the only one
+* allowed to touch the work queue, the framebuffer and the display.
+*/
+
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#define FRAME_PACKET_COUNT 2 // more would add latency
+
+// shows the rendered frame, called on whatever thread rendered it
+#define FRAME_PRESENT_CALLBACK(name) void name(Offscreen_Buffer *buffer, void *data)
+typedef FRAME_PRESENT_CALLBACK(Frame_Present_Callback);
+
+static b8 global_lazy_clear = M_FALSE; // how RenderFramePacket() clears, see ClearFramebufferLazy()
+
+typedef struct Tag_Frame_Packet {
+    u32 clear_color;
+    f32 clear_depth;
+
+    Memory_Arena arena;          // reset by BeginFrame()
+    Projected_Vertex *triangles; // culled, in submission order, at the bottom of the arena
+    u32 triangle_vertex_count;
+    Cull_Stats cull_stats;
+
+    Memory_Arena *scratch; // of the pipeline
+} Frame_Packet;
+
+typedef struct Tag_Frame_Pipeline {
+    Offscreen_Buffer *buffer;
+    Frame_Present_Callback *present; // may be 0
+    void *present_data;
+
+    Frame_Packet packets[FRAME_PACKET_COUNT];
+    Memory_Arena scratch; // vertex stage of the draws being recorded
+    u32 record_index; // game thread
+    u32 render_index; // render thread
+
+    b8 pipelined;
+    volatile b8 running;
+    Platform_Semaphore packet_ready; // counts recorded packets
+    Platform_Semaphore packet_free;  // counts packets the game thread may record into
+    Platform_Thread thread;
+} Frame_Pipeline;
+
+// Transforms, clips and culls the mesh and appends the triangles to the packet. They are written right behind
+// the triangles of the previous draws and culled in place, the culled ones are popped off again.
+void RecordIndexedMesh(Frame_Packet *packet, Offscreen_Buffer *buffer, Mat4 *mvp, Indexed_Mesh *mesh) {
+    Arena_Marker marker = BeginArenaTemp(packet->scratch);
+    u32 size;
+    Projected_Vertex *triangles = TransformAndClipIndexedMesh(buffer, packet->scratch, &packet->arena, mvp, mesh, &size,
+                                                              &packet->cull_stats);
+    ASSERT(triangles == packet->triangles + packet->triangle_vertex_count);
+
+    PROFILE_BEGIN("cull");
+    u32 visible_size = CullTriangles(buffer, triangles, size, global_cull_mode, &packet->cull_stats);
+    PROFILE_END("cull");
+
+    ArenaPop(&packet->arena, (size - visible_size) * sizeof(Projected_Vertex));
+    packet->triangle_vertex_count += visible_size;
+    EndArenaTemp(marker);
+}
+
+// One mesh at every one of the models, the triangles are the same as recording every instance on its own. The
+// MVPs are composed in one go and the varyings are loaded once, per instance only the positions get transformed.
+// Every instance is culled right after its assembly, so its triangles are still in the cache.
+void RecordInstancedMesh(Frame_Packet *packet, Offscreen_Buffer *buffer, Mat4 *proj, Mat3x4 *view, Mat3x4 *models,
+                         u32 instance_count, Indexed_Mesh *mesh) {
+    float width = (float)buffer->width;
+    float height = (float)buffer->height;
+
+    Arena_Marker marker = BeginArenaTemp(packet->scratch);
+    Mat4 *mvps = ARENA_PUSH_ARRAY(packet->scratch, Mat4, instance_count);
+    ComposeInstanceMvps(mvps, proj, view, models, instance_count);
+
+    // the batched vertex stage writes whole groups of 4
+    Transformed_Vertex *transformed_vertices = ARENA_PUSH_ARRAY(packet->scratch, Transformed_Vertex, (mesh->vertex_count + 3) & ~3u);
+    LoadMeshVaryings(mesh, transformed_vertices);
+
+    PROFILE_BEGIN("instances");
+    for (u32 i = 0; i < instance_count; ++i) {
+        // an instance with every vertex outside the same plane has no triangles
+        if (TransformMeshPositions(mvps + i, mesh, width, height, transformed_vertices)) continue;
+
+        Projected_Vertex *triangles = packet->triangles + packet->triangle_vertex_count;
+        u32 size = AssembleTriangles(mesh, transformed_vertices, width, height, &packet->arena, &packet->cull_stats);
+        u32 visible_size = CullTriangles(buffer, triangles, size, global_cull_mode, &packet->cull_stats);
+        ArenaPop(&packet->arena, (size - visible_size) * sizeof(Projected_Vertex));
+        packet->triangle_vertex_count += visible_size;
+    }
+    PROFILE_END("instances");
+    EndArenaTemp(marker);
+}
+
+// The whole frame gets binned at once. Tiles still see the triangles in submission order, so the pixels are
+// the same as drawing every mesh on its own.
+void RenderFramePacket(Offscreen_Buffer *buffer, Frame_Packet *packet) {
+    if (global_lazy_clear) {
+        ClearFramebufferLazy(buffer, packet->clear_color, packet->clear_depth);
+    }
+    else {
+        ClearFramebuffer(buffer, packet->clear_color);
+        ClearDepthBuffer(buffer, packet->clear_depth);
+    }
+    RasterizeTriangles(buffer, &packet->arena, packet->triangles, packet->triangle_vertex_count);
+    global_cull_stats = packet->cull_stats;
+}
+
+void RenderAndPresentPacket(Frame_Pipeline *pipeline, Frame_Packet *packet) {
+    RenderFramePacket(pipeline->buffer, packet);
+    if (pipeline->present) {
+        PROFILE_BEGIN("present");
+        pipeline->present(pipeline->buffer, pipeline->present_data);
+        PROFILE_END("present");
+    }
+}
+
+PLATFORM_THREAD_PROC(FrameRenderThreadProc) {
+    Frame_Pipeline *pipeline = (Frame_Pipeline *)parameter;
+    PROFILE_THREAD_NAME("render");
+
+    for (;;) {
+        platform_wait_semaphore(pipeline->packet_ready);
+        if (!pipeline->running) break;
+
+        Frame_Packet *packet = pipeline->packets + pipeline->render_index;
+        pipeline->render_index = (pipeline->render_index + 1) % FRAME_PACKET_COUNT;
+        RenderAndPresentPacket(pipeline, packet);
+        platform_signal_semaphore(pipeline->packet_free);
+    }
+    return 0;
+}
+
+b8 InitFramePipeline(Frame_Pipeline *pipeline, Offscreen_Buffer *buffer, Frame_Present_Callback *present,
+                     void *present_data) {
+    Frame_Pipeline zero_pipeline = {0};
+    *pipeline = zero_pipeline;
+    if (!CreateArena(&pipeline->scratch, "scratch", FRAME_ARENA_RESERVE)) return M_FALSE;
+    for (int i = 0; i < FRAME_PACKET_COUNT; ++i) {
+        Frame_Packet *packet = pipeline->packets + i;
+        if (!CreateArena(&packet->arena, "frame", FRAME_ARENA_RESERVE)) return M_FALSE;
+        packet->scratch = &pipeline->scratch;
+    }
+
+    pipeline->buffer = buffer;
+    pipeline->present = present;
+    pipeline->present_data = present_data;
+    pipeline->packet_ready = platform_create_semaphore(FRAME_PACKET_COUNT);
+    pipeline->packet_free = platform_create_semaphore(FRAME_PACKET_COUNT);
+    return M_TRUE;
+}
+
+// the most the frame arenas ever held
+size_t FrameArenaHighWater(Frame_Pipeline *pipeline) {
+    size_t high_water = 0;
+    for (int i = 0; i < FRAME_PACKET_COUNT; ++i) {
+        high_water = MAX(high_water, pipeline->packets[i].arena.high_water);
+    }
+    return high_water;
+}
+
+// returns the packet to record the next frame into, waits while the render thread is a frame behind
+Frame_Packet *BeginFrame(Frame_Pipeline *pipeline, u32 clear_color, f32 clear_depth) {
+    if (pipeline->pipelined) {
+        PROFILE_BEGIN("wait for render");
+        platform_wait_semaphore(pipeline->packet_free);
+        PROFILE_END("wait for render");
+    }
+
+    Frame_Packet *packet = pipeline->packets + pipeline->record_index;
+    packet->clear_color = clear_color;
+    packet->clear_depth = clear_depth;
+    ResetArena(&packet->arena);
+    packet->triangles = (Projected_Vertex *)ArenaTop(&packet->arena);
+    packet->triangle_vertex_count = 0;
+    Cull_Stats zero_stats = {0};
+    packet->cull_stats = zero_stats;
+    return packet;
+}
+
+void EndFrame(Frame_Pipeline *pipeline) {
+    if (pipeline->pipelined) {
+        pipeline->record_index = (pipeline->record_index + 1) % FRAME_PACKET_COUNT;
+        platform_signal_semaphore(pipeline->packet_ready);
+    }
+    else {
+        RenderAndPresentPacket(pipeline, pipeline->packets + pipeline->record_index);
+    }
+}
+
+// waits until every recorded frame is presented
+void FlushFramePipeline(Frame_Pipeline *pipeline) {
+    if (!pipeline->pipelined) return;
+
+    for (int i = 0; i < FRAME_PACKET_COUNT; ++i) {
+        platform_wait_semaphore(pipeline->packet_free);
+    }
+    for (int i = 0; i < FRAME_PACKET_COUNT; ++i) {
+        platform_signal_semaphore(pipeline->packet_free);
+    }
+}
+
+// only between frames, turning it off waits for the frames in flight
+void SetFramePipelining(Frame_Pipeline *pipeline, b8 pipelined) {
+    if (pipeline->pipelined == pipelined) return;
+
+    if (pipelined) {
+        pipeline->render_index = pipeline->record_index;
+        for (int i = 0; i < FRAME_PACKET_COUNT; ++i) {
+            platform_signal_semaphore(pipeline->packet_free);
+        }
+        pipeline->running = M_TRUE;
+        pipeline->pipelined = M_TRUE;
+        pipeline->thread = platform_create_thread(FrameRenderThreadProc, pipeline);
+    }
+    else {
+        // waits for the frames in flight and takes the free packets back, the serial mode doesn't count them
+        for (int i = 0; i < FRAME_PACKET_COUNT; ++i) {
+            platform_wait_semaphore(pipeline->packet_free);
+        }
+        pipeline->running = M_FALSE;
+        platform_signal_semaphore(pipeline->packet_ready);
+        platform_join_thread(pipeline->thread);
+        pipeline->pipelined = M_FALSE;
+    }
+}
+
+#endif
@@ -0,0 +1,631 @@
+/*
+* Headless driver: renders a fixed scene into an Offscreen_Buffer for a
+* number of frames, without a window, and prints frame time statistics.
+* Every frame of a scene depends only on its frame number, so the numbers
+* (and the checksum of the last frame) can be compared across commits.
+*
+* usage: headless [-scene cube|cubes|overdraw|field|city] [-frames n]
+*                 [-warmup n] [-width w] [-height h] [-threads n] [-serial]
+*                 [-scalar] [-lazyclear] [-pipelined] [-gradient]
+*                 [-perspective] [-texture point|bilinear] [-mesh file]
+*                 [-nofrustumcull] [-noocclusioncull] [-instanced] [-lod]
+*                 [-display wxh] [-ppm file] [-trace file] [-compare]
+*
+* -instanced draws the cubes scene as one instanced draw from TRS records
+* instead of a draw per cube, the frames come out the same.
+*
+* The field scene draws a Scene of a few thousand instances that gets
+* frustum culled through its BVH, -nofrustumcull draws all of them in the
+* same order to compare. -lod simplifies the cube (or the -mesh) into
+* levels of detail when loading, the field scene draws far away instances
+* with the coarser ones.
+*
+* The city scene walks down a street between blocks of buildings with
+* small cubes (or the -mesh) around them. The buildings are occluders, so
+* most of the cubes get occlusion culled, -noocclusioncull draws all of
+* the ones in the frustum to compare.
+*
+* -mesh draws a .mesh file (see obj_convert) instead of the cube, it should
+* fit into the cube from -1 to 1 like obj_convert -fit makes it.
+*
+* -gradient colors the cube from its vertex positions through the generic
+* varyings instead of the flat vertex colors, -perspective interpolates
+* them perspective correct. -texture puts a mipmapped checkerboard on every
+* face instead (always perspective correct), meshes need uvs for it.
+*
+* -compare renders every frame of every scene with the scalar and with the
+* SIMD rasterizer instead of measuring anything and fails if their pixels,
+* depths or Hi-Z bounds differ anywhere. -scene, -warmup and -pipelined are
+* ignored, every other option applies.
+*
+* -pipelined records frame n+1 on the main thread while a render thread
+* rasterizes and presents frame n.
+*
+* -display also scales every frame up to a display sized buffer like the
+* windowed build presents it, -ppm then writes that buffer.
+*
+* -trace needs a build with PROFILER=1 and writes the zones of the measured
+* frames as Chrome trace event JSON.
+*/
+
+#include "misc.h"
+#include "my_math.h"
+#include "platform.h"
+#include "profiler.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "work_queue.h"
+#include "texture.h"
+#include "renderer.h"
+#include "mesh_file.h"
+#include "mesh_lod.h"
+#include "occlusion.h"
+#include "frame_pipeline.h"
+#include "scene.h"
+
+typedef enum Tag_Test_Scene {
+    SCENE_CUBE,     // the spinning cube from the windowed build
+    SCENE_CUBES,    // a grid of small cubes, lots of draws and vertices
+    SCENE_OVERDRAW, // big cubes drawn back to front, fill rate
+    SCENE_FIELD,    // thousands of cubes around a turning camera, mostly outside the frustum
+    SCENE_CITY,     // a street between buildings that hide most of the cubes around them
+    SCENE_COUNT
+} Test_Scene;
+
+static char *global_scene_names[SCENE_COUNT] = { "cube", "cubes", "overdraw", "field", "city" };
+
+typedef struct Tag_Frame_Sample {
+    f64 milliseconds;
+    f64 megacycles;
+} Frame_Sample;
+
+void DrawCubeAt(Frame_Packet *packet, Offscreen_Buffer *buffer, Indexed_Mesh *cube, Mat4 *proj, Mat3x4 *view,
+                float x, float y, float z, float scale, float turn) {
+    Mat4 model4 = mat4_mul3(translate(x, y, z), rotate_y(turn), rotate_x(0.5f * turn));
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+            model4.e[row][column] *= scale;
+        }
+    }
+    Mat3x4 model = mat3x4_from_mat4(&model4);
+    Mat3x4 model_view;
+    Mat4 mvp;
+    mat3x4_mul(&model_view, view, &model);
+    mat4_mul_mat3x4(&mvp, proj, &model_view);
+    RecordIndexedMesh(packet, buffer, &mvp, cube);
+}
+
+#define FIELD_SIZE 64 // static cubes along each side
+#define FIELD_RING_COUNT 16
+
+// a grid of turned cubes on the ground plus the ring of dynamic ones
+b8 CreateField(Scene *field, Memory_Arena *arena, Indexed_Mesh *cube) {
+    if (!CreateScene(field, arena, FIELD_SIZE * FIELD_SIZE + FIELD_RING_COUNT)) return M_FALSE;
+    for (int z = 0; z < FIELD_SIZE; ++z) {
+        for (int x = 0; x < FIELD_SIZE; ++x) {
+            float turn = (float)((x * 7 + z * 13) % 16) / 16.0f;
+            float scale = 0.3f + 0.1f * (float)((x * 5 + z * 3) % 4);
+            Mat4 model4 = mat4_mul(translate(3.0f * (float)x - 94.5f, scale - 1.0f, 3.0f * (float)z - 94.5f), rotate_y(turn));
+            for (int row = 0; row < 3; ++row) {
+                for (int column = 0; column < 3; ++column) {
+                    model4.e[row][column] *= scale;
+                }
+            }
+            Mat3x4 model = mat3x4_from_mat4(&model4);
+            AddSceneInstance(field, cube, &model, M_TRUE);
+        }
+    }
+    Mat3x4 identity = mat3x4_identity();
+    for (int i = 0; i < FIELD_RING_COUNT; ++i) {
+        AddSceneInstance(field, cube, &identity, M_FALSE);
+    }
+    BuildSceneBvh(field);
+    return M_TRUE;
+}
+
+#define CITY_SIZE 12          // blocks along each side
+#define CITY_BLOCK_CLUTTER 16 // small cubes around every building
+
+// a grid of box buildings of different heights with streets between them, the small cubes stand on the
+// pavement around the buildings
+b8 CreateCity(Scene *city, Memory_Arena *arena, Indexed_Mesh *building, Indexed_Mesh *clutter) {
+    if (!CreateScene(city, arena, CITY_SIZE * CITY_SIZE * (1 + CITY_BLOCK_CLUTTER))) return M_FALSE;
+    for (int z = 0; z < CITY_SIZE; ++z) {
+        for (int x = 0; x < CITY_SIZE; ++x) {
+            float center_x = 10.0f * (float)x - 55.0f;
+            float center_z = 10.0f * (float)z - 55.0f;
+            float height = 3.0f + (float)((x * 7 + z * 11) % 7);
+            Mat4 model4 = translate(center_x, height - 1.0f, center_z);
+            for (int row = 0; row < 3; ++row) {
+                model4.e[row][0] *= 3.5f;
+                model4.e[row][1] *= height;
+                model4.e[row][2] *= 3.5f;
+            }
+            Mat3x4 model = mat3x4_from_mat4(&model4);
+            SetSceneOccluder(city, AddSceneInstance(city, building, &model, M_TRUE), building);
+
+            for (int i = 0; i < CITY_BLOCK_CLUTTER; ++i) {
+                // four along every side, just outside of the walls
+                float along = 2.0f * (float)(i % 4) - 3.0f;
+                float side = (i / 4) % 2 ? 4.2f : -4.2f;
+                float clutter_x = i < 8 ? center_x + along : center_x + side;
+                float clutter_z = i < 8 ? center_z + side : center_z + along;
+                float turn = (float)((x * 7 + z * 13 + i * 5) % 16) / 16.0f;
+                Mat4 clutter4 = mat4_mul(translate(clutter_x, -0.65f, clutter_z), rotate_y(turn));
+                for (int row = 0; row < 3; ++row) {
+                    for (int column = 0; column < 3; ++column) {
+                        clutter4.e[row][column] *= 0.35f;
+                    }
+                }
+                Mat3x4 clutter_model = mat3x4_from_mat4(&clutter4);
+                AddSceneInstance(city, clutter, &clutter_model, M_TRUE);
+            }
+        }
+    }
+    BuildSceneBvh(city);
+    return M_TRUE;
+}
+
+// records the frame, depending on the pipeline it gets rendered right away or on the render thread
+void RenderScene(Test_Scene scene, int frame, Frame_Pipeline *pipeline, Indexed_Mesh *cube, Scene *world, b8 instanced) {
+    Offscreen_Buffer *buffer = pipeline->buffer;
+    float aspect = (float)buffer->width / (float)buffer->height;
+    Mat4 proj = perspective_projection(0.25f, aspect, 0.1f, 100.0f);
+    float t = (float)frame / 60.0f; // as if running at 60 fps
+
+    Frame_Packet *packet = BeginFrame(pipeline, 0x222222, 1.0f);
+
+    switch (scene) {
+        case SCENE_CUBE: {
+            Mat4 view4 = LookAt(0.0f, 2.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+            Mat3x4 view = mat3x4_from_mat4(&view4);
+            DrawCubeAt(packet, buffer, cube, &proj, &view, 0.0f, 0.0f, 0.0f, 1.0f, 0.5f * t);
+        } break;
+
+        case SCENE_CUBES: {
+            Mat4 view4 = LookAt(0.0f, 12.0f, 24.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+            Mat3x4 view = mat3x4_from_mat4(&view4);
+            if (instanced) {
+                Trs trs[16 * 16];
+                Mat3x4 models[16 * 16];
+                for (int z = 0; z < 16; ++z) {
+                    for (int x = 0; x < 16; ++x) {
+                        float turn = 0.5f * t + 0.0625f * (float)(x + z);
+                        Trs cube_trs = { {2.0f * (float)x - 15.0f, 0.0f, 2.0f * (float)z - 15.0f}, 0.4f, turn, 0.5f * turn };
+                        trs[z * 16 + x] = cube_trs;
+                    }
+                }
+                mat3x4_from_trs_batch(models, trs, 16 * 16);
+                RecordInstancedMesh(packet, buffer, &proj, &view, models, 16 * 16, cube);
+                break;
+            }
+            for (int z = 0; z < 16; ++z) {
+                for (int x = 0; x < 16; ++x) {
+                    float turn = 0.5f * t + 0.0625f * (float)(x + z);
+                    DrawCubeAt(packet, buffer, cube, &proj, &view, 2.0f * (float)x - 15.0f, 0.0f, 2.0f * (float)z - 15.0f,
+                               0.4f, turn);
+                }
+            }
+        } break;
+
+        case SCENE_OVERDRAW: {
+            Mat4 view4 = LookAt(0.0f, 0.0f, 4.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+            Mat3x4 view = mat3x4_from_mat4(&view4);
+            for (int i = 15; i >= 0; --i) {
+                DrawCubeAt(packet, buffer, cube, &proj, &view, 0.0f, 0.0f, -2.0f * (float)i, 1.5f, 0.25f * t + 0.01f * (float)i);
+            }
+        } break;
+
+        case SCENE_FIELD: {
+            float yaw_sin, yaw_cos;
+            m_sincos(0.02f * t, &yaw_sin, &yaw_cos);
+            Mat4 view4 = LookAt(0.0f, 4.0f, 0.0f, 10.0f * yaw_sin, 0.0f, 10.0f * yaw_cos, 0.0f, 1.0f, 0.0f);
+            Mat3x4 view = mat3x4_from_mat4(&view4);
+            // the dynamic cubes spin in a ring around the camera
+            for (u32 i = 0; i < FIELD_RING_COUNT; ++i) {
+                float angle_sin, angle_cos;
+                m_sincos((float)i / (float)FIELD_RING_COUNT + 0.05f * t, &angle_sin, &angle_cos);
+                Mat4 model4 = mat4_mul3(translate(6.0f * angle_sin, 1.0f, 6.0f * angle_cos), rotate_y(t), rotate_x(0.5f * t));
+                Mat3x4 model = mat3x4_from_mat4(&model4);
+                MoveSceneInstance(world, world->dynamic_instances[i], &model);
+            }
+            DrawScene(packet, buffer, world, &proj, &view);
+        } break;
+
+        case SCENE_CITY: {
+            // down the street between the middle two columns of blocks, looking a little to the sides
+            float z = 55.0f - 2.0f * t;
+            float sway, unused;
+            m_sincos(0.1f * t, &sway, &unused);
+            float yaw_sin, yaw_cos;
+            m_sincos(0.15f * sway, &yaw_sin, &yaw_cos);
+            Mat4 view4 = LookAt(0.0f, 1.5f, z, 10.0f * yaw_sin, 1.0f, z - 10.0f * yaw_cos, 0.0f, 1.0f, 0.0f);
+            Mat3x4 view = mat3x4_from_mat4(&view4);
+            DrawScene(packet, buffer, world, &proj, &view);
+        } break;
+
+        case SCENE_COUNT: break;
+    }
+
+    EndFrame(pipeline);
+}
+
+// what presenting does in the windowed build, so lazy and full clears cost the same work per frame
+FRAME_PRESENT_CALLBACK(PresentHeadless) {
+    Offscreen_Buffer *display = (Offscreen_Buffer *)data;
+    ResolveClears(buffer);
+    if (display->memory) {
+        UpscaleBuffer(display, buffer, 0x000000, global_tile_binner.queue);
+    }
+}
+
+// The frames of scene with the scalar rasterizer and then again with the SIMD one, which has to write the same
+// bits into the color, depth and Hi-Z buffers. Stops at the first frame that differs.
+b8 CompareRasterizers(Test_Scene scene, int frame_count, Frame_Pipeline *pipeline, Memory_Arena *arena,
+                      Indexed_Mesh *cube, Scene *world, b8 instanced) {
+    Offscreen_Buffer *buffer = pipeline->buffer;
+    int pixel_count = buffer->width * buffer->height;
+    int block_count = buffer->hiz_width * buffer->hiz_height;
+    u32 *pixels = (u32 *)buffer->memory;
+    u32 *depths = (u32 *)buffer->depth; // compared as bits, the Hi-Z bounds follow the depths
+    u32 *hiz_bounds = depths + pixel_count;
+
+    Arena_Marker marker = BeginArenaTemp(arena);
+    u32 *scalar_pixels = ARENA_PUSH_ARRAY(arena, u32, pixel_count);
+    u32 *scalar_depths = ARENA_PUSH_ARRAY(arena, u32, pixel_count + 2 * block_count);
+    u32 *scalar_hiz_bounds = scalar_depths + pixel_count;
+
+    b8 raster_simd = global_raster_simd;
+    b8 same = M_TRUE;
+    for (int frame = 0; frame < frame_count && same; ++frame) {
+        global_raster_simd = M_FALSE;
+        RenderScene(scene, frame, pipeline, cube, world, instanced);
+        memcpy(scalar_pixels, pixels, pixel_count * sizeof(u32));
+        memcpy(scalar_depths, depths, (pixel_count + 2 * block_count) * sizeof(u32));
+
+        global_raster_simd = M_TRUE;
+        RenderScene(scene, frame, pipeline, cube, world, instanced);
+
+        int first = -1;
+        u32 pixel_differences = 0;
+        u32 depth_differences = 0;
+        for (int i = 0; i < pixel_count; ++i) {
+            b8 pixel_differs = pixels[i] != scalar_pixels[i];
+            b8 depth_differs = depths[i] != scalar_depths[i];
+            pixel_differences += pixel_differs;
+            depth_differences += depth_differs;
+            if (first < 0 && (pixel_differs || depth_differs)) first = i;
+        }
+        u32 hiz_differences = 0;
+        for (int i = 0; i < 2 * block_count; ++i) {
+            hiz_differences += hiz_bounds[i] != scalar_hiz_bounds[i];
+        }
+
+        if (pixel_differences || depth_differences || hiz_differences) {
+            printf("compare    %s frame %d: %u pixels, %u depths and %u Hi-Z bounds differ", global_scene_names[scene],
+                   frame, pixel_differences, depth_differences, hiz_differences);
+            if (first >= 0) printf(", the first at %d, %d", first % buffer->width, first / buffer->width);
+            printf("\n");
+            same = M_FALSE;
+        }
+    }
+    if (same) printf("compare    %s: %d frames the same\n", global_scene_names[scene], frame_count);
+
+    global_raster_simd = raster_simd;
+    EndArenaTemp(marker);
+    return same;
+}
+
+int CompareDoubles(const void *a, const void *b) {
+    f64 x = *(const f64 *)a;
+    f64 y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank, values gets sorted
+f64 Percentile(f64 *values, int count, f64 percent) {
+    qsort(values, count, sizeof(f64), CompareDoubles);
+    int rank = (int)(percent / 100.0 * (f64)count + 0.999999);
+    rank = MIN(MAX(rank, 1), count);
+    return values[rank - 1];
+}
+
+u32 FramebufferChecksum(Offscreen_Buffer *buffer) { // FNV-1a
+    u32 hash = 2166136261u;
+    u8 *bytes = (u8 *)buffer->memory;
+    int size = buffer->width * buffer->height * buffer->bytes_per_pixel;
+    for (int i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+b8 WritePpm(Offscreen_Buffer *buffer, char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return M_FALSE;
+
+    fprintf(file, "P6\n%d %d\n255\n", buffer->width, buffer->height);
+    u32 *pixels = (u32 *)buffer->memory;
+    for (int i = 0; i < buffer->width * buffer->height; ++i) {
+        u8 rgb[3] = { (u8)(pixels[i] >> 16), (u8)(pixels[i] >> 8), (u8)pixels[i] };
+        fwrite(rgb, 1, 3, file);
+    }
+    fclose(file);
+    return M_TRUE;
+}
+
+int main(int argument_count, char **arguments) {
+    Test_Scene scene = SCENE_CUBE;
+    int frame_count = 300;
+    int warmup_count = 10;
+    int width = 1280;
+    int height = 720;
+    int thread_count = platform_processor_count();
+    char *ppm_path = 0;
+    char *trace_path = 0;
+    char *mesh_path = 0;
+    b8 pipelined = M_FALSE;
+    b8 gradient = M_FALSE;
+    b8 perspective = M_FALSE;
+    b8 textured = M_FALSE;
+    b8 instanced = M_FALSE;
+    b8 lods = M_FALSE;
+    b8 compare = M_FALSE;
+    Texture_Filter filter = TEXTURE_FILTER_POINT;
+    int display_width = 0;
+    int display_height = 0;
+
+    for (int i = 1; i < argument_count; ++i) {
+        char *argument = arguments[i];
+        b8 has_value = i + 1 < argument_count;
+        if (strcmp(argument, "-scene") == 0 && has_value) {
+            char *name = arguments[++i];
+            scene = SCENE_COUNT;
+            for (int s = 0; s < SCENE_COUNT; ++s) {
+                if (strcmp(name, global_scene_names[s]) == 0) scene = (Test_Scene)s;
+            }
+            if (scene == SCENE_COUNT) {
+                fprintf(stderr, "unknown scene %s\n", name);
+                return FAILURE;
+            }
+        }
+        else if (strcmp(argument, "-frames") == 0 && has_value)  frame_count = atoi(arguments[++i]);
+        else if (strcmp(argument, "-warmup") == 0 && has_value)  warmup_count = atoi(arguments[++i]);
+        else if (strcmp(argument, "-width") == 0 && has_value)   width = atoi(arguments[++i]);
+        else if (strcmp(argument, "-height") == 0 && has_value)  height = atoi(arguments[++i]);
+        else if (strcmp(argument, "-threads") == 0 && has_value) thread_count = atoi(arguments[++i]);
+        else if (strcmp(argument, "-ppm") == 0 && has_value)     ppm_path = arguments[++i];
+        else if (strcmp(argument, "-trace") == 0 && has_value)   trace_path = arguments[++i];
+        else if (strcmp(argument, "-mesh") == 0 && has_value)    mesh_path = arguments[++i];
+        else if (strcmp(argument, "-texture") == 0 && has_value) {
+            char *name = arguments[++i];
+            textured = M_TRUE;
+            if (strcmp(name, "point") == 0)         filter = TEXTURE_FILTER_POINT;
+            else if (strcmp(name, "bilinear") == 0) filter = TEXTURE_FILTER_BILINEAR;
+            else {
+                fprintf(stderr, "unknown texture filter %s\n", name);
+                return FAILURE;
+            }
+        }
+        else if (strcmp(argument, "-display") == 0 && has_value) {
+            if (sscanf(arguments[++i], "%dx%d", &display_width, &display_height) != 2 ||
+                display_width < 1 || display_height < 1) {
+                fprintf(stderr, "-display wants the size as wxh, like 1920x1080\n");
+                return FAILURE;
+            }
+        }
+        else if (strcmp(argument, "-serial") == 0)               global_render_mode = RENDER_MODE_SERIAL;
+        else if (strcmp(argument, "-scalar") == 0)               global_raster_simd = M_FALSE;
+        else if (strcmp(argument, "-lazyclear") == 0)            global_lazy_clear = M_TRUE;
+        else if (strcmp(argument, "-pipelined") == 0)            pipelined = M_TRUE;
+        else if (strcmp(argument, "-gradient") == 0)             gradient = M_TRUE;
+        else if (strcmp(argument, "-perspective") == 0)          perspective = M_TRUE;
+        else if (strcmp(argument, "-nofrustumcull") == 0)        global_frustum_culling = M_FALSE;
+        else if (strcmp(argument, "-noocclusioncull") == 0)      global_occlusion_culling = M_FALSE;
+        else if (strcmp(argument, "-instanced") == 0)            instanced = M_TRUE;
+        else if (strcmp(argument, "-lod") == 0)                  lods = M_TRUE;
+        else if (strcmp(argument, "-compare") == 0)              compare = M_TRUE;
+        else {
+            fprintf(stderr, "usage: headless [-scene cube|cubes|overdraw|field|city] [-frames n] [-warmup n]\n"
+                            "                [-width w] [-height h] [-threads n] [-serial] [-scalar] [-lazyclear]\n"
+                            "                [-pipelined] [-gradient] [-perspective] [-texture point|bilinear]\n"
+                            "                [-mesh file] [-nofrustumcull] [-noocclusioncull] [-instanced] [-lod]\n"
+                            "                [-display wxh] [-ppm file] [-trace file] [-compare]\n");
+            return FAILURE;
+        }
+    }
+    if (frame_count < 1 || width < 1 || height < 1 || thread_count < 1) {
+        fprintf(stderr, "frames, width, height and threads have to be at least 1\n");
+        return FAILURE;
+    }
+#if !PROFILER
+    if (trace_path) {
+        fprintf(stderr, "-trace needs a build with PROFILER=1\n");
+        return FAILURE;
+    }
+#endif
+
+    static Memory_Arena permanent;
+    static Frame_Pipeline pipeline;
+    if (!CreateArena(&permanent, "permanent", PERMANENT_ARENA_RESERVE)) {
+        fprintf(stderr, "couldn't reserve memory\n");
+        return FAILURE;
+    }
+
+    Offscreen_Buffer buffer = {0};
+    CreateFramebuffer(&buffer, &permanent, width, height);
+
+    static Work_Queue work_queue;
+    InitWorkQueue(&work_queue, thread_count - 1);
+    CreateTileBinner(&global_tile_binner, &permanent, &work_queue, width, height);
+
+    Offscreen_Buffer display = {0};
+    if (display_width > 0) {
+        ResizeDisplayBuffer(&display, display_width, display_height);
+    }
+
+    if (!InitFramePipeline(&pipeline, &buffer, PresentHeadless, &display)) {
+        fprintf(stderr, "couldn't reserve memory\n");
+        return FAILURE;
+    }
+    SetFramePipelining(&pipeline, pipelined);
+
+    Indexed_Mesh cube = CreateCubeMesh(&permanent);
+    Mesh_File mesh_file = {0};
+    if (mesh_path) {
+        f64 load_start = platform_get_seconds();
+        if (!LoadMeshFile(&mesh_file, mesh_path, &cube)) {
+            fprintf(stderr, "can't load %s\n", mesh_path);
+            return FAILURE;
+        }
+        printf("mesh       %s, %u vertices, %u triangles, mapped in %.3f ms\n", mesh_path, cube.vertex_count,
+               cube.index_count / 3, 1000.0 * (platform_get_seconds() - load_start));
+    }
+    if (perspective) cube.perspective_varyings = M_TRUE;
+    if (gradient) {
+        // r, g, b from x, y, z plus one unused varying, so it isn't just the color
+        cube.varying_count = 4;
+        cube.varyings = ARENA_PUSH_ARRAY(&permanent, f32, cube.vertex_count * cube.varying_count);
+        for (u32 i = 0; i < cube.vertex_count; ++i) {
+            f32 *varyings = cube.varyings + i * cube.varying_count;
+            varyings[0] = 127.5f * (cube.vertices[i].position.x + 1.0f);
+            varyings[1] = 127.5f * (cube.vertices[i].position.y + 1.0f);
+            varyings[2] = 127.5f * (cube.vertices[i].position.z + 1.0f);
+            varyings[3] = 1.0f;
+        }
+    }
+    static Texture texture;
+    if (textured) {
+        if (!CreateCheckerTexture(&texture, &permanent, &pipeline.scratch, 256, 8, 0xFFE0E0E0, 0xFF303030, filter)) {
+            fprintf(stderr, "couldn't create the texture\n");
+            return FAILURE;
+        }
+        if (!mesh_path) {
+            TextureCubeMesh(&cube, &texture);
+        }
+        else if (cube.varying_count >= 2) {
+            cube.texture = &texture;
+        }
+        else {
+            fprintf(stderr, "%s has no uvs to texture it with\n", mesh_path);
+            return FAILURE;
+        }
+    }
+
+    if (lods) {
+        f64 lod_start = platform_get_seconds();
+        u32 level_count = BuildMeshLods(&cube, &permanent, &pipeline.scratch);
+        printf("lods       %u levels built in %.3f ms:", level_count, 1000.0 * (platform_get_seconds() - lod_start));
+        f32 coarsest_error = 0.0f;
+        for (Indexed_Mesh *level = &cube; level; level = level->next_lod) {
+            printf(" %u", level->index_count / 3);
+            coarsest_error = level->lod_error;
+        }
+        printf(" triangles, error %.4f at the coarsest\n", coarsest_error);
+    }
+
+    static Scene field;
+    static Scene city;
+    Indexed_Mesh building = CreateCubeMesh(&permanent); // stays a box with flat colors whatever the -mesh is
+    if (((scene == SCENE_FIELD || compare) && !CreateField(&field, &permanent, &cube)) ||
+        ((scene == SCENE_CITY || compare) && !CreateCity(&city, &permanent, &building, &cube))) {
+        fprintf(stderr, "couldn't create the scene\n");
+        return FAILURE;
+    }
+    CreateOcclusionBuffer(&field.occlusion, &permanent, width, height);
+    CreateOcclusionBuffer(&city.occlusion, &permanent, width, height);
+
+    if (compare) {
+        SetFramePipelining(&pipeline, M_FALSE); // the frame has to be done before looking at it
+        b8 same = M_TRUE;
+        for (int s = 0; s < SCENE_COUNT; ++s) {
+            Scene *world = s == SCENE_CITY ? &city : &field;
+            same = CompareRasterizers((Test_Scene)s, frame_count, &pipeline, &permanent, &cube, world, instanced) && same;
+        }
+        return same ? SUCCESS : FAILURE;
+    }
+    Scene *world = scene == SCENE_CITY ? &city : &field;
+
+    for (int frame = 0; frame < warmup_count; ++frame) {
+        RenderScene(scene, frame, &pipeline, &cube, world, instanced);
+    }
+
+#if PROFILER
+    // warmup frames stay out of the trace
+    init_profiler();
+    PROFILE_THREAD_NAME("main");
+#endif
+
+    Frame_Sample *samples = ARENA_PUSH_ARRAY(&permanent, Frame_Sample, frame_count);
+    for (int frame = 0; frame < frame_count; ++frame) {
+        f64 start_seconds = platform_get_seconds();
+        u64 start_cycles = __rdtsc();
+
+        // pipelined this is the time between two frames getting recorded, which is also how often one gets presented
+        PROFILE_BEGIN("frame");
+        RenderScene(scene, frame, &pipeline, &cube, world, instanced);
+        PROFILE_END("frame");
+
+        u64 end_cycles = __rdtsc();
+        f64 end_seconds = platform_get_seconds();
+        samples[frame].milliseconds = 1000.0 * (end_seconds - start_seconds);
+        samples[frame].megacycles = (f64)(end_cycles - start_cycles) / (1000.0 * 1000.0); // mcpf
+    }
+
+    SetFramePipelining(&pipeline, M_FALSE); // the last frame has to be done before looking at it
+
+    f64 *values = ARENA_PUSH_ARRAY(&permanent, f64, frame_count);
+    f64 total_megacycles = 0.0;
+    for (int frame = 0; frame < frame_count; ++frame) {
+        values[frame] = samples[frame].milliseconds;
+        total_megacycles += samples[frame].megacycles;
+    }
+    f64 min_ms = Percentile(values, frame_count, 0.0);
+    f64 median_ms = Percentile(values, frame_count, 50.0);
+    f64 p99_ms = Percentile(values, frame_count, 99.0);
+    for (int frame = 0; frame < frame_count; ++frame) {
+        values[frame] = samples[frame].megacycles;
+    }
+    f64 median_mcpf = Percentile(values, frame_count, 50.0);
+
+    printf("scene      %s %dx%d, %d frames (+%d warmup), %d threads, %s, %s, %s clear%s%s\n",
+           global_scene_names[scene], width, height, frame_count, warmup_count, thread_count,
+           global_render_mode == RENDER_MODE_TILED ? "tiled" : "serial", global_raster_simd ? "simd" : "scalar",
+           global_lazy_clear ? "lazy" : "full", pipelined ? ", pipelined" : "",
+           textured ? (filter == TEXTURE_FILTER_BILINEAR ? ", bilinear texture" : ", point texture")
+                    : gradient ? (perspective ? ", perspective gradient" : ", gradient") : (perspective ? ", perspective" : ""));
+    printf("frame ms   min %.3f  median %.3f  p99 %.3f\n", min_ms, median_ms, p99_ms);
+    printf("mcpf       mean %.3f  median %.3f\n", total_megacycles / (f64)frame_count, median_mcpf);
+    printf("triangles  %u submitted, %u rasterized, %u dropped with the frame arena full in the last frame\n",
+           global_cull_stats.submitted, global_cull_stats.passed, global_cull_stats.out_of_memory);
+    if (scene == SCENE_FIELD || scene == SCENE_CITY) {
+        printf("instances  %u in the scene, %u BVH nodes visited, %u tested, %u occluded by %u occluders, %u drawn in "
+               "%u draws (%u simplified) in the last frame\n", world->instance_count, world->stats.nodes_visited,
+               world->stats.instances_tested, world->stats.occluded, world->stats.occluders, world->stats.drawn,
+               world->stats.draws, world->stats.simplified);
+    }
+    printf("memory     permanent %.2f MB, frame arena high water %.2f MB, scratch high water %.2f MB\n",
+           (f64)permanent.used / (1024.0 * 1024.0), (f64)FrameArenaHighWater(&pipeline) / (1024.0 * 1024.0),
+           (f64)pipeline.scratch.high_water / (1024.0 * 1024.0));
+    printf("checksum   %08x\n", FramebufferChecksum(&buffer));
+    if (display.memory) {
+        printf("display    %dx%d, checksum %08x\n", display.width, display.height, FramebufferChecksum(&display));
+    }
+
+    if (ppm_path && !WritePpm(display.memory ? &display : &buffer, ppm_path)) {
+        fprintf(stderr, "could not write %s\n", ppm_path);
+        return FAILURE;
+    }
+#if PROFILER
+    if (trace_path && !write_chrome_trace(trace_path)) {
+        fprintf(stderr, "could not write %s\n", trace_path);
+        return FAILURE;
+    }
+#endif
+
+    return SUCCESS;
+}
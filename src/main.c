@@ -1,10 +1,23 @@
 #include "misc.h"
 #include "input.h"
 #include "my_math.h"
+#include "platform.h"
+#include "profiler.h"
+#include "arena.h"
 
-#include <windows.h>
 #include <dsound.h>
 
+#include "work_queue.h"
+#include "audio_mixer.h"
+#include "audio_thread.h"
+#include "texture.h"
+#include "renderer.h"
+#include "mesh_file.h"
+#include "mesh_lod.h"
+#include "occlusion.h"
+#include "frame_pipeline.h"
+#include "scene.h"
+
 //
 // constants
 //
@@ -25,49 +38,32 @@ typedef struct Tag_Window {
     int client_height;
 } Window;
 
-typedef struct Tag_Offscreen_Buffer {
-    BITMAPINFO info;
-    void *memory;
-    int width;
-    int height;
-    int pitch;
-    int bytes_per_pixel;
-} Offscreen_Buffer;
-
-typedef struct Tag_Sound_Output {
-    int samples_per_second;
-    int tone_hz;
-    i16 tone_volume;
-    u32 running_sample_index;
-    int wave_period;
-    int bytes_per_sample;
-    int secondary_buffer_size;
-    int latency_sample_count;
-} Sound_Output;
-
-typedef struct Tag_Color {
-    u8 r;
-    u8 g;
-    u8 b;
-} Color;
-
-typedef struct Tag_Vertex {
-    Vec3 position;
-    Color color;
-} Vertex;
-
-typedef struct Tag_Projected_Vertex {
-    Vec2I position;
-    Color color;
-} Projected_Vertex;
+#define SOUND_BYTES_PER_SAMPLE (2 * sizeof(i16))
+
+// platform part of the Audio_Sink that writes into the DirectSound ring buffer
+typedef struct Tag_Direct_Sound_Sink {
+    LPDIRECTSOUNDBUFFER buffer;
+    DWORD buffer_size; // in bytes
+    DWORD last_play_cursor;
+    u64 played_bytes;
+} Direct_Sound_Sink;
 
 //
 // globals
 //
 static b8 global_should_close = M_TRUE;
 static Offscreen_Buffer global_backbuffer;
+static Offscreen_Buffer global_display_buffer; // global_backbuffer scaled to the client area
 static Window global_window;
 static LPDIRECTSOUNDBUFFER global_sound_buffer;
+static Direct_Sound_Sink global_direct_sound_sink;
+static Audio_Sink global_audio_sink;
+static Audio_System global_audio;
+static Work_Queue global_work_queue;
+static Frame_Pipeline global_frame_pipeline;
+static Memory_Arena global_permanent_arena; // everything that lives as long as the program
+static Scene global_scene;
+static b8 global_pipelined_frames = M_TRUE; // F2 toggles, pipelined frames are presented one frame later
 
 #define DIRECT_SOUND_CREATE(name) HRESULT WINAPI name(LPCGUID pcGuidDevice, LPDIRECTSOUND *ppDS, LPUNKNOWN pUnkOuter)
 typedef DIRECT_SOUND_CREATE(Direct_Sound_Create);
@@ -129,180 +125,81 @@ b8 init_direct_sound(HWND window, int buffer_size, int samples_per_second) {
     return M_TRUE;
 }
 
-void fill_sound_buffer(Sound_Output *sound_output, DWORD byte_to_lock, DWORD bytes_to_write) {
+// only ever called from the audio thread
+AUDIO_SINK_PLAYED_SAMPLES(DirectSoundPlayedSamples) {
+    Direct_Sound_Sink *direct_sound = (Direct_Sound_Sink *)sink->platform;
+    DWORD play_cursor;
+    DWORD write_cursor;
+    if (SUCCEEDED(IDirectSoundBuffer_GetCurrentPosition(direct_sound->buffer, &play_cursor, &write_cursor))) {
+        DWORD delta = (play_cursor + direct_sound->buffer_size - direct_sound->last_play_cursor) % direct_sound->buffer_size;
+        direct_sound->played_bytes += delta;
+        direct_sound->last_play_cursor = play_cursor;
+    }
+    return direct_sound->played_bytes / SOUND_BYTES_PER_SAMPLE;
+}
+
+AUDIO_SINK_WRITE(DirectSoundWrite) {
+    Direct_Sound_Sink *direct_sound = (Direct_Sound_Sink *)sink->platform;
+    DWORD byte_to_lock = (DWORD)((position * SOUND_BYTES_PER_SAMPLE) % direct_sound->buffer_size);
+    DWORD bytes_to_write = (DWORD)(sample_count * SOUND_BYTES_PER_SAMPLE);
+
     VOID *region1;
     DWORD region1_size;
     VOID *region2;
     DWORD region2_size;
-    if (SUCCEEDED(IDirectSoundBuffer_Lock(global_sound_buffer,
+    if (SUCCEEDED(IDirectSoundBuffer_Lock(direct_sound->buffer,
                                           byte_to_lock,
                                           bytes_to_write,
                                           &region1, &region1_size,
                                           &region2, &region2_size,
                                           0))) {
-
-        i16 *sample_out = (i16 *)region1;
-        DWORD region1_sample_count = region1_size / sound_output->bytes_per_sample;
-        for (DWORD sample_index = 0; sample_index < region1_sample_count; ++sample_index) {
-            f32 t = (f32)sound_output->running_sample_index / (f32)sound_output->wave_period;
-            f32 sin_value = m_sin(t);
-            i16 sample_value = (i16)(sin_value * sound_output->tone_volume);
-            *sample_out++ = sample_value;
-            *sample_out++ = sample_value;
-
-            ++sound_output->running_sample_index;
-        }
-
-        sample_out = (i16 *)region2;
-        DWORD region2_sample_count = region2_size / sound_output->bytes_per_sample;
-        for (DWORD sample_index = 0; sample_index < region2_sample_count; ++sample_index) {
-            f32 t = (f32)sound_output->running_sample_index / (f32)sound_output->wave_period;
-            f32 sin_value = m_sin(t);
-            i16 sample_value = (i16)(sin_value * sound_output->tone_volume);
-            *sample_out++ = sample_value;
-            *sample_out++ = sample_value;
-
-            ++sound_output->running_sample_index;
-        }
-
-        IDirectSoundBuffer_Unlock(global_sound_buffer, region1, region1_size, region2, region2_size);
-    }
-}
-
-inline Vec2I ToPixelPosition(float x, float y, int width, int height) {
-    Vec2I result;
-    result.x = (int)((x + 1.0f) / 2.0f * (float)width);
-    result.y = (int)((y + 1.0f) / 2.0f * (float)height);
-    return result;
-}
-
-inline b8 IsTopLeft(Vec2I edge) {
-    return edge.y < 0 || (edge.x > 0 && edge.y == 0);
-}
-    
-int EdgeCross(Vec2I minuend0, Vec2I minuend1, Vec2I subtrahend) {
-    Vec2I difference0 = vec2i_sub(minuend0, subtrahend);
-    Vec2I difference1 = vec2i_sub(minuend1, subtrahend);
-    
-    return difference0.x * difference1.y - difference0.y * difference1.x;
-}
-
-void RenderTriangleToBuffer(Offscreen_Buffer *buffer, Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2) {
-    int x_min = MAX(MIN(MIN(v0.position.x, v1.position.x), v2.position.x), 0);
-    int y_min = MAX(MIN(MIN(v0.position.y, v1.position.y), v2.position.y), 0);
-    int x_max = MIN(MAX(MAX(v0.position.x, v1.position.x), v2.position.x), buffer->width-1);
-    int y_max = MIN(MAX(MAX(v0.position.y, v1.position.y), v2.position.y), buffer->height-1);
-
-    int bias0 = IsTopLeft(vec2i_sub(v2.position, v1.position)) ? 0 : -1;
-    int bias1 = IsTopLeft(vec2i_sub(v0.position, v2.position)) ? 0 : -1;
-    int bias2 = IsTopLeft(vec2i_sub(v1.position, v0.position)) ? 0 : -1;
-    
-    int area = EdgeCross(v1.position, v2.position, v0.position);
-    
-    Vec2I p_start = { x_min, y_min };
-    int w0 = EdgeCross(v2.position, p_start, v1.position) + bias0;
-    int w1 = EdgeCross(v0.position, p_start, v2.position) + bias1;
-    int w2 = EdgeCross(v1.position, p_start, v0.position) + bias2;
-    
-    int delta_w0_x = v1.position.y - v2.position.y;
-    int delta_w1_x = v2.position.y - v0.position.y;
-    int delta_w2_x = v0.position.y - v1.position.y;
-    int delta_w0_y = (v2.position.x - v1.position.x) + ((x_min - x_max) * (v1.position.y - v2.position.y));
-    int delta_w1_y = (v0.position.x - v2.position.x) + ((x_min - x_max) * (v2.position.y - v0.position.y));
-    int delta_w2_y = (v1.position.x - v0.position.x) + ((x_min - x_max) * (v0.position.y - v1.position.y));
-    
-    u32 *pixel = (u32 *)buffer->memory;
-    for (int y = y_min; y <= y_max; ++y) {
-        for (int x = x_min; x <= x_max; ++x) {
-            b8 inside_triangle = w0 >= 0 && w1 >= 0 && w2 >= 0;
-            
-            if (inside_triangle) {
-                float alpha = (float)w0 / (float)area;
-                float beta  = (float)w1 / (float)area;
-                float gamma = (float)w2 / (float)area;
-                
-                u32 a = 0xFF;
-                u32 r = (u32)(alpha * v0.color.r + beta * v1.color.r + gamma * v2.color.r);
-                u32 g = (u32)(alpha * v0.color.g + beta * v1.color.g + gamma * v2.color.g);
-                u32 b = (u32)(alpha * v0.color.b + beta * v1.color.b + gamma * v2.color.b);
-                
-                pixel[x + y * buffer->width] = a << 24 | r << 16 | g << 8 | b;
-            }
-            
-            if (x == x_max) continue; // @note: this is needed because else the w_s are off by 1 * delta_w[0,1,2]_x for the rest of the loop
-            w0 += delta_w0_x;
-            w1 += delta_w1_x;
-            w2 += delta_w2_x;
-        }
-        
-        w0 += delta_w0_y;
-        w1 += delta_w1_y;
-        w2 += delta_w2_y;
+        memcpy(region1, samples, region1_size);
+        memcpy(region2, (u8 *)samples + region1_size, region2_size);
+        IDirectSoundBuffer_Unlock(direct_sound->buffer, region1, region1_size, region2, region2_size);
     }
 }
 
-void RenderMeshToBuffer(Offscreen_Buffer *buffer, Projected_Vertex mesh[], u32 size) {
-    Projected_Vertex triangle[3];
-
-    triangle[0] = mesh[0]; // dont call RenderTriangleToBuffer with i == 0
-    for (u32 i = 1; i < size; ++i) {
-        if (i % 3 == 0) {
-            RenderTriangleToBuffer(buffer, triangle[0], triangle[1], triangle[2]);
-        }
-        triangle[i % 3] = mesh[i];
-    }
-    RenderTriangleToBuffer(buffer, triangle[0], triangle[1], triangle[2]);
-}
-
-void ClearFramebuffer(Offscreen_Buffer *buffer, u32 color) {
-    if (!buffer->memory) return;
-    
-    int bitmap_size = buffer->width * buffer->height;
-    
-    u32 *pixel = (u32 *)buffer->memory;
-    for (int i = 0; i < bitmap_size; ++i) {
-        pixel[i] = color;
-    }
-}
-
-void CreateFramebuffer(Offscreen_Buffer *buffer, int width, int height) {
-    if (buffer->memory) {
-        return;
-    }
-    
-    buffer->width  = width;
-    buffer->height = height;
-    buffer->bytes_per_pixel = 4;
-
-    buffer->info.bmiHeader.biSize = sizeof(buffer->info.bmiHeader);
-    buffer->info.bmiHeader.biWidth = buffer->width;
-    buffer->info.bmiHeader.biHeight = -buffer->height; // '-' becaues I want top down dib (origin at top left corner)
-    buffer->info.bmiHeader.biPlanes = 1;
-    buffer->info.bmiHeader.biBitCount = 32;
-    buffer->info.bmiHeader.biCompression = BI_RGB;
-    //bitmap_info.bmiHeader.biSizeImage = 0;
-    //bitmap_info.bmiHeader.biXPelsPerMeter = 0;
-    //bitmap_info.bmiHeader.biYPelsPerMeter = 0;
-    //bitmap_info.bmiHeader.biClrUsed = 0;
-    //bitmap_info.bmiHeader.biClrImportant = 0;
-
-    int bitmap_memory_size = buffer->bytes_per_pixel * buffer->width * buffer->height;
-    buffer->memory = VirtualAlloc(NULL, bitmap_memory_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-
-    buffer->pitch = buffer->width * buffer->bytes_per_pixel;
-
-    ClearFramebuffer(buffer, 0);
+void init_direct_sound_sink(Audio_Sink *sink, Direct_Sound_Sink *direct_sound, LPDIRECTSOUNDBUFFER buffer,
+                            DWORD buffer_size, int samples_per_second) {
+    direct_sound->buffer = buffer;
+    direct_sound->buffer_size = buffer_size;
+    direct_sound->last_play_cursor = 0;
+    direct_sound->played_bytes = 0;
+
+    sink->played_samples = DirectSoundPlayedSamples;
+    sink->write = DirectSoundWrite;
+    sink->samples_per_second = samples_per_second;
+    sink->file = 0;
+    sink->platform = direct_sound;
 }
 
 void CopyBufferToDisplay(Offscreen_Buffer *buffer, HDC device_context, int canvas_width, int canvas_height) {
-    // @todo: aspect ratio correction
-    StretchDIBits(
+    // tiles nothing got drawn to are still waiting for their clear
+    ResolveClears(buffer);
+
+    // scaling ourselves keeps the pixels square and the image the same on every platform, GDI only copies
+    ResizeDisplayBuffer(&global_display_buffer, canvas_width, canvas_height);
+    UpscaleBuffer(&global_display_buffer, buffer, 0x000000, &global_work_queue);
+
+    BITMAPINFO info = {0};
+    info.bmiHeader.biSize = sizeof(info.bmiHeader);
+    info.bmiHeader.biWidth = global_display_buffer.width;
+    info.bmiHeader.biHeight = -global_display_buffer.height; // '-' becaues I want top down dib (origin at top left corner)
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+
+    SetDIBitsToDevice(
         device_context,
-        0, 0, canvas_width, canvas_height, // destination
-        0, 0, buffer->width, buffer->height, // source
-        buffer->memory,
-        &buffer->info,
-        DIB_RGB_COLORS, SRCCOPY);
+        0, 0, global_display_buffer.width, global_display_buffer.height, // destination
+        0, 0, 0, global_display_buffer.height, // source, all scan lines
+        global_display_buffer.memory,
+        &info,
+        DIB_RGB_COLORS);
+}
+
+FRAME_PRESENT_CALLBACK(PresentToWindow) {
+    CopyBufferToDisplay(buffer, (HDC)data, global_window.client_width, global_window.client_height);
 }
 
 LRESULT CALLBACK main_window_callback(HWND w_handle, UINT message, WPARAM wparam, LPARAM lparam) {
@@ -336,7 +233,10 @@ LRESULT CALLBACK main_window_callback(HWND w_handle, UINT message, WPARAM wparam
             HDC device_context = BeginPaint(w_handle, &paint);
             int width = paint.rcPaint.right - paint.rcPaint.left;
             int height = paint.rcPaint.bottom - paint.rcPaint.top;
-            CopyBufferToDisplay(&global_backbuffer, device_context, width, height);
+            // the render thread owns the buffers and presents often enough anyway
+            if (!global_frame_pipeline.pipelined) {
+                CopyBufferToDisplay(&global_backbuffer, device_context, width, height);
+            }
             EndPaint(w_handle, &paint);
         } break;
 
@@ -461,6 +361,10 @@ void platform_process_events(void) {
                         process_key_event(SPACE, key_state, &event_reader);
                     } break;
 
+                    case VK_F2: {
+                        if (is_down && !repeated) global_pipelined_frames = !global_pipelined_frames;
+                    } break;
+
                     case VK_F4: {
                         if (alt_down) global_should_close = M_TRUE;
                     } break;
@@ -486,6 +390,10 @@ int CALLBACK WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR cmd_line,
     LARGE_INTEGER perf_count_frequency_result;
     QueryPerformanceFrequency(&perf_count_frequency_result);
     i64 perf_count_frequency = perf_count_frequency_result.QuadPart;
+#if PROFILER
+    init_profiler();
+    PROFILE_THREAD_NAME("main");
+#endif
 
     //
     // creating window
@@ -493,12 +401,25 @@ int CALLBACK WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR cmd_line,
     if (!PlatformCreateWindow(instance, WIDTH, HEIGHT, "3D Software Renderer")) {
         return FAILURE;
     }
-    CreateFramebuffer(&global_backbuffer, PIXELS_X, PIXELS_Y);
+    if (!CreateArena(&global_permanent_arena, "permanent", PERMANENT_ARENA_RESERVE)) {
+        return FAILURE;
+    }
+    CreateFramebuffer(&global_backbuffer, &global_permanent_arena, PIXELS_X, PIXELS_Y);
+
+    //
+    // worker threads
+    //
+    InitWorkQueue(&global_work_queue, platform_processor_count() - 1);
+    CreateTileBinner(&global_tile_binner, &global_permanent_arena, &global_work_queue, PIXELS_X, PIXELS_Y);
 
     //
     // loop preparation
     //
     HDC device_context = GetDC(global_window.handle);
+    if (!InitFramePipeline(&global_frame_pipeline, &global_backbuffer, PresentToWindow, device_context)) {
+        return FAILURE;
+    }
+    global_lazy_clear = M_TRUE;
 
     global_should_close = M_FALSE;
 
@@ -510,18 +431,22 @@ int CALLBACK WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR cmd_line,
     double fps = 0.0;
     double mcpf = 0.0;
 
-    Sound_Output sound_output = {0};
-    sound_output.samples_per_second = 48000;
-    sound_output.tone_hz = 256;
-    sound_output.tone_volume = 2000;
-    sound_output.wave_period = sound_output.samples_per_second / sound_output.tone_hz;
-    sound_output.bytes_per_sample = sizeof(i16) * 2;
-    sound_output.secondary_buffer_size = sound_output.samples_per_second * sound_output.bytes_per_sample;
-    sound_output.latency_sample_count = sound_output.samples_per_second / 15;
-
-    init_direct_sound(global_window.handle, sound_output.secondary_buffer_size, sound_output.samples_per_second);
-    fill_sound_buffer(&sound_output, 0, sound_output.latency_sample_count * sound_output.bytes_per_sample);
-    IDirectSoundBuffer_Play(global_sound_buffer, 0, 0, DSBPLAY_LOOPING);
+    int samples_per_second = 48000;
+    DWORD sound_buffer_size = (DWORD)(samples_per_second * SOUND_BYTES_PER_SAMPLE);
+    if (init_direct_sound(global_window.handle, sound_buffer_size, samples_per_second)) {
+        init_direct_sound_sink(&global_audio_sink, &global_direct_sound_sink, global_sound_buffer,
+                               sound_buffer_size, samples_per_second);
+        IDirectSoundBuffer_Play(global_sound_buffer, 0, 0, DSBPLAY_LOOPING);
+    }
+    else {
+        // no sound card, keep the audio thread running anyway
+        init_null_sink(&global_audio_sink, samples_per_second);
+    }
+    init_audio_system(&global_audio, &global_audio_sink, samples_per_second / 30);
+    audio_play_tone(&global_audio, 256.0f, 0.09f, 0.0f); // test tone
+    // Sleep() only wakes on the timer tick, 15.6 ms by default, the audio thread wants to wake every 2 ms
+    timeBeginPeriod(1);
+    start_audio_thread(&global_audio);
 
     /* Vertex pyramid[] = { */
     /*     { { -1.0f, -1.0f, -1.0f }, {255, 0, 0} }, */
@@ -541,143 +466,75 @@ int CALLBACK WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR cmd_line,
     /*     { {  1.0f, -1.0f, -1.0f }, {255, 255, 0} } */
     /* }; */
 
-    Vertex cube[] = {{{ -1.0f, -1.0f, -1.0f }, { 255, 0, 0 }},
-                     {{  1.0f, -1.0f, -1.0f }, { 255, 0, 0 }},
-                     {{ -1.0f,  1.0f, -1.0f }, { 255, 0, 0 }},
-
-                     {{  1.0f, -1.0f, -1.0f }, { 255, 0, 0 }},
-                     {{  1.0f,  1.0f, -1.0f }, { 255, 0, 0 }},
-                     {{ -1.0f,  1.0f, -1.0f }, { 255, 0, 0 }},
-
-                     {{  1.0f, -1.0f, -1.0f }, { 255, 255, 0 }},
-                     {{  1.0f, -1.0f,  1.0f }, { 255, 255, 0 }},
-                     {{  1.0f,  1.0f, -1.0f }, { 255, 255, 0 }},
-
-                     {{  1.0f, -1.0f,  1.0f }, { 255, 255, 0 }},
-                     {{  1.0f,  1.0f,  1.0f }, { 255, 255, 0 }},
-                     {{  1.0f,  1.0f, -1.0f }, { 255, 255, 0 }},
-
-                     {{  1.0f, -1.0f,  1.0f }, { 255, 0, 255 }},
-                     {{ -1.0f, -1.0f,  1.0f }, { 255, 0, 255 }},
-                     {{  1.0f,  1.0f,  1.0f }, { 255, 0, 255 }},
-
-                     {{ -1.0f, -1.0f,  1.0f }, { 255, 0, 255 }},
-                     {{ -1.0f,  1.0f,  1.0f }, { 255, 0, 255 }},
-                     {{  1.0f,  1.0f,  1.0f }, { 255, 0, 255 }},
-
-                     {{ -1.0f, -1.0f,  1.0f }, { 0, 255, 0 }},
-                     {{ -1.0f, -1.0f, -1.0f }, { 0, 255, 0 }},
-                     {{ -1.0f,  1.0f,  1.0f }, { 0, 255, 0 }},
-
-                     {{ -1.0f, -1.0f, -1.0f }, { 0, 255, 0 }},
-                     {{ -1.0f,  1.0f, -1.0f }, { 0, 255, 0 }},
-                     {{ -1.0f,  1.0f,  1.0f }, { 0, 255, 0 }},
-
-                     {{  1.0f,  1.0f,  1.0f }, { 0, 255, 255 }},
-                     {{ -1.0f,  1.0f,  1.0f }, { 0, 255, 255 }},
-                     {{  1.0f,  1.0f, -1.0f }, { 0, 255, 255 }},
-
-                     {{ -1.0f,  1.0f,  1.0f }, { 0, 255, 255 }},
-                     {{ -1.0f,  1.0f, -1.0f }, { 0, 255, 255 }},
-                     {{  1.0f,  1.0f, -1.0f }, { 0, 255, 255 }},
-
-                     {{  1.0f, -1.0f, -1.0f }, { 0, 0, 255 }},
-                     {{ -1.0f, -1.0f, -1.0f }, { 0, 0, 255 }},
-                     {{  1.0f, -1.0f,  1.0f }, { 0, 0, 255 }},
-
-                     {{ -1.0f, -1.0f, -1.0f }, { 0, 0, 255 }},
-                     {{ -1.0f, -1.0f,  1.0f }, { 0, 0, 255 }},
-                     {{  1.0f, -1.0f,  1.0f }, { 0, 0, 255 }}};
+    // a .mesh file on the command line replaces the cube, made by obj_convert -fit
+    Indexed_Mesh cube = CreateCubeMesh(&global_permanent_arena);
+    static Texture cube_texture;
+    b8 have_texture = CreateCheckerTexture(&cube_texture, &global_permanent_arena, &global_frame_pipeline.scratch, 256, 8, 0xFFE0E0E0, 0xFF303030, TEXTURE_FILTER_BILINEAR);
+    Mesh_File mesh_file = {0};
+    if (cmd_line && cmd_line[0] && LoadMeshFile(&mesh_file, cmd_line, &cube)) {
+        if (have_texture && cube.varying_count >= 2) cube.texture = &cube_texture;
+    }
+    else if (have_texture) {
+        TextureCubeMesh(&cube, &cube_texture);
+    }
+    BuildMeshLods(&cube, &global_permanent_arena, &global_frame_pipeline.scratch); // the cube itself has none
     
     float n = 0.1f;
     float f = 100.0f;
     float width = (float)global_backbuffer.width;
     float height = (float)global_backbuffer.height;
-    Mat4 view  = LookAt(0.0f, 2.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+    Mat4 view4 = LookAt(0.0f, 2.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+    Mat3x4 view = mat3x4_from_mat4(&view4);
     Mat4 proj  = perspective_projection(0.25f, width / height, n, f);
     //Mat4 proj  = ortho_projection(-2.0f, 2.0f, -2.0f, 2.0f, n, f);
 
+    // the model spins above a floor of small static cubes that mostly lies outside the view
+    Indexed_Mesh floor_cube = CreateCubeMesh(&global_permanent_arena);
+    if (have_texture) TextureCubeMesh(&floor_cube, &cube_texture);
+    if (!CreateScene(&global_scene, &global_permanent_arena, 1 + 64 * 64)) {
+        return FAILURE;
+    }
+    Mat3x4 model = mat3x4_identity();
+    u32 model_instance = AddSceneInstance(&global_scene, &cube, &model, M_FALSE);
+    if (!mesh_file.memory) SetSceneOccluder(&global_scene, model_instance, &cube); // a loaded mesh doesn't have to contain the cube
+    for (int z = 0; z < 64; ++z) {
+        for (int x = 0; x < 64; ++x) {
+            Mat4 floor4 = translate(1.5f * (float)x - 47.25f, -1.6f, 1.5f * (float)z - 47.25f);
+            for (int i = 0; i < 3; ++i) floor4.e[i][i] = 0.25f;
+            Mat3x4 floor_model = mat3x4_from_mat4(&floor4);
+            AddSceneInstance(&global_scene, &floor_cube, &floor_model, M_TRUE);
+        }
+    }
+    BuildSceneBvh(&global_scene);
+    CreateOcclusionBuffer(&global_scene.occlusion, &global_permanent_arena, PIXELS_X, PIXELS_Y);
+
     float t = 0.0f;
     
     while (!global_should_close) {
         float delta_time = (float)frame_time / 1000.0f;
+        PROFILE_BEGIN("frame");
         
         platform_process_events();
+        SetFramePipelining(&global_frame_pipeline, global_pipelined_frames);
         
-        ClearFramebuffer(&global_backbuffer, 0x222222);
+        // waits for the render thread if it is still busy with the frame before the last one
+        Frame_Packet *packet = BeginFrame(&global_frame_pipeline, 0x222222, 1.0f);
 
         //
         // graphics test
         //
         // transformations in the order: scale -> rotate -> translate
-        Mat4 model = mat4_mul(translate(0.0f, 0.0f, 0.0f), rotate_y(t));
-        Mat4 mvp = mat4_mul3(proj, view, model);
+        Mat4 model4 = mat4_mul(translate(0.0f, 0.0f, 0.0f), rotate_y(t));
+        model = mat3x4_from_mat4(&model4);
+        MoveSceneInstance(&global_scene, model_instance, &model);
         t += delta_time * 0.5f;
         
-        Projected_Vertex mesh[36];
-
-        // Vertex processing
-        for (int i = 0; i < SIZE(cube); ++i) {
-            Vec4 edge = { cube[i].position.x,
-                          cube[i].position.y,
-                          cube[i].position.z,
-                          1.0f };
-            Vec4 result = mat4_vec4_mul(mvp, edge);
-
-            // Vertex post-processing
-            // -> clipping
-            
-            
-            // -> perspective divide
-            Vec3 ndc;
-            if (result.value.w != 0.0f) {
-                ndc.x = result.value.x / result.value.w;
-                ndc.y = -result.value.y / result.value.w;
-                ndc.z = result.value.z / result.value.w;
-            }
-            else {
-                ndc.x = result.value.x;
-                ndc.y = -result.value.y;
-                ndc.z = result.value.z;
-            }
-            
-            // -> viewport transform
-            Vec3I viewport_position = { (int)(width / 2 * ndc.x + width / 2),
-                                        (int)(height / 2 * ndc.y + height / 2),
-                                        (int)((f - n) / 2.0f * ndc.z + (f + n) / 2.0f) };
-
-            mesh[i].position.x = viewport_position.x;
-            mesh[i].position.y = viewport_position.y;
-            mesh[i].color = cube[i].color;
-        }
-
-        RenderMeshToBuffer(&global_backbuffer, mesh, SIZE(mesh));
-        
-        // Fragment processing
-        // @todo
+        // everything outside the view is culled before its vertices get transformed
+        DrawScene(packet, &global_backbuffer, &global_scene, &proj, &view);
         
-        CopyBufferToDisplay(&global_backbuffer, device_context, global_window.client_width,
-                            global_window.client_height);
-        
-        //
-        // audio test
-        //
-        DWORD play_cursor;
-        DWORD write_cursor;
-        if (SUCCEEDED(IDirectSoundBuffer_GetCurrentPosition(global_sound_buffer, &play_cursor, &write_cursor) )) {
-            DWORD byte_to_lock = (sound_output.running_sample_index * sound_output.bytes_per_sample) % sound_output.secondary_buffer_size;
-            DWORD target_cursor = (play_cursor + (sound_output.latency_sample_count * sound_output.bytes_per_sample)) % sound_output.secondary_buffer_size;
-            DWORD bytes_to_write;
-            if (byte_to_lock > target_cursor) {
-                bytes_to_write = sound_output.secondary_buffer_size - byte_to_lock;
-                bytes_to_write += target_cursor;
-            }
-            else {
-                bytes_to_write = target_cursor - byte_to_lock;
-            }
-            
-            fill_sound_buffer(&sound_output, byte_to_lock, bytes_to_write);
-        }
+        // rasterizes and presents now or, pipelined, on the render thread while we do the next frame
+        EndFrame(&global_frame_pipeline);
+        PROFILE_END("frame");
         
         //
         // performance metrics
@@ -695,6 +552,14 @@ int CALLBACK WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR cmd_line,
         last_counter = end_counter;
         last_cycle_count = end_cycle_count;
     }
+
+    SetFramePipelining(&global_frame_pipeline, M_FALSE);
+    UnloadMeshFile(&mesh_file);
+    stop_audio_thread(&global_audio);
+    timeEndPeriod(1);
+#if PROFILER
+    write_chrome_trace("trace.json"); // the last PROFILER_EVENTS_PER_THREAD zone boundaries of every thread
+#endif
     
     return SUCCESS;
 }
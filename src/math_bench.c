@@ -0,0 +1,161 @@
+/*
+* Microbenchmark for the matrix functions in my_math.h.
+*
+* Composes model * view * projection for a lot of objects the way a scene
+* would every frame, once with the scalar by value functions, once with the
+* SSE pointer variants and once with the affine fast path, and checks that
+* the results agree. Also sweeps sin and cos across the quadrant
+* boundaries, where the table lookups mirror (build it with
+* -fsanitize=address to catch reads past the table).
+*/
+
+#include "misc.h"
+#include "my_math.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define OBJECT_COUNT 4096
+#define REPEAT_COUNT 200
+
+static Mat4 global_models[OBJECT_COUNT];
+static Mat4 global_results[OBJECT_COUNT];
+static Mat3x4 global_models_affine[OBJECT_COUNT];
+static Mat4 global_references[OBJECT_COUNT];
+
+// == per element instead of memcmp, the SSE versions may round a zero to the other sign
+b8 results_equal_references(void) {
+    for (int i = 0; i < OBJECT_COUNT; ++i) {
+        for (int row = 0; row < 4; ++row) {
+            for (int column = 0; column < 4; ++column) {
+                if (global_results[i].e[row][column] != global_references[i].e[row][column]) return M_FALSE;
+            }
+        }
+    }
+    return M_TRUE;
+}
+
+float checksum(void) {
+    float sum = 0.0f;
+    for (int i = 0; i < OBJECT_COUNT; ++i) {
+        for (int row = 0; row < 4; ++row) {
+            for (int column = 0; column < 4; ++column) {
+                sum += global_results[i].e[row][column];
+            }
+        }
+    }
+    return sum;
+}
+
+void report(char *name, f64 seconds, f64 baseline) {
+    f64 ns_per_object = seconds * 1e9 / ((f64)OBJECT_COUNT * REPEAT_COUNT);
+    printf("%-28s %8.2f ns/object  %5.2fx  (checksum %f)\n", name, ns_per_object, baseline / seconds, checksum());
+}
+
+// Every quarter turn in [-4, 4] and a few floats to either side of it, where the table lookups mirror and
+// the quadrant of m_sincos changes. Returns the max absolute error against double precision.
+float sweep_quadrant_boundaries(void) {
+    float max_error = 0.0f;
+    for (int quarter = -16; quarter <= 16; ++quarter) {
+        float below = 0.25f * (float)quarter;
+        float above = below;
+        for (int step = 0; step <= 4; ++step) {
+            float turns[2] = { below, above };
+            for (int i = 0; i < 2; ++i) {
+                f64 radians = 2.0 * 3.14159265358979323846 * (f64)turns[i];
+                float sin_value;
+                float cos_value;
+                m_sincos(turns[i], &sin_value, &cos_value);
+                max_error = MAX(max_error, (float)fabs(sin_value - sin(radians)));
+                max_error = MAX(max_error, (float)fabs(cos_value - cos(radians)));
+                max_error = MAX(max_error, (float)fabs(m_sin(turns[i]) - sin(radians)));
+                max_error = MAX(max_error, (float)fabs(m_cos(turns[i]) - cos(radians)));
+            }
+            below = nextafterf(below, -INFINITY);
+            above = nextafterf(above, INFINITY);
+        }
+    }
+    return max_error;
+}
+
+int main(void) {
+    for (int i = 0; i < OBJECT_COUNT; ++i) {
+        float t = (float)i / OBJECT_COUNT;
+        global_models[i] = mat4_mul3(translate(t * 10.0f, 0.0f, -t * 5.0f), rotate_y(t), rotate_x(0.5f * t));
+    }
+    Mat4 view = LookAt(0.0f, 2.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+    Mat4 proj = perspective_projection(0.25f, 16.0f / 9.0f, 0.1f, 100.0f);
+
+    // scalar, by value
+    f64 start = platform_get_seconds();
+    for (int repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        for (int i = 0; i < OBJECT_COUNT; ++i) {
+            global_results[i] = mat4_mul3(proj, view, global_models[i]);
+        }
+    }
+    f64 scalar_seconds = platform_get_seconds() - start;
+    report("mat4_mul3", scalar_seconds, scalar_seconds);
+    memcpy(global_references, global_results, sizeof(global_results));
+
+    // SSE, by pointer
+    start = platform_get_seconds();
+    for (int repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        for (int i = 0; i < OBJECT_COUNT; ++i) {
+            mat4_mul3_ptr(global_results + i, &proj, &view, global_models + i);
+        }
+    }
+    report("mat4_mul3_ptr", platform_get_seconds() - start, scalar_seconds);
+    if (!results_equal_references()) {
+        printf("mat4_mul3_ptr does not match mat4_mul3\n");
+        return FAILURE;
+    }
+
+    // affine, view * model stays 3x4 and only the projection is a full 4x4
+    Mat3x4 view_affine = mat3x4_from_mat4(&view);
+    for (int i = 0; i < OBJECT_COUNT; ++i) {
+        global_models_affine[i] = mat3x4_from_mat4(global_models + i);
+    }
+    start = platform_get_seconds();
+    for (int repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+        for (int i = 0; i < OBJECT_COUNT; ++i) {
+            Mat3x4 model_view;
+            mat3x4_mul(&model_view, &view_affine, global_models_affine + i);
+            mat4_mul_mat3x4(global_results + i, &proj, &model_view);
+        }
+    }
+    report("mat3x4_mul + mat4_mul_mat3x4", platform_get_seconds() - start, scalar_seconds);
+
+    // the affine path multiplies in a different order, so only close, not equal
+    float max_error = 0.0f;
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            float error = fabsf(global_references[OBJECT_COUNT - 1].e[row][column] - global_results[OBJECT_COUNT - 1].e[row][column]);
+            max_error = MAX(max_error, error);
+        }
+    }
+    printf("affine max error %g\n", max_error);
+
+    // inverse round trip
+    Mat3x4 inverse;
+    Mat3x4 round_trip;
+    mat3x4_inverse(&inverse, global_models_affine + OBJECT_COUNT - 1);
+    mat3x4_mul(&round_trip, &inverse, global_models_affine + OBJECT_COUNT - 1);
+    Mat3x4 identity = mat3x4_identity();
+    max_error = 0.0f;
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            max_error = MAX(max_error, fabsf(round_trip.e[row][column] - identity.e[row][column]));
+        }
+    }
+    printf("inverse round trip max error %g\n", max_error);
+
+    float boundary_error = sweep_quadrant_boundaries();
+    printf("sin/cos quadrant boundaries max error %g\n", boundary_error);
+    if (boundary_error > 1e-5f) {
+        printf("sin/cos are off at a quadrant boundary\n");
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,210 @@
+/*
+* Binary mesh files.
+*
+* A .mesh file is an Indexed_Mesh the way it sits in memory: a header and
+* then the sections, every one of them MESH_FILE_ALIGNMENT aligned:
+*
+*     Mesh_File_Header
+*     Vertex vertices[vertex_count]
+*     f32 positions[3][padded_vertex_count] // x, y, z streams, BuildPositionStreams()
+*     f32 varyings[vertex_count * varying_count] // optional
+*     u16 or u32 indices[index_count]
+*
+* LoadMeshFile() maps the file and points the mesh into the mapping, so
+* nothing gets parsed or copied and the pages are loaded when the renderer
+* first touches them (the bounds are in the header for that reason). The
+* header is checked, the contents are trusted, the files are meant to come
+* from obj_convert. Files are only valid for the
+* architecture they were written on (little endian, the Vertex layout of
+* this compiler), vertex_size catches the most likely mismatch.
+*/
+
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <stdio.h>
+
+#define MESH_FILE_MAGIC 0x4853454D // "MESH" in the first four bytes
+#define MESH_FILE_VERSION 2
+#define MESH_FILE_ALIGNMENT 64
+
+typedef struct Tag_Mesh_File_Header {
+    u32 magic;
+    u32 version;
+    u32 header_size;
+    u32 vertex_size; // sizeof(Vertex) of the writer
+
+    u32 vertex_count;
+    u32 padded_vertex_count; // length of every position stream
+    u32 index_count;
+    u32 index_type;    // Index_Type
+    u32 varying_count; // per vertex, 0 if there are none
+    u32 flags;         // MESH_FILE_PERSPECTIVE_VARYINGS
+    Mesh_Bounds bounds; // so loading doesn't have to touch the vertices
+
+    // from the start of the file
+    u64 vertices_offset;
+    u64 positions_offset;
+    u64 varyings_offset; // 0 without varyings
+    u64 indices_offset;
+    u64 file_size;
+} Mesh_File_Header;
+
+#define MESH_FILE_PERSPECTIVE_VARYINGS 1
+
+typedef struct Tag_Mesh_File {
+    void *memory; // the mapping, the mesh points into it
+    size_t size;
+} Mesh_File;
+
+inline u64 AlignMeshFileOffset(u64 offset) {
+    return (offset + MESH_FILE_ALIGNMENT - 1) & ~(u64)(MESH_FILE_ALIGNMENT - 1);
+}
+
+inline b8 MeshFileSectionFits(u64 offset, u64 size, u64 file_size) {
+    return offset % MESH_FILE_ALIGNMENT == 0 && offset <= file_size && size <= file_size - offset;
+}
+
+// The mesh stays valid until UnloadMeshFile(), it points into read-only memory.
+b8 LoadMeshFile(Mesh_File *file, char *path, Indexed_Mesh *mesh) {
+    file->memory = platform_map_file(path, &file->size);
+    if (!file->memory) return M_FALSE;
+
+    Mesh_File_Header *header = (Mesh_File_Header *)file->memory;
+    b8 valid = file->size >= sizeof(Mesh_File_Header) &&
+               header->magic == MESH_FILE_MAGIC &&
+               header->version == MESH_FILE_VERSION &&
+               header->header_size == sizeof(Mesh_File_Header) &&
+               header->vertex_size == sizeof(Vertex) &&
+               header->file_size == file->size &&
+               (header->index_type == INDEX_U16 || header->index_type == INDEX_U32) &&
+               header->index_count % 3 == 0 &&
+               header->padded_vertex_count == ((header->vertex_count + 3) & ~3u) &&
+               header->varying_count <= MAX_VARYINGS &&
+               (header->varying_count == 0 || header->varyings_offset != 0);
+    if (valid) {
+        u64 index_size = header->index_type == INDEX_U16 ? sizeof(u16) : sizeof(u32);
+        valid = MeshFileSectionFits(header->vertices_offset, (u64)header->vertex_count * sizeof(Vertex), file->size) &&
+                MeshFileSectionFits(header->positions_offset, 3ull * header->padded_vertex_count * sizeof(f32), file->size) &&
+                MeshFileSectionFits(header->indices_offset, (u64)header->index_count * index_size, file->size) &&
+                (header->varying_count == 0 ||
+                 MeshFileSectionFits(header->varyings_offset, (u64)header->vertex_count * header->varying_count * sizeof(f32), file->size));
+    }
+    if (!valid) {
+        platform_unmap_file(file->memory, file->size);
+        file->memory = 0;
+        return M_FALSE;
+    }
+
+    u8 *base = (u8 *)file->memory;
+    Indexed_Mesh zero_mesh = {0};
+    *mesh = zero_mesh;
+    mesh->vertices = (Vertex *)(base + header->vertices_offset);
+    mesh->vertex_count = header->vertex_count;
+    mesh->indices = base + header->indices_offset;
+    mesh->index_count = header->index_count;
+    mesh->index_type = (Index_Type)header->index_type;
+    if (header->varying_count) {
+        mesh->varyings = (f32 *)(base + header->varyings_offset);
+        mesh->varying_count = header->varying_count;
+        mesh->perspective_varyings = (header->flags & MESH_FILE_PERSPECTIVE_VARYINGS) != 0;
+    }
+    f32 *positions = (f32 *)(base + header->positions_offset);
+    mesh->positions_x = positions;
+    mesh->positions_y = positions + header->padded_vertex_count;
+    mesh->positions_z = positions + 2 * header->padded_vertex_count;
+    mesh->bounds = header->bounds;
+    return M_TRUE;
+}
+
+void UnloadMeshFile(Mesh_File *file) {
+    if (file->memory) platform_unmap_file(file->memory, file->size);
+    file->memory = 0;
+    file->size = 0;
+}
+
+// pads the file up to the next section
+inline b8 AlignMeshFile(FILE *file, u64 *offset) {
+    static const u8 zeros[MESH_FILE_ALIGNMENT] = {0};
+    u64 aligned = AlignMeshFileOffset(*offset);
+    if (aligned != *offset && fwrite(zeros, 1, (size_t)(aligned - *offset), file) != aligned - *offset) return M_FALSE;
+    *offset = aligned;
+    return M_TRUE;
+}
+
+inline b8 WriteMeshFileBytes(FILE *file, u64 *offset, void *data, u64 size) {
+    if (size && fwrite(data, 1, (size_t)size, file) != size) return M_FALSE;
+    *offset += size;
+    return M_TRUE;
+}
+
+// Writes the mesh as a .mesh file. The position streams are built from the vertices on scratch if the mesh has
+// none.
+b8 WriteMeshFile(char *path, Indexed_Mesh *mesh, Memory_Arena *scratch) {
+    Arena_Marker marker = BeginArenaTemp(scratch);
+    Indexed_Mesh streams = *mesh;
+    if (!streams.positions_x) BuildPositionStreams(&streams, scratch);
+    u32 padded_vertex_count = (mesh->vertex_count + 3) & ~3u;
+    u64 index_size = mesh->index_type == INDEX_U16 ? sizeof(u16) : sizeof(u32);
+
+    Mesh_File_Header header = {0};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.header_size = sizeof(Mesh_File_Header);
+    header.vertex_size = sizeof(Vertex);
+    header.vertex_count = mesh->vertex_count;
+    header.padded_vertex_count = padded_vertex_count;
+    header.index_count = mesh->index_count;
+    header.index_type = mesh->index_type;
+    header.varying_count = mesh->varyings ? MIN(mesh->varying_count, MAX_VARYINGS) : 0;
+    header.flags = mesh->perspective_varyings ? MESH_FILE_PERSPECTIVE_VARYINGS : 0;
+    ComputeMeshBounds(&streams);
+    header.bounds = streams.bounds;
+
+    // the same walk as the writes below
+    u64 offset = sizeof(Mesh_File_Header);
+    header.vertices_offset = AlignMeshFileOffset(offset);
+    offset = header.vertices_offset + (u64)mesh->vertex_count * sizeof(Vertex);
+    header.positions_offset = AlignMeshFileOffset(offset);
+    offset = header.positions_offset + 3ull * padded_vertex_count * sizeof(f32);
+    if (header.varying_count) {
+        header.varyings_offset = AlignMeshFileOffset(offset);
+        offset = header.varyings_offset + (u64)mesh->vertex_count * header.varying_count * sizeof(f32);
+    }
+    header.indices_offset = AlignMeshFileOffset(offset);
+    header.file_size = header.indices_offset + mesh->index_count * index_size;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        EndArenaTemp(marker);
+        return M_FALSE;
+    }
+
+    offset = 0;
+    b8 written = WriteMeshFileBytes(file, &offset, &header, sizeof(header)) &&
+                 AlignMeshFile(file, &offset) &&
+                 WriteMeshFileBytes(file, &offset, mesh->vertices, (u64)mesh->vertex_count * sizeof(Vertex)) &&
+                 AlignMeshFile(file, &offset) &&
+                 // three arrays of padded_vertex_count in a row, the mesh's streams don't have to be one block
+                 WriteMeshFileBytes(file, &offset, streams.positions_x, padded_vertex_count * sizeof(f32)) &&
+                 WriteMeshFileBytes(file, &offset, streams.positions_y, padded_vertex_count * sizeof(f32)) &&
+                 WriteMeshFileBytes(file, &offset, streams.positions_z, padded_vertex_count * sizeof(f32));
+    if (written && header.varying_count) {
+        written = AlignMeshFile(file, &offset);
+        // a mesh with more varyings than MAX_VARYINGS only keeps the first ones
+        for (u32 i = 0; written && i < mesh->vertex_count; ++i) {
+            written = WriteMeshFileBytes(file, &offset, mesh->varyings + (size_t)i * mesh->varying_count,
+                                         header.varying_count * sizeof(f32));
+        }
+    }
+    if (written) {
+        written = AlignMeshFile(file, &offset) &&
+                  WriteMeshFileBytes(file, &offset, mesh->indices, mesh->index_count * index_size);
+    }
+    written = fclose(file) == 0 && written && offset == header.file_size;
+
+    EndArenaTemp(marker);
+    return written;
+}
+
+#endif
@@ -0,0 +1,513 @@
+/*
+* Levels of detail.
+*
+* BuildMeshLods() simplifies a mesh at load time into a chain of coarser
+* and coarser levels, every one with about half the triangles of the one
+* before. The simplification collapses edges in the order of their
+* quadric error (Garland and Heckbert): every vertex sums up the planes of
+* its triangles and moving it onto a neighbor costs the squared distance
+* of the neighbor to those planes. Vertices only ever move onto a
+* neighbor, so a level uses a subset of the vertices above it and their
+* colors and varyings stay as they are.
+*
+* Vertices at the same position (uv seams, the corners of the cube with a
+* color per face) move together, each onto the vertex of the neighbor it
+* shares a triangle with. Vertices on open borders stay where they are.
+*
+* SelectMeshLod() picks the coarsest level whose error covers at most
+* global_lod_error_pixels on the screen, from the radius of the instance's
+* bounding sphere after the projection. A far away instance costs a few
+* triangles instead of all of them.
+*/
+
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <stdlib.h>
+
+#define MAX_MESH_LODS 16      // levels in a chain, the full detail one included
+#define LOD_MIN_TRIANGLES 8   // no coarser level gets made from a level this small
+#define LOD_NO_VERTEX 0xFFFFFFFF
+
+static f32 global_lod_error_pixels = 0.75f; // how far off a level may look on the screen
+
+typedef struct Tag_Quadric { // area weighted sum of squared distances to planes, a symmetric 4x4 matrix
+    // doubles, the error is a small difference of big sums once a few hundred planes got added up
+    f64 a00, a01, a02, a11, a12, a22; // n * n^T
+    f64 b0, b1, b2;                   // n * d
+    f64 c;                            // d * d
+    f64 weight;                       // area of the planes
+} Quadric;
+
+typedef struct Tag_Lod_Collapse { // moving every vertex at from onto to, both are group leaders
+    u32 from;
+    u32 to;
+    f32 cost;
+} Lod_Collapse;
+
+Quadric QuadricFromPlane(Vec3 plane_normal, f32 plane_d, f32 plane_weight) {
+    f64 nx = plane_normal.x;
+    f64 ny = plane_normal.y;
+    f64 nz = plane_normal.z;
+    f64 d = plane_d;
+    f64 weight = plane_weight;
+    Quadric q;
+    q.a00 = weight * nx * nx;
+    q.a01 = weight * nx * ny;
+    q.a02 = weight * nx * nz;
+    q.a11 = weight * ny * ny;
+    q.a12 = weight * ny * nz;
+    q.a22 = weight * nz * nz;
+    q.b0 = weight * nx * d;
+    q.b1 = weight * ny * d;
+    q.b2 = weight * nz * d;
+    q.c = weight * d * d;
+    q.weight = weight;
+    return q;
+}
+
+inline void AddQuadric(Quadric *q, Quadric *other) {
+    q->a00 += other->a00;
+    q->a01 += other->a01;
+    q->a02 += other->a02;
+    q->a11 += other->a11;
+    q->a12 += other->a12;
+    q->a22 += other->a22;
+    q->b0 += other->b0;
+    q->b1 += other->b1;
+    q->b2 += other->b2;
+    q->c += other->c;
+    q->weight += other->weight;
+}
+
+// the mean squared distance of p to the planes
+f32 QuadricError(Quadric *q, Vec3 position) {
+    if (q->weight <= 0.0) return 0.0f;
+    f64 x = position.x;
+    f64 y = position.y;
+    f64 z = position.z;
+    f64 rx = q->a00 * x + q->a01 * y + q->a02 * z + q->b0;
+    f64 ry = q->a01 * x + q->a11 * y + q->a12 * z + q->b1;
+    f64 rz = q->a02 * x + q->a12 * y + q->a22 * z + q->b2;
+    f64 error = rx * x + ry * y + rz * z + q->b0 * x + q->b1 * y + q->b2 * z + q->c;
+    return (f32)(MAX(error, 0.0) / q->weight); // rounding can make it a little negative
+}
+
+// By cost, cheapest first. Three radix passes of 11 bits over the bits of the costs, they are never negative so
+// the bits sort like the floats. Stable, so equal costs stay in the order of the edges.
+void SortLodCollapses(Lod_Collapse *collapses, u32 count, Memory_Arena *scratch) {
+    Arena_Marker marker = BeginArenaTemp(scratch);
+    Lod_Collapse *temp = ARENA_PUSH_ARRAY(scratch, Lod_Collapse, count);
+    u32 *histograms = ARENA_PUSH_ARRAY(scratch, u32, 3 * 2048);
+    memset(histograms, 0, 3 * 2048 * sizeof(u32));
+    for (u32 i = 0; i < count; ++i) {
+        u32 key;
+        memcpy(&key, &collapses[i].cost, sizeof(key));
+        ++histograms[key & 2047];
+        ++histograms[2048 + ((key >> 11) & 2047)];
+        ++histograms[4096 + (key >> 22)];
+    }
+
+    Lod_Collapse *from = collapses;
+    Lod_Collapse *to = temp;
+    for (int pass = 0; pass < 3; ++pass) {
+        u32 *histogram = histograms + pass * 2048;
+        u32 offset = 0;
+        for (int digit = 0; digit < 2048; ++digit) { // counts to where every digit starts
+            u32 digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
+        }
+        for (u32 i = 0; i < count; ++i) {
+            u32 key;
+            memcpy(&key, &from[i].cost, sizeof(key));
+            to[histogram[(key >> (11 * pass)) & 2047]++] = from[i];
+        }
+        Lod_Collapse *swap = from;
+        from = to;
+        to = swap;
+    }
+    memcpy(collapses, from, count * sizeof(Lod_Collapse)); // three passes end up in temp
+    EndArenaTemp(marker);
+}
+
+int CompareEdgeKeys(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+#define LOD_WELD_STEPS (1 << 20) // per bounding radius, closer positions count as the same
+
+typedef struct Tag_Weld_Key {
+    i32 x, y, z;
+} Weld_Key;
+
+inline Weld_Key WeldKey(Vec3 p) { // p relative to the bounds
+    Weld_Key key;
+    key.x = (i32)floorf(p.x * (f32)LOD_WELD_STEPS + 0.5f);
+    key.y = (i32)floorf(p.y * (f32)LOD_WELD_STEPS + 0.5f);
+    key.z = (i32)floorf(p.z * (f32)LOD_WELD_STEPS + 0.5f);
+    return key;
+}
+
+// group[i] is the first vertex at about the same position as vertex i. Exact compares miss too much, like the
+// poles of a uv sphere that end up at 1e-16 and -1e-16 from the sines.
+void GroupVerticesByPosition(Vec3 *positions, u32 vertex_count, u32 *group, Memory_Arena *scratch) {
+    Arena_Marker marker = BeginArenaTemp(scratch);
+    u32 table_size = 1;
+    while (table_size < 2 * vertex_count) table_size *= 2;
+    u32 *table = ARENA_PUSH_ARRAY(scratch, u32, table_size);
+    memset(table, 0xFF, table_size * sizeof(u32)); // LOD_NO_VERTEX
+    Weld_Key *keys = ARENA_PUSH_ARRAY(scratch, Weld_Key, vertex_count);
+
+    for (u32 i = 0; i < vertex_count; ++i) {
+        Weld_Key key = keys[i] = WeldKey(positions[i]);
+        u32 slot = (((u32)key.x * 73856093u) ^ ((u32)key.y * 19349663u) ^ ((u32)key.z * 83492791u)) & (table_size - 1);
+        while (table[slot] != LOD_NO_VERTEX) {
+            Weld_Key other = keys[table[slot]];
+            if (other.x == key.x && other.y == key.y && other.z == key.z) break;
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == LOD_NO_VERTEX) table[slot] = i;
+        group[i] = table[slot];
+    }
+    EndArenaTemp(marker);
+}
+
+inline Vec3 TriangleNormal(Vec3 p0, Vec3 p1, Vec3 p2) { // not normalized, twice the area long
+    return vec3_cross(vec3_sub(p1, p0), vec3_sub(p2, p0));
+}
+
+// The vertex at position from that shares a triangle with vertex and is in the group to, LOD_NO_VERTEX if none does.
+u32 FindCollapsePartner(u32 vertex, u32 to, u32 *indices, u32 *group, u32 *triangle_offsets, u32 *vertex_triangles) {
+    for (u32 t = triangle_offsets[vertex]; t < triangle_offsets[vertex + 1]; ++t) {
+        u32 *triangle = indices + 3 * vertex_triangles[t];
+        for (int corner = 0; corner < 3; ++corner) {
+            if (group[triangle[corner]] == to) return triangle[corner];
+        }
+    }
+    return LOD_NO_VERTEX;
+}
+
+// Whether moving the group from onto to keeps every triangle that stays facing the same way, counts the
+// triangles that go away into removed.
+b8 CollapseIsValid(Lod_Collapse *collapse, Vec3 *positions, u32 *indices, u32 *group, u32 *next_in_group,
+                   u32 *triangle_offsets, u32 *vertex_triangles, u32 *removed) {
+    Vec3 target = positions[collapse->to];
+    *removed = 0;
+    for (u32 vertex = collapse->from; vertex != LOD_NO_VERTEX; vertex = next_in_group[vertex]) {
+        if (triangle_offsets[vertex] == triangle_offsets[vertex + 1]) continue; // not used by any triangle
+        if (FindCollapsePartner(vertex, collapse->to, indices, group, triangle_offsets, vertex_triangles) == LOD_NO_VERTEX) {
+            return M_FALSE;
+        }
+
+        for (u32 t = triangle_offsets[vertex]; t < triangle_offsets[vertex + 1]; ++t) {
+            u32 *triangle = indices + 3 * vertex_triangles[t];
+            Vec3 before[3];
+            Vec3 after[3];
+            b8 collapses = M_FALSE;
+            for (int corner = 0; corner < 3; ++corner) {
+                before[corner] = positions[triangle[corner]];
+                after[corner] = triangle[corner] == vertex ? target : before[corner];
+                if (group[triangle[corner]] == collapse->to) collapses = M_TRUE;
+            }
+            if (collapses) {
+                ++*removed;
+                continue;
+            }
+            Vec3 normal_before = TriangleNormal(before[0], before[1], before[2]);
+            Vec3 normal_after = TriangleNormal(after[0], after[1], after[2]);
+            // turning by more than about 75 degrees is a fold in the making
+            f32 lengths_squared = vec3_dot(normal_before, normal_before) * vec3_dot(normal_after, normal_after);
+            f32 cosine = vec3_dot(normal_before, normal_after);
+            if (cosine <= 0.0f || cosine * cosine < 0.0625f * lengths_squared) return M_FALSE;
+        }
+    }
+    return M_TRUE;
+}
+
+// Simplifies the mesh down to about target_index_count indices, less far if more collapses would flip triangles
+// or tear open seams. The result has its own compacted vertices (and varyings and position streams) in arena and
+// the bounds of the mesh. *error is how far it is off the mesh, in object space.
+Indexed_Mesh SimplifyMesh(Indexed_Mesh *mesh, u32 target_index_count, Memory_Arena *arena, Memory_Arena *scratch,
+                          f32 *error) {
+    Arena_Marker marker = BeginArenaTemp(scratch);
+    u32 vertex_count = mesh->vertex_count;
+    u32 index_count = mesh->index_count;
+
+    // relative to the bounds, so the quadrics stay in a range floats handle well
+    f32 radius = mesh->bounds.radius > 0.0f ? mesh->bounds.radius : 1.0f;
+    Vec3 *positions = ARENA_PUSH_ARRAY(scratch, Vec3, vertex_count);
+    for (u32 i = 0; i < vertex_count; ++i) {
+        positions[i] = vec3_scale(1.0f / radius, vec3_sub(mesh->vertices[i].position, mesh->bounds.center));
+    }
+    u32 *indices = ARENA_PUSH_ARRAY(scratch, u32, index_count);
+    for (u32 i = 0; i < index_count; ++i) {
+        indices[i] = MeshIndex(mesh, i);
+    }
+
+    u32 *group = ARENA_PUSH_ARRAY(scratch, u32, vertex_count);
+    u32 *next_in_group = ARENA_PUSH_ARRAY(scratch, u32, vertex_count);
+    GroupVerticesByPosition(positions, vertex_count, group, scratch);
+    for (u32 i = 0; i < vertex_count; ++i) {
+        next_in_group[i] = LOD_NO_VERTEX;
+        if (group[i] != i) {
+            next_in_group[i] = next_in_group[group[i]];
+            next_in_group[group[i]] = i;
+        }
+    }
+
+    // triangles with two corners at the same position (like at the poles of a uv sphere) cover nothing
+    u32 kept_count = 0;
+    for (u32 i = 0; i < index_count; i += 3) {
+        u32 g0 = group[indices[i]];
+        u32 g1 = group[indices[i + 1]];
+        u32 g2 = group[indices[i + 2]];
+        if (g0 == g1 || g1 == g2 || g2 == g0) continue;
+        indices[kept_count++] = indices[i];
+        indices[kept_count++] = indices[i + 1];
+        indices[kept_count++] = indices[i + 2];
+    }
+    index_count = kept_count;
+
+    Quadric *quadrics = ARENA_PUSH_ARRAY(scratch, Quadric, vertex_count); // of the group leaders
+    memset(quadrics, 0, vertex_count * sizeof(Quadric));
+    for (u32 i = 0; i < index_count; i += 3) {
+        Vec3 normal = TriangleNormal(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+        f32 length = sqrtf(vec3_dot(normal, normal));
+        if (length <= 0.0f) continue;
+        normal = vec3_scale(1.0f / length, normal);
+        Quadric plane = QuadricFromPlane(normal, -vec3_dot(normal, positions[indices[i]]), 0.5f * length);
+        for (int corner = 0; corner < 3; ++corner) {
+            AddQuadric(quadrics + group[indices[i + corner]], &plane);
+        }
+    }
+
+    // an edge that doesn't have exactly two triangles is on a border (or not manifold), its vertices stay
+    b8 *locked = ARENA_PUSH_ARRAY(scratch, b8, vertex_count);
+    memset(locked, 0, vertex_count * sizeof(b8));
+    {
+        Arena_Marker edge_marker = BeginArenaTemp(scratch);
+        u64 *edges = ARENA_PUSH_ARRAY(scratch, u64, index_count);
+        u32 edge_count = 0;
+        for (u32 i = 0; i < index_count; i += 3) {
+            for (int corner = 0; corner < 3; ++corner) {
+                u32 a = group[indices[i + corner]];
+                u32 b = group[indices[i + (corner + 1) % 3]];
+                if (a != b) edges[edge_count++] = ((u64)MIN(a, b) << 32) | MAX(a, b);
+            }
+        }
+        qsort(edges, edge_count, sizeof(u64), CompareEdgeKeys);
+        for (u32 first = 0; first < edge_count;) {
+            u32 last = first;
+            while (last < edge_count && edges[last] == edges[first]) ++last;
+            if (last - first != 2) {
+                locked[(u32)(edges[first] >> 32)] = M_TRUE;
+                locked[(u32)edges[first]] = M_TRUE;
+            }
+            first = last;
+        }
+        EndArenaTemp(edge_marker);
+    }
+
+    u32 *triangle_offsets = ARENA_PUSH_ARRAY(scratch, u32, vertex_count + 1);
+    u32 *vertex_triangles = ARENA_PUSH_ARRAY(scratch, u32, index_count);
+    u32 *remap = ARENA_PUSH_ARRAY(scratch, u32, vertex_count);
+    b8 *touched = ARENA_PUSH_ARRAY(scratch, b8, vertex_count);
+    Lod_Collapse *collapses = ARENA_PUSH_ARRAY(scratch, Lod_Collapse, index_count);
+    f32 max_error_squared = 0.0f;
+
+    // Every pass collapses the cheapest edges whose neighborhoods don't overlap, so the checks of one collapse
+    // can't be spoiled by another one of the same pass. The last few triangles would take a lot of passes that
+    // get less and less done, close is good enough.
+    u32 close_enough = index_count > target_index_count ? target_index_count + (index_count - target_index_count) / 64
+                                                        : target_index_count;
+    while (index_count > close_enough) {
+        memset(triangle_offsets, 0, (vertex_count + 1) * sizeof(u32));
+        for (u32 i = 0; i < index_count; ++i) {
+            ++triangle_offsets[indices[i] + 1];
+        }
+        for (u32 i = 0; i < vertex_count; ++i) {
+            triangle_offsets[i + 1] += triangle_offsets[i];
+        }
+        for (u32 i = 0; i < index_count; ++i) {
+            vertex_triangles[triangle_offsets[indices[i]]++] = i / 3;
+        }
+        for (u32 i = vertex_count; i > 0; --i) { // the filling moved every offset to the next one
+            triangle_offsets[i] = triangle_offsets[i - 1];
+        }
+        triangle_offsets[0] = 0;
+
+        // an edge between two triangles shows up in both, the other way around in the second
+        u32 collapse_count = 0;
+        for (u32 i = 0; i < index_count; i += 3) {
+            for (int corner = 0; corner < 3; ++corner) {
+                u32 a = group[indices[i + corner]];
+                u32 b = group[indices[i + (corner + 1) % 3]];
+                if (a >= b || (locked[a] && locked[b])) continue;
+
+                Quadric sum = quadrics[a];
+                AddQuadric(&sum, quadrics + b);
+                f32 cost_a_to_b = locked[a] ? FLT_MAX : QuadricError(&sum, positions[b]);
+                f32 cost_b_to_a = locked[b] ? FLT_MAX : QuadricError(&sum, positions[a]);
+                Lod_Collapse collapse = { a, b, cost_a_to_b };
+                if (cost_b_to_a < cost_a_to_b) {
+                    collapse.from = b;
+                    collapse.to = a;
+                    collapse.cost = cost_b_to_a;
+                }
+                collapses[collapse_count++] = collapse;
+            }
+        }
+        if (collapse_count == 0) break;
+        SortLodCollapses(collapses, collapse_count, scratch);
+
+        for (u32 i = 0; i < vertex_count; ++i) {
+            remap[i] = i;
+        }
+        memset(touched, 0, vertex_count * sizeof(b8));
+        // Collapses that are blocked wait for the next pass instead of more expensive ones taking their turn (a
+        // collapse removes about two triangles). A pass that can't do any of the cheap ones does the next one.
+        // Moving a locked vertex costs FLT_MAX and must never happen, not even in a pass that's stuck otherwise.
+        u32 triangles_to_remove = (index_count - target_index_count) / 3;
+        f32 cost_limit = 1.5f * collapses[MIN(triangles_to_remove / 2, collapse_count - 1)].cost;
+        u32 removed_total = 0;
+        for (u32 c = 0; c < collapse_count && removed_total < triangles_to_remove; ++c) {
+            Lod_Collapse *collapse = collapses + c;
+            u32 removed;
+            if (collapse->cost == FLT_MAX) break; // sorted, so all the rest move locked vertices too
+            if (collapse->cost > cost_limit && removed_total) break;
+            if (touched[collapse->from] || touched[collapse->to]) continue;
+            if (!CollapseIsValid(collapse, positions, indices, group, next_in_group, triangle_offsets, vertex_triangles,
+                                 &removed)) {
+                continue;
+            }
+
+            for (u32 vertex = collapse->from; vertex != LOD_NO_VERTEX; vertex = next_in_group[vertex]) {
+                if (triangle_offsets[vertex] == triangle_offsets[vertex + 1]) continue;
+                remap[vertex] = FindCollapsePartner(vertex, collapse->to, indices, group, triangle_offsets, vertex_triangles);
+                // nothing around it can collapse in this pass anymore
+                for (u32 t = triangle_offsets[vertex]; t < triangle_offsets[vertex + 1]; ++t) {
+                    u32 *triangle = indices + 3 * vertex_triangles[t];
+                    for (int corner = 0; corner < 3; ++corner) {
+                        touched[group[triangle[corner]]] = M_TRUE;
+                    }
+                }
+            }
+            AddQuadric(quadrics + collapse->to, quadrics + collapse->from);
+            max_error_squared = MAX(max_error_squared, collapse->cost);
+            removed_total += removed;
+        }
+        if (removed_total == 0) break; // stuck
+
+        // the triangles that lost a side go away
+        kept_count = 0;
+        for (u32 i = 0; i < index_count; i += 3) {
+            u32 i0 = remap[indices[i]];
+            u32 i1 = remap[indices[i + 1]];
+            u32 i2 = remap[indices[i + 2]];
+            if (group[i0] == group[i1] || group[i1] == group[i2] || group[i2] == group[i0]) continue;
+            indices[kept_count++] = i0;
+            indices[kept_count++] = i1;
+            indices[kept_count++] = i2;
+        }
+        index_count = kept_count;
+    }
+
+    // only the vertices that are still used go into the result, in the order they were in
+    u32 *new_index = remap;
+    memset(new_index, 0xFF, vertex_count * sizeof(u32)); // LOD_NO_VERTEX
+    for (u32 i = 0; i < index_count; ++i) {
+        new_index[indices[i]] = 0;
+    }
+    u32 new_vertex_count = 0;
+    for (u32 i = 0; i < vertex_count; ++i) {
+        if (new_index[i] != LOD_NO_VERTEX) new_index[i] = new_vertex_count++;
+    }
+
+    Indexed_Mesh result = {0};
+    result.vertices = ARENA_PUSH_ARRAY(arena, Vertex, new_vertex_count);
+    result.vertex_count = new_vertex_count;
+    result.index_count = index_count;
+    result.index_type = new_vertex_count <= 0xFFFF ? INDEX_U16 : INDEX_U32;
+    result.varying_count = mesh->varying_count;
+    result.perspective_varyings = mesh->perspective_varyings;
+    result.texture = mesh->texture;
+    result.bounds = mesh->bounds; // the same for every level, so they cull and get selected alike
+    if (mesh->varyings) {
+        result.varyings = ARENA_PUSH_ARRAY(arena, f32, (size_t)new_vertex_count * mesh->varying_count);
+    }
+    for (u32 i = 0; i < vertex_count; ++i) {
+        if (new_index[i] == LOD_NO_VERTEX) continue;
+        result.vertices[new_index[i]] = mesh->vertices[i];
+        if (mesh->varyings) {
+            memcpy(result.varyings + (size_t)new_index[i] * mesh->varying_count,
+                   mesh->varyings + (size_t)i * mesh->varying_count, mesh->varying_count * sizeof(f32));
+        }
+    }
+    if (result.index_type == INDEX_U16) {
+        u16 *result_indices = ARENA_PUSH_ARRAY(arena, u16, index_count);
+        for (u32 i = 0; i < index_count; ++i) {
+            result_indices[i] = (u16)new_index[indices[i]];
+        }
+        result.indices = result_indices;
+    }
+    else {
+        u32 *result_indices = ARENA_PUSH_ARRAY(arena, u32, index_count);
+        for (u32 i = 0; i < index_count; ++i) {
+            result_indices[i] = new_index[indices[i]];
+        }
+        result.indices = result_indices;
+    }
+    BuildPositionStreams(&result, arena);
+
+    *error = sqrtf(max_error_squared) * radius;
+    EndArenaTemp(marker);
+    return result;
+}
+
+// Hangs the coarser levels off mesh->next_lod, each from the one before it with about half its triangles. Stops
+// when a level doesn't get much smaller anymore. Returns the number of levels, the full detail one included.
+u32 BuildMeshLods(Indexed_Mesh *mesh, Memory_Arena *arena, Memory_Arena *scratch) {
+    Indexed_Mesh *level = mesh;
+    u32 level_count = 1;
+    while (level_count < MAX_MESH_LODS && level->index_count / 3 > LOD_MIN_TRIANGLES) {
+        Arena_Marker marker = BeginArenaTemp(arena);
+        f32 error;
+        Indexed_Mesh simplified = SimplifyMesh(level, level->index_count / 6 * 3, arena, scratch, &error);
+        if (simplified.index_count > level->index_count / 4 * 3) {
+            EndArenaTemp(marker);
+            break;
+        }
+
+        Indexed_Mesh *next = ARENA_PUSH_ARRAY(arena, Indexed_Mesh, 1);
+        *next = simplified;
+        next->lod_error = level->lod_error + error; // the errors of the levels add up at most
+        level->next_lod = next;
+        level = next;
+        ++level_count;
+    }
+    return level_count;
+}
+
+// The radius in pixels of a sphere around center (in world space) on a screen height pixels high, through the
+// vertical focal length proj->e[1][1] of perspective_projection(). FLT_MAX with the camera in the sphere.
+f32 ProjectedSphereRadius(Mat4 *proj, Mat3x4 *view, Vec3 center, f32 radius, f32 height) {
+    f32 depth = -(view->e[2][0] * center.x + view->e[2][1] * center.y + view->e[2][2] * center.z + view->e[2][3]);
+    if (depth <= radius) return FLT_MAX;
+    return radius * proj->e[1][1] * 0.5f * height / depth;
+}
+
+// The coarsest level of the chain whose error stays below global_lod_error_pixels, for an instance whose bounding
+// sphere is projected_radius pixels big.
+Indexed_Mesh *SelectMeshLod(Indexed_Mesh *mesh, f32 projected_radius) {
+    if (mesh->bounds.radius <= 0.0f) return mesh;
+    f32 pixels_per_unit = projected_radius / mesh->bounds.radius;
+    while (mesh->next_lod && mesh->next_lod->lod_error * pixels_per_unit <= global_lod_error_pixels) {
+        mesh = mesh->next_lod;
+    }
+    return mesh;
+}
+
+#endif
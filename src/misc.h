@@ -14,8 +14,8 @@
 
 #define SIZE(x) sizeof(x) / sizeof(x[0])
 
-#define MIN(x, y) ((x) < (y)) ? (x) : (y)
-#define MAX(x, y) ((x) > (y)) ? (x) : (y)
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
 //
 // types
@@ -2,6 +2,7 @@
 #define MY_MATH_H_
 
 #include <math.h> // only for sqrtf @todo ?!
+#include <emmintrin.h>
 
 typedef struct Tag_Vec2 {
 	float x;
@@ -39,9 +40,22 @@ typedef struct Tag_Mat4 {
 	float e[4][4];
 } Mat4;
 
+// affine transform, the implicit last row is 0 0 0 1
+typedef struct Tag_Mat3x4 {
+	float e[3][4];
+} Mat3x4;
+
+// half the size of a Mat3x4, for lots of instances, see mat3x4_from_trs_batch()
+typedef struct Tag_Trs {
+	Vec3 translation;
+	float scale;  // uniform
+	float turn_y; // applied after turn_x
+	float turn_x;
+} Trs;
+
 #define PI 3.14159265359f
 #define TABLE_SIZE 257
-#define STEP_SIZE 0.25f * 2 * PI / (TABLE_SIZE - 1)
+#define STEP_SIZE (0.25f * 2 * PI / (TABLE_SIZE - 1))
 
 float table[TABLE_SIZE] = {
     0.0000000f, 0.0061359f, 0.0122715f, 0.0184067f, 0.0245412f, 0.0306748f, 
@@ -122,7 +136,7 @@ float m_sin(float turn) {
         index = (TABLE_SIZE - 1) - index;
     }
     int index0 = (int)index;
-    int index1 = index0 + 1;
+    int index1 = MIN(index0 + 1, TABLE_SIZE - 1); // index is TABLE_SIZE - 1 at the quadrant boundaries
     
     float lerp = table[index0] + (((table[index1] - table[index0]) / STEP_SIZE) *
                                   ((index - index0) * STEP_SIZE));
@@ -163,7 +177,7 @@ float m_cos(float turn) {
         index = (TABLE_SIZE - 1) - index;
     }
     int index0 = (int)index;
-    int index1 = index0 + 1;
+    int index1 = MIN(index0 + 1, TABLE_SIZE - 1); // index is TABLE_SIZE - 1 at the quadrant boundaries
     
     float lerp = table[index0] + (((table[index1] - table[index0]) / STEP_SIZE) *
                                   ((index - index0) * STEP_SIZE));
@@ -176,12 +190,79 @@ float m_cos(float turn) {
     }    
 }
 
+//
+// Branch free sine and cosine of a turn, four at a time. The turn gets split into a quadrant q and a rest
+// r in [-1/8, 1/8], then sin and cos of 2 pi r come from the Cephes minimax polynomials and q picks which
+// one goes where and with which sign. Only valid while 4 * turn fits in an int.
+//
+// Max absolute error over [-4, 4] turns, against double precision sin/cos:
+//   m_sin / m_cos (table) 4.8e-6
+//   m_sincos              1.0e-7
+//
+inline void sincos_ps(__m128 turns, __m128 *sin_out, __m128 *cos_out) {
+    __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(turns, _mm_set1_ps(4.0f)));
+    __m128 rest = _mm_sub_ps(turns, _mm_mul_ps(_mm_cvtepi32_ps(quadrant), _mm_set1_ps(0.25f)));
+    __m128 x = _mm_mul_ps(rest, _mm_set1_ps(2.0f * PI));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 sin_poly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z), _mm_set1_ps(8.3321608736e-3f));
+    sin_poly = _mm_add_ps(_mm_mul_ps(sin_poly, z), _mm_set1_ps(-1.6666654611e-1f));
+    sin_poly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sin_poly, z), x), x);
+
+    __m128 cos_poly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z), _mm_set1_ps(-1.388731625493765e-3f));
+    cos_poly = _mm_add_ps(_mm_mul_ps(cos_poly, z), _mm_set1_ps(4.166664568298827e-2f));
+    cos_poly = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cos_poly, z), z), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), z)));
+
+    // odd quadrants swap sin and cos, quadrants 2 and 3 negate the sine, 1 and 2 the cosine
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    __m128 sin_value = _mm_or_ps(_mm_and_ps(swap, cos_poly), _mm_andnot_ps(swap, sin_poly));
+    __m128 cos_value = _mm_or_ps(_mm_and_ps(swap, sin_poly), _mm_andnot_ps(swap, cos_poly));
+    *sin_out = _mm_xor_ps(sin_value, sin_sign);
+    *cos_out = _mm_xor_ps(cos_value, cos_sign);
+}
+
+inline void m_sincos(float turn, float *sin_out, float *cos_out) {
+    __m128 sin_value;
+    __m128 cos_value;
+    sincos_ps(_mm_set_ss(turn), &sin_value, &cos_value);
+    *sin_out = _mm_cvtss_f32(sin_value);
+    *cos_out = _mm_cvtss_f32(cos_value);
+}
+
+// sin_out or cos_out may be NULL if only one of them is needed
+void m_sincos_batch(const float *turns, float *sin_out, float *cos_out, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sin_value;
+        __m128 cos_value;
+        sincos_ps(_mm_loadu_ps(turns + i), &sin_value, &cos_value);
+        if (sin_out) _mm_storeu_ps(sin_out + i, sin_value);
+        if (cos_out) _mm_storeu_ps(cos_out + i, cos_value);
+    }
+    for (; i < count; ++i) {
+        float sin_value;
+        float cos_value;
+        m_sincos(turns[i], &sin_value, &cos_value);
+        if (sin_out) sin_out[i] = sin_value;
+        if (cos_out) cos_out[i] = cos_value;
+    }
+}
+
 float m_tan(float turn) {
-    return m_sin(turn) / m_cos(turn);
+    float sin_value;
+    float cos_value;
+    m_sincos(turn, &sin_value, &cos_value);
+    return sin_value / cos_value;
 }
 
 float m_cotan(float turn) {
-    return m_cos(turn) / m_sin(turn);
+    float sin_value;
+    float cos_value;
+    m_sincos(turn, &sin_value, &cos_value);
+    return cos_value / sin_value;
 }
 
 inline Vec2 vec2_add(Vec2 v1, Vec2 v2) {
@@ -385,28 +466,34 @@ Mat4 translate(float x, float y, float z) {
 
 Mat4 rotate_x(float turn) {
     Mat4 result = mat4_identity();
-    result.e[1][1] =  m_cos(turn);
-    result.e[1][2] = -m_sin(turn);
-    result.e[2][1] =  m_sin(turn);
-    result.e[2][2] =  m_cos(turn);
+    float s, c;
+    m_sincos(turn, &s, &c);
+    result.e[1][1] =  c;
+    result.e[1][2] = -s;
+    result.e[2][1] =  s;
+    result.e[2][2] =  c;
     return result;
 }
 
 Mat4 rotate_y(float turn) {
     Mat4 result = mat4_identity();
-    result.e[0][0] =  m_cos(turn);
-    result.e[0][2] =  m_sin(turn);
-    result.e[2][0] = -m_sin(turn);
-    result.e[2][2] =  m_cos(turn);
+    float s, c;
+    m_sincos(turn, &s, &c);
+    result.e[0][0] =  c;
+    result.e[0][2] =  s;
+    result.e[2][0] = -s;
+    result.e[2][2] =  c;
     return result;
 }
 
 Mat4 rotate_z(float turn) {
     Mat4 result = mat4_identity();
-    result.e[0][0] =  m_cos(turn);
-    result.e[0][1] = -m_sin(turn);
-    result.e[1][0] =  m_sin(turn);
-    result.e[1][1] =  m_cos(turn);
+    float s, c;
+    m_sincos(turn, &s, &c);
+    result.e[0][0] =  c;
+    result.e[0][1] = -s;
+    result.e[1][0] =  s;
+    result.e[1][1] =  c;
     return result;
 }
 
@@ -457,4 +544,218 @@ Mat4 perspective_projection(float fov, float aspect, float near, float far) {
     return result;
 }
 
+//
+// SSE versions that take pointers instead of copying 64 byte structs around. The Mat4 ones do the same float
+// operations in the same order as the scalar versions above, so their results compare equal with == (a zero
+// may come out with the other sign). result may alias any of the inputs.
+//
+void mat4_mul_ptr(Mat4 *result, const Mat4 *a, const Mat4 *b) {
+    __m128 b0 = _mm_loadu_ps(b->e[0]);
+    __m128 b1 = _mm_loadu_ps(b->e[1]);
+    __m128 b2 = _mm_loadu_ps(b->e[2]);
+    __m128 b3 = _mm_loadu_ps(b->e[3]);
+
+    __m128 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a->e[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][3]), b3));
+        rows[i] = row;
+    }
+    for (int i = 0; i < 4; ++i) {
+        _mm_storeu_ps(result->e[i], rows[i]);
+    }
+}
+
+void mat4_mul3_ptr(Mat4 *result, const Mat4 *a, const Mat4 *b, const Mat4 *c) {
+    Mat4 ab;
+    mat4_mul_ptr(&ab, a, b);
+    mat4_mul_ptr(result, &ab, c);
+}
+
+void mat4_vec4_mul_ptr(Vec4 *result, const Mat4 *m, const Vec4 *v) {
+    __m128 c0 = _mm_loadu_ps(m->e[0]);
+    __m128 c1 = _mm_loadu_ps(m->e[1]);
+    __m128 c2 = _mm_loadu_ps(m->e[2]);
+    __m128 c3 = _mm_loadu_ps(m->e[3]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    __m128 sum = _mm_mul_ps(c0, _mm_set1_ps(v->e[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c1, _mm_set1_ps(v->e[1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c2, _mm_set1_ps(v->e[2])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c3, _mm_set1_ps(v->e[3])));
+    _mm_storeu_ps(result->e, sum);
+}
+
+void transpose_ptr(Mat4 *result, const Mat4 *m) {
+    __m128 r0 = _mm_loadu_ps(m->e[0]);
+    __m128 r1 = _mm_loadu_ps(m->e[1]);
+    __m128 r2 = _mm_loadu_ps(m->e[2]);
+    __m128 r3 = _mm_loadu_ps(m->e[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(result->e[0], r0);
+    _mm_storeu_ps(result->e[1], r1);
+    _mm_storeu_ps(result->e[2], r2);
+    _mm_storeu_ps(result->e[3], r3);
+}
+
+//
+// affine fast paths, translate, rotate_* and LookAt only ever produce these
+//
+inline Mat3x4 mat3x4_identity(void) {
+	Mat3x4 result = {0.0f};
+	result.e[0][0] = 1.0f;
+	result.e[1][1] = 1.0f;
+	result.e[2][2] = 1.0f;
+	return result;
+}
+
+// drops the last row, only valid if it is 0 0 0 1
+inline Mat3x4 mat3x4_from_mat4(const Mat4 *m) {
+    Mat3x4 result;
+    _mm_storeu_ps(result.e[0], _mm_loadu_ps(m->e[0]));
+    _mm_storeu_ps(result.e[1], _mm_loadu_ps(m->e[1]));
+    _mm_storeu_ps(result.e[2], _mm_loadu_ps(m->e[2]));
+    return result;
+}
+
+inline Mat4 mat4_from_mat3x4(const Mat3x4 *m) {
+    Mat4 result;
+    _mm_storeu_ps(result.e[0], _mm_loadu_ps(m->e[0]));
+    _mm_storeu_ps(result.e[1], _mm_loadu_ps(m->e[1]));
+    _mm_storeu_ps(result.e[2], _mm_loadu_ps(m->e[2]));
+    _mm_storeu_ps(result.e[3], _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+    return result;
+}
+
+// 36 multiplies instead of 64, the last row of b only adds a's translation
+void mat3x4_mul(Mat3x4 *result, const Mat3x4 *a, const Mat3x4 *b) {
+    __m128 b0 = _mm_loadu_ps(b->e[0]);
+    __m128 b1 = _mm_loadu_ps(b->e[1]);
+    __m128 b2 = _mm_loadu_ps(b->e[2]);
+
+    __m128 rows[3];
+    for (int i = 0; i < 3; ++i) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a->e[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][2]), b2));
+        row = _mm_add_ps(row, _mm_set_ps(a->e[i][3], 0.0f, 0.0f, 0.0f));
+        rows[i] = row;
+    }
+    for (int i = 0; i < 3; ++i) {
+        _mm_storeu_ps(result->e[i], rows[i]);
+    }
+}
+
+// for projection * (view * model), the projection is not affine but the rest is
+void mat4_mul_mat3x4(Mat4 *result, const Mat4 *a, const Mat3x4 *b) {
+    __m128 b0 = _mm_loadu_ps(b->e[0]);
+    __m128 b1 = _mm_loadu_ps(b->e[1]);
+    __m128 b2 = _mm_loadu_ps(b->e[2]);
+
+    __m128 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a->e[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->e[i][2]), b2));
+        row = _mm_add_ps(row, _mm_set_ps(a->e[i][3], 0.0f, 0.0f, 0.0f));
+        rows[i] = row;
+    }
+    for (int i = 0; i < 4; ++i) {
+        _mm_storeu_ps(result->e[i], rows[i]);
+    }
+}
+
+inline Vec3 mat3x4_transform_point(const Mat3x4 *m, Vec3 p) {
+    Vec3 result;
+    result.x = m->e[0][0] * p.x + m->e[0][1] * p.y + m->e[0][2] * p.z + m->e[0][3];
+    result.y = m->e[1][0] * p.x + m->e[1][1] * p.y + m->e[1][2] * p.z + m->e[1][3];
+    result.z = m->e[2][0] * p.x + m->e[2][1] * p.y + m->e[2][2] * p.z + m->e[2][3];
+    return result;
+}
+
+// inverse of the 3x3 part via cofactors, the translation becomes -inverse * t.
+// A singular matrix gives the identity.
+void mat3x4_inverse(Mat3x4 *result, const Mat3x4 *m) {
+    float a = m->e[0][0], b = m->e[0][1], c = m->e[0][2];
+    float d = m->e[1][0], e = m->e[1][1], f = m->e[1][2];
+    float g = m->e[2][0], h = m->e[2][1], i = m->e[2][2];
+
+    float c00 = e * i - f * h;
+    float c01 = f * g - d * i;
+    float c02 = d * h - e * g;
+    float det = a * c00 + b * c01 + c * c02;
+    if (det == 0.0f) {
+        *result = mat3x4_identity();
+        return;
+    }
+    float inv_det = 1.0f / det;
+
+    Mat3x4 inverse;
+    inverse.e[0][0] = c00 * inv_det;
+    inverse.e[0][1] = (c * h - b * i) * inv_det;
+    inverse.e[0][2] = (b * f - c * e) * inv_det;
+    inverse.e[1][0] = c01 * inv_det;
+    inverse.e[1][1] = (a * i - c * g) * inv_det;
+    inverse.e[1][2] = (c * d - a * f) * inv_det;
+    inverse.e[2][0] = c02 * inv_det;
+    inverse.e[2][1] = (b * g - a * h) * inv_det;
+    inverse.e[2][2] = (a * e - b * d) * inv_det;
+
+    float tx = m->e[0][3], ty = m->e[1][3], tz = m->e[2][3];
+    for (int row = 0; row < 3; ++row) {
+        inverse.e[row][3] = -(inverse.e[row][0] * tx + inverse.e[row][1] * ty + inverse.e[row][2] * tz);
+    }
+    *result = inverse;
+}
+
+// only for rotation + translation (LookAt, rotate_*, translate), the 3x3 part is just transposed
+void mat3x4_inverse_rigid(Mat3x4 *result, const Mat3x4 *m) {
+    Mat3x4 inverse;
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+            inverse.e[row][column] = m->e[column][row];
+        }
+    }
+    float tx = m->e[0][3], ty = m->e[1][3], tz = m->e[2][3];
+    for (int row = 0; row < 3; ++row) {
+        inverse.e[row][3] = -(inverse.e[row][0] * tx + inverse.e[row][1] * ty + inverse.e[row][2] * tz);
+    }
+    *result = inverse;
+}
+
+// mat4_mul3(translate(t), rotate_y(turn_y), rotate_x(turn_x)) with the 3x3 part times scale, written out so the
+// products that are 0 or 1 drop away. The remaining ones are the same, so are the results.
+void mat3x4_from_trs_batch(Mat3x4 *result, const Trs *trs, int count) {
+    float turns_y[64], turns_x[64];
+    float sin_y[64], cos_y[64], sin_x[64], cos_x[64];
+    for (int first = 0; first < count; first += 64) {
+        int chunk = count - first < 64 ? count - first : 64;
+        for (int i = 0; i < chunk; ++i) {
+            turns_y[i] = trs[first + i].turn_y;
+            turns_x[i] = trs[first + i].turn_x;
+        }
+        m_sincos_batch(turns_y, sin_y, cos_y, chunk);
+        m_sincos_batch(turns_x, sin_x, cos_x, chunk);
+
+        for (int i = 0; i < chunk; ++i) {
+            const Trs *t = trs + first + i;
+            Mat3x4 *m = result + first + i;
+            m->e[0][0] = cos_y[i] * t->scale;
+            m->e[0][1] = (sin_y[i] * sin_x[i]) * t->scale;
+            m->e[0][2] = (sin_y[i] * cos_x[i]) * t->scale;
+            m->e[0][3] = t->translation.x;
+            m->e[1][0] = 0.0f;
+            m->e[1][1] = cos_x[i] * t->scale;
+            m->e[1][2] = -sin_x[i] * t->scale;
+            m->e[1][3] = t->translation.y;
+            m->e[2][0] = -sin_y[i] * t->scale;
+            m->e[2][1] = (cos_y[i] * sin_x[i]) * t->scale;
+            m->e[2][2] = (cos_y[i] * cos_x[i]) * t->scale;
+            m->e[2][3] = t->translation.z;
+        }
+    }
+}
+
 #endif 
@@ -0,0 +1,297 @@
+/*
+* Offline converter from Wavefront OBJ to the binary .mesh format of
+* mesh_file.h.
+*
+* usage: obj_convert input.obj output.mesh [-fit] [-flip]
+*
+* Reads v, vt, vn and f (polygons get triangulated as fans, negative
+* indices count from the end), everything else is ignored. Every distinct
+* position/uv/normal combination becomes one vertex. The vertex color is
+* the normal if the file has normals and the position inside the bounding
+* box otherwise. Files with uvs get them as two perspective correct
+* varyings, so the mesh can be textured.
+*
+* -fit centers the mesh and scales it into the cube from -1 to 1, -flip
+* reverses the winding of every triangle.
+*/
+
+#include "misc.h"
+#include "my_math.h"
+#include "platform.h"
+#include "profiler.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "work_queue.h"
+#include "texture.h"
+#include "renderer.h"
+#include "mesh_file.h"
+
+typedef struct Tag_Obj_Corner { // 0 based, -1 if the face doesn't have it
+    i32 position;
+    i32 uv;
+    i32 normal;
+} Obj_Corner;
+
+typedef struct Tag_Obj_Data {
+    Vec3 *positions;
+    u32 position_count;
+    u32 position_capacity;
+    f32 *uvs; // 2 per uv
+    u32 uv_count;
+    u32 uv_capacity;
+    Vec3 *normals;
+    u32 normal_count;
+    u32 normal_capacity;
+    Obj_Corner *corners; // 3 per triangle
+    u32 corner_count;
+    u32 corner_capacity;
+} Obj_Data;
+
+// an offline tool, so plain realloc
+void *GrowArray(void *memory, u32 *capacity, u32 needed, size_t element_size) {
+    if (needed <= *capacity) return memory;
+    u32 new_capacity = MAX(needed, MAX(*capacity * 2, 1024u));
+    void *grown = realloc(memory, new_capacity * element_size);
+    if (!grown) {
+        fprintf(stderr, "out of memory\n");
+        exit(FAILURE);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+char *SkipSpaces(char *at) {
+    while (*at == ' ' || *at == '\t') ++at;
+    return at;
+}
+
+// OBJ indices are 1 based, negative ones count back from the last element read so far
+b8 ParseObjIndex(char **at, u32 count, i32 *index) {
+    char *end;
+    long value = strtol(*at, &end, 10);
+    if (end == *at) return M_FALSE;
+    *at = end;
+
+    long resolved = value < 0 ? (long)count + value : value - 1;
+    if (value == 0 || resolved < 0 || resolved >= (long)count) return M_FALSE;
+    *index = (i32)resolved;
+    return M_TRUE;
+}
+
+// position[/[uv][/normal]]
+b8 ParseObjCorner(char **at, Obj_Data *obj, Obj_Corner *corner) {
+    corner->uv = -1;
+    corner->normal = -1;
+    if (!ParseObjIndex(at, obj->position_count, &corner->position)) return M_FALSE;
+    if (**at != '/') return M_TRUE;
+
+    ++*at;
+    if (**at != '/' && !ParseObjIndex(at, obj->uv_count, &corner->uv)) return M_FALSE;
+    if (**at != '/') return M_TRUE;
+
+    ++*at;
+    return ParseObjIndex(at, obj->normal_count, &corner->normal);
+}
+
+b8 ParseObj(char *text, Obj_Data *obj) {
+    int line_number = 1;
+    for (char *line = text; *line; ++line_number) {
+        char *line_end = line;
+        while (*line_end && *line_end != '\n') ++line_end;
+        char *next_line = *line_end ? line_end + 1 : line_end;
+        *line_end = 0;
+
+        char *at = SkipSpaces(line);
+        b8 valid = M_TRUE;
+        if (at[0] == 'v' && (at[1] == ' ' || at[1] == '\t')) {
+            obj->positions = (Vec3 *)GrowArray(obj->positions, &obj->position_capacity, obj->position_count + 1, sizeof(Vec3));
+            Vec3 *position = obj->positions + obj->position_count++;
+            valid = sscanf(at + 2, "%f %f %f", &position->x, &position->y, &position->z) == 3;
+        }
+        else if (at[0] == 'v' && at[1] == 't' && (at[2] == ' ' || at[2] == '\t')) {
+            obj->uvs = (f32 *)GrowArray(obj->uvs, &obj->uv_capacity, 2 * (obj->uv_count + 1), sizeof(f32));
+            f32 *uv = obj->uvs + 2 * obj->uv_count++;
+            uv[1] = 0.0f;
+            valid = sscanf(at + 3, "%f %f", uv, uv + 1) >= 1;
+        }
+        else if (at[0] == 'v' && at[1] == 'n' && (at[2] == ' ' || at[2] == '\t')) {
+            obj->normals = (Vec3 *)GrowArray(obj->normals, &obj->normal_capacity, obj->normal_count + 1, sizeof(Vec3));
+            Vec3 *normal = obj->normals + obj->normal_count++;
+            valid = sscanf(at + 3, "%f %f %f", &normal->x, &normal->y, &normal->z) == 3;
+        }
+        else if (at[0] == 'f' && (at[1] == ' ' || at[1] == '\t')) {
+            at += 2;
+            Obj_Corner first;
+            Obj_Corner previous;
+            int corner_count = 0;
+            for (at = SkipSpaces(at); valid && *at && *at != '\r'; at = SkipSpaces(at)) {
+                Obj_Corner corner;
+                valid = ParseObjCorner(&at, obj, &corner);
+                if (!valid) break;
+
+                if (corner_count == 0) first = corner;
+                if (corner_count >= 2) {
+                    obj->corners = (Obj_Corner *)GrowArray(obj->corners, &obj->corner_capacity, obj->corner_count + 3, sizeof(Obj_Corner));
+                    obj->corners[obj->corner_count++] = first;
+                    obj->corners[obj->corner_count++] = previous;
+                    obj->corners[obj->corner_count++] = corner;
+                }
+                previous = corner;
+                ++corner_count;
+            }
+            valid = valid && corner_count >= 3;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "line %d: can't read \"%s\"\n", line_number, line);
+            return M_FALSE;
+        }
+        line = next_line;
+    }
+    return M_TRUE;
+}
+
+inline u32 HashCorner(Obj_Corner corner) {
+    u32 hash = (u32)corner.position * 0x9E3779B1u;
+    hash ^= (u32)corner.uv * 0x85EBCA77u;
+    hash ^= (u32)corner.normal * 0xC2B2AE3Du;
+    return hash ^ (hash >> 15);
+}
+
+inline u8 UnitToColor(f32 value) { // -1 to 1
+    return (u8)(MIN(MAX(value * 0.5f + 0.5f, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+int main(int argument_count, char **arguments) {
+    char *input_path = 0;
+    char *output_path = 0;
+    b8 fit = M_FALSE;
+    b8 flip = M_FALSE;
+    for (int i = 1; i < argument_count; ++i) {
+        if (strcmp(arguments[i], "-fit") == 0)       fit = M_TRUE;
+        else if (strcmp(arguments[i], "-flip") == 0) flip = M_TRUE;
+        else if (!input_path)                        input_path = arguments[i];
+        else if (!output_path)                       output_path = arguments[i];
+        else                                         input_path = 0;
+    }
+    if (!input_path || !output_path) {
+        fprintf(stderr, "usage: obj_convert input.obj output.mesh [-fit] [-flip]\n");
+        return FAILURE;
+    }
+
+    FILE *input = fopen(input_path, "rb");
+    if (!input) {
+        fprintf(stderr, "can't open %s\n", input_path);
+        return FAILURE;
+    }
+    fseek(input, 0, SEEK_END);
+    long input_size = ftell(input);
+    fseek(input, 0, SEEK_SET);
+    char *text = (char *)malloc((size_t)input_size + 1);
+    if (!text || fread(text, 1, (size_t)input_size, input) != (size_t)input_size) {
+        fprintf(stderr, "can't read %s\n", input_path);
+        return FAILURE;
+    }
+    text[input_size] = 0;
+    fclose(input);
+
+    Obj_Data obj = {0};
+    if (!ParseObj(text, &obj)) return FAILURE;
+    if (obj.corner_count == 0) {
+        fprintf(stderr, "%s has no faces\n", input_path);
+        return FAILURE;
+    }
+
+    Vec3 bounds_min = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+    Vec3 bounds_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (u32 i = 0; i < obj.position_count; ++i) {
+        bounds_min.x = MIN(bounds_min.x, obj.positions[i].x);
+        bounds_min.y = MIN(bounds_min.y, obj.positions[i].y);
+        bounds_min.z = MIN(bounds_min.z, obj.positions[i].z);
+        bounds_max.x = MAX(bounds_max.x, obj.positions[i].x);
+        bounds_max.y = MAX(bounds_max.y, obj.positions[i].y);
+        bounds_max.z = MAX(bounds_max.z, obj.positions[i].z);
+    }
+    Vec3 center = { 0.5f * (bounds_min.x + bounds_max.x), 0.5f * (bounds_min.y + bounds_max.y), 0.5f * (bounds_min.z + bounds_max.z) };
+    f32 half_extent = 0.5f * MAX(MAX(bounds_max.x - bounds_min.x, bounds_max.y - bounds_min.y), bounds_max.z - bounds_min.z);
+    f32 fit_scale = half_extent > 0.0f ? 1.0f / half_extent : 1.0f;
+
+    // every distinct corner becomes a vertex, an open addressing table finds the ones already made
+    u32 table_size = 1;
+    while (table_size < 2 * obj.corner_count) table_size *= 2;
+    u32 *table = (u32 *)malloc(table_size * sizeof(u32)); // vertex index + 1, 0 is empty
+    memset(table, 0, table_size * sizeof(u32));
+    Obj_Corner *vertex_corners = (Obj_Corner *)malloc(obj.corner_count * sizeof(Obj_Corner));
+    u32 *indices = (u32 *)malloc(obj.corner_count * sizeof(u32));
+    u32 vertex_count = 0;
+    for (u32 i = 0; i < obj.corner_count; ++i) {
+        u32 source = flip ? i - i % 3 + (3 - i % 3) % 3 : i; // 0 2 1 per triangle
+        Obj_Corner corner = obj.corners[source];
+
+        u32 slot = HashCorner(corner) & (table_size - 1);
+        while (table[slot]) {
+            Obj_Corner *existing = vertex_corners + table[slot] - 1;
+            if (existing->position == corner.position && existing->uv == corner.uv && existing->normal == corner.normal) break;
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (!table[slot]) {
+            vertex_corners[vertex_count] = corner;
+            table[slot] = ++vertex_count;
+        }
+        indices[i] = table[slot] - 1;
+    }
+
+    Vertex *vertices = (Vertex *)malloc(vertex_count * sizeof(Vertex));
+    memset(vertices, 0, vertex_count * sizeof(Vertex)); // the padding gets written to the file too
+    f32 *varyings = obj.uv_count ? (f32 *)malloc(2 * vertex_count * sizeof(f32)) : 0;
+    for (u32 i = 0; i < vertex_count; ++i) {
+        Obj_Corner corner = vertex_corners[i];
+        Vec3 position = obj.positions[corner.position];
+        // -1 to 1 inside the bounding box
+        Vec3 relative = { (position.x - center.x) * fit_scale, (position.y - center.y) * fit_scale, (position.z - center.z) * fit_scale };
+        vertices[i].position = fit ? relative : position;
+
+        Vec3 color_source = corner.normal >= 0 ? obj.normals[corner.normal] : relative;
+        vertices[i].color.r = UnitToColor(color_source.x);
+        vertices[i].color.g = UnitToColor(color_source.y);
+        vertices[i].color.b = UnitToColor(color_source.z);
+
+        if (varyings) {
+            // OBJ has v going up, the textures have row 0 at the top
+            varyings[2 * i + 0] = corner.uv >= 0 ? obj.uvs[2 * corner.uv + 0] : 0.0f;
+            varyings[2 * i + 1] = corner.uv >= 0 ? 1.0f - obj.uvs[2 * corner.uv + 1] : 0.0f;
+        }
+    }
+
+    Indexed_Mesh mesh = {0};
+    mesh.vertices = vertices;
+    mesh.vertex_count = vertex_count;
+    mesh.index_count = obj.corner_count;
+    if (vertex_count <= 65536) {
+        u16 *small_indices = (u16 *)malloc(obj.corner_count * sizeof(u16));
+        for (u32 i = 0; i < obj.corner_count; ++i) small_indices[i] = (u16)indices[i];
+        mesh.indices = small_indices;
+        mesh.index_type = INDEX_U16;
+    }
+    else {
+        mesh.indices = indices;
+        mesh.index_type = INDEX_U32;
+    }
+    if (varyings) {
+        mesh.varyings = varyings;
+        mesh.varying_count = 2;
+        mesh.perspective_varyings = M_TRUE;
+    }
+
+    Memory_Arena scratch;
+    if (!CreateArena(&scratch, "scratch", FRAME_ARENA_RESERVE) || !WriteMeshFile(output_path, &mesh, &scratch)) {
+        fprintf(stderr, "can't write %s\n", output_path);
+        return FAILURE;
+    }
+    printf("%s: %u vertices, %u triangles%s\n", output_path, vertex_count, obj.corner_count / 3, varyings ? ", uvs" : "");
+    return SUCCESS;
+}
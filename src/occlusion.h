@@ -0,0 +1,196 @@
+/*
+* Occlusion culling.
+*
+* The occluders of a Scene (big meshes like walls and buildings, see
+* SetSceneOccluder()) get rasterized into a small depth-only buffer before
+* anything of the frame is recorded. Every instance that made it through
+* the frustum then has the screen rectangle of its bounding box tested
+* against that buffer. An instance that is behind the occluders in every
+* pixel of its rectangle gets dropped before a single vertex of it is
+* transformed.
+*
+* Like masked occlusion culling (Hasselgren et al.) the rasterizer works
+* on a coverage mask per group of four pixels from the SIMD edge
+* functions, only the covered ones take the triangle's depth. There is no
+* color and no attribute, a triangle costs a few instructions per four
+* pixels. The depths are conservative: a pixel takes the farthest depth
+* the triangle has anywhere inside the pixel, an instance gets tested
+* with the nearest depth of its box against every pixel its box touches
+* and a ring of one more around them, for the parts of pixels whose
+* centers are covered that aren't.
+*/
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#define OCCLUSION_WIDTH 256       // pixels at most, a multiple of 4, the height follows from the aspect of the screen
+#define OCCLUSION_DEPTH_BIAS 1e-6f // so an occluder in front of everything doesn't hide itself through rounding
+
+typedef struct Tag_Occlusion_Buffer {
+    f32 *depth; // width * height, from 0 at the near plane to 1 at the far one like the depth buffer
+    int width;
+    int height;
+} Occlusion_Buffer;
+
+typedef struct Tag_Occluder_Vertex { // in occlusion buffer pixels, y down
+    f32 x;
+    f32 y;
+    f32 z;
+    b8 in_front; // of the near plane, the others can't be projected
+} Occluder_Vertex;
+
+static b8 global_occlusion_culling = M_TRUE; // M_FALSE draws everything that's in the frustum, to compare
+
+void CreateOcclusionBuffer(Occlusion_Buffer *occlusion, Memory_Arena *arena, int screen_width, int screen_height) {
+    occlusion->width = MIN((screen_width + 3) & ~3, OCCLUSION_WIDTH);
+    occlusion->height = MAX((occlusion->width * screen_height + screen_width - 1) / screen_width, 1);
+    occlusion->depth = (f32 *)ArenaPushSize(arena, (size_t)occlusion->width * occlusion->height * sizeof(f32), 64);
+}
+
+inline void ClearOcclusionBuffer(Occlusion_Buffer *occlusion) {
+    Fill32((u32 *)occlusion->depth, FloatBits(1.0f), (size_t)occlusion->width * occlusion->height, M_FALSE);
+}
+
+// the same mapping as ProjectClipVertex(), without the fixed point
+inline Occluder_Vertex ProjectOccluderVertex(Occlusion_Buffer *occlusion, Mat4 *mvp, Vec3 p) {
+    f32 x = mvp->e[0][0] * p.x + mvp->e[0][1] * p.y + mvp->e[0][2] * p.z + mvp->e[0][3];
+    f32 y = mvp->e[1][0] * p.x + mvp->e[1][1] * p.y + mvp->e[1][2] * p.z + mvp->e[1][3];
+    f32 z = mvp->e[2][0] * p.x + mvp->e[2][1] * p.y + mvp->e[2][2] * p.z + mvp->e[2][3];
+    f32 w = mvp->e[3][0] * p.x + mvp->e[3][1] * p.y + mvp->e[3][2] * p.z + mvp->e[3][3];
+
+    Occluder_Vertex result = {0};
+    result.in_front = w > 0.0f && z >= -w;
+    if (result.in_front) {
+        f32 inv_w = 1.0f / w;
+        result.x = 0.5f * (f32)occlusion->width * (x * inv_w + 1.0f);
+        result.y = 0.5f * (f32)occlusion->height * (1.0f - y * inv_w);
+        result.z = 0.5f * z * inv_w + 0.5f;
+    }
+    return result;
+}
+
+// Pixels whose centers the triangle covers take the farthest depth its plane has inside the pixel (but never
+// farther than its farthest vertex), if that's nearer than what they have. Back faces get skipped like the
+// renderer skips them.
+void RasterizeOccluderTriangle(Occlusion_Buffer *occlusion, Occluder_Vertex v0, Occluder_Vertex v1, Occluder_Vertex v2) {
+    // y points down, so a positive area means clockwise like in CullTriangles()
+    f32 area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (area == 0.0f) return;
+    if ((area > 0.0f && global_cull_mode == CULL_CW) || (area < 0.0f && global_cull_mode == CULL_CCW)) return;
+    if (area < 0.0f) {
+        Occluder_Vertex temp = v1;
+        v1 = v2;
+        v2 = temp;
+        area = -area;
+    }
+
+    int x_min = MAX((int)floorf(MIN(MIN(v0.x, v1.x), v2.x)), 0);
+    int y_min = MAX((int)floorf(MIN(MIN(v0.y, v1.y), v2.y)), 0);
+    int x_max = MIN((int)ceilf(MAX(MAX(v0.x, v1.x), v2.x)), occlusion->width - 1);
+    int y_max = MIN((int)ceilf(MAX(MAX(v0.y, v1.y), v2.y)), occlusion->height - 1);
+    if (x_min > x_max || y_min > y_max) return;
+
+    // edge functions a * x + b * y + c, positive inside, every one 0 at the vertex the other two meet at
+    Occluder_Vertex *vertices[3] = { &v0, &v1, &v2 };
+    f32 a[3], b[3], c[3];
+    for (int i = 0; i < 3; ++i) {
+        Occluder_Vertex *from = vertices[(i + 1) % 3];
+        Occluder_Vertex *to = vertices[(i + 2) % 3];
+        a[i] = from->y - to->y;
+        b[i] = to->x - from->x;
+        c[i] = -(a[i] * from->x + b[i] * from->y);
+    }
+    // the depth plane from the barycentrics, plus the most it grows inside half a pixel in x and y
+    f32 inv_area = 1.0f / area;
+    f32 z_a = (a[0] * v0.z + a[1] * v1.z + a[2] * v2.z) * inv_area;
+    f32 z_b = (b[0] * v0.z + b[1] * v1.z + b[2] * v2.z) * inv_area;
+    f32 z_c = (c[0] * v0.z + c[1] * v1.z + c[2] * v2.z) * inv_area + 0.5f * (fabsf(z_a) + fabsf(z_b));
+    __m128 z_max = _mm_set1_ps(MAX(MAX(v0.z, v1.z), v2.z));
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 lane_centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    for (int y = y_min; y <= y_max; ++y) {
+        f32 center_y = (f32)y + 0.5f;
+        __m128 row0 = _mm_set1_ps(b[0] * center_y + c[0]);
+        __m128 row1 = _mm_set1_ps(b[1] * center_y + c[1]);
+        __m128 row2 = _mm_set1_ps(b[2] * center_y + c[2]);
+        __m128 row_z = _mm_set1_ps(z_b * center_y + z_c);
+        f32 *depth_row = occlusion->depth + y * occlusion->width;
+
+        // the width is a multiple of 4, so the groups never leave the row
+        for (int x = x_min & ~3; x <= x_max; x += 4) {
+            __m128 center_x = _mm_add_ps(_mm_set1_ps((f32)x), lane_centers);
+            __m128 covered = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), center_x), row0), zero);
+            covered = _mm_and_ps(covered, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[1]), center_x), row1), zero));
+            covered = _mm_and_ps(covered, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[2]), center_x), row2), zero));
+            if (!_mm_movemask_ps(covered)) continue;
+
+            __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(z_a), center_x), row_z), z_max);
+            __m128 old_z = _mm_load_ps(depth_row + x);
+            __m128 new_z = _mm_min_ps(old_z, z);
+            _mm_store_ps(depth_row + x, _mm_or_ps(_mm_and_ps(covered, new_z), _mm_andnot_ps(covered, old_z)));
+        }
+    }
+}
+
+// Triangles reaching behind the near plane get left out, that only makes the occluder smaller.
+void RasterizeOccluder(Occlusion_Buffer *occlusion, Memory_Arena *scratch, Mat4 *mvp, Indexed_Mesh *mesh) {
+    Arena_Marker marker = BeginArenaTemp(scratch);
+    Occluder_Vertex *vertices = ARENA_PUSH_ARRAY(scratch, Occluder_Vertex, mesh->vertex_count);
+    for (u32 i = 0; i < mesh->vertex_count; ++i) {
+        vertices[i] = ProjectOccluderVertex(occlusion, mvp, mesh->vertices[i].position);
+    }
+
+    for (u32 i = 0; i + 2 < mesh->index_count; i += 3) {
+        Occluder_Vertex v0 = vertices[MeshIndex(mesh, i)];
+        Occluder_Vertex v1 = vertices[MeshIndex(mesh, i + 1)];
+        Occluder_Vertex v2 = vertices[MeshIndex(mesh, i + 2)];
+        if (v0.in_front && v1.in_front && v2.in_front) RasterizeOccluderTriangle(occlusion, v0, v1, v2);
+    }
+    EndArenaTemp(marker);
+}
+
+// Whether any part of the box (in world space) may be in front of the occluders. A box reaching behind the near
+// plane always may.
+b8 BoxMayBeVisible(Occlusion_Buffer *occlusion, Mat4 *view_proj, Vec3 box_min, Vec3 box_max) {
+    f32 x_min = FLT_MAX;
+    f32 y_min = FLT_MAX;
+    f32 x_max = -FLT_MAX;
+    f32 y_max = -FLT_MAX;
+    f32 z_min = FLT_MAX;
+    for (int corner = 0; corner < 8; ++corner) {
+        Vec3 p = vec3_make(corner & 1 ? box_max.x : box_min.x, corner & 2 ? box_max.y : box_min.y,
+                           corner & 4 ? box_max.z : box_min.z);
+        Occluder_Vertex v = ProjectOccluderVertex(occlusion, view_proj, p);
+        if (!v.in_front) return M_TRUE;
+        x_min = MIN(x_min, v.x);
+        y_min = MIN(y_min, v.y);
+        x_max = MAX(x_max, v.x);
+        y_max = MAX(y_max, v.y);
+        z_min = MIN(z_min, v.z);
+    }
+
+    // every pixel the rectangle touches and one more around it, clamped before the floats become ints
+    int x0 = x_min < 1.0f ? 0 : (int)x_min - 1;
+    int y0 = y_min < 1.0f ? 0 : (int)y_min - 1;
+    int x1 = x_max > (f32)(occlusion->width - 2) ? occlusion->width - 1 : MAX((int)x_max + 1, 0);
+    int y1 = y_max > (f32)(occlusion->height - 2) ? occlusion->height - 1 : MAX((int)y_max + 1, 0);
+    if (x0 > x1 || y0 > y1) return M_TRUE;
+
+    __m128 nearest = _mm_set1_ps(z_min - OCCLUSION_DEPTH_BIAS);
+    __m128i first_lane = _mm_set1_epi32(x0 - 1);
+    __m128i last_lane = _mm_set1_epi32(x1 + 1);
+    for (int y = y0; y <= y1; ++y) {
+        f32 *depth_row = occlusion->depth + y * occlusion->width;
+        for (int x = x0 & ~3; x <= x1; x += 4) {
+            __m128i lanes = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+            __m128i in_rectangle = _mm_and_si128(_mm_cmpgt_epi32(lanes, first_lane), _mm_cmplt_epi32(lanes, last_lane));
+            // the box is hidden in a pixel if the occluders there are nearer than all of it
+            __m128 not_hidden = _mm_cmpge_ps(_mm_load_ps(depth_row + x), nearest);
+            if (_mm_movemask_ps(_mm_and_ps(not_hidden, _mm_castsi128_ps(in_rectangle)))) return M_TRUE;
+        }
+    }
+    return M_FALSE;
+}
+
+#endif
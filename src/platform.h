@@ -0,0 +1,238 @@
+/*
+* The few operating system services the renderer core, the work queue and
+* the audio thread need: memory, mapped files, time, atomics, semaphores
+* and threads.
+* Win32 and POSIX implementations, everything else (window, sound card,
+* input) stays in the platform layer itself.
+*/
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <intrin.h>
+
+#define COMPILER_BARRIER() _ReadWriteBarrier()
+#define THREAD_LOCAL __declspec(thread)
+
+typedef HANDLE Platform_Semaphore;
+typedef HANDLE Platform_Thread;
+
+#define PLATFORM_THREAD_PROC(name) DWORD WINAPI name(LPVOID parameter)
+
+#else
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+#define THREAD_LOCAL __thread
+
+typedef sem_t *Platform_Semaphore;
+typedef pthread_t Platform_Thread;
+
+#define PLATFORM_THREAD_PROC(name) void *name(void *parameter)
+
+#endif
+
+typedef PLATFORM_THREAD_PROC(Platform_Thread_Proc);
+
+// zeroed, straight from the OS
+void *platform_allocate_memory(size_t size) {
+#if defined(_WIN32)
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? 0 : memory;
+#endif
+}
+
+// size has to be the one that was passed to platform_allocate_memory()
+void platform_free_memory(void *memory, size_t size) {
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+// Address space only, nothing can be touched before platform_commit_memory(). Free it with
+// platform_free_memory() and the reserved size.
+void *platform_reserve_memory(size_t size) {
+#if defined(_WIN32)
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *memory = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return memory == MAP_FAILED ? 0 : memory;
+#endif
+}
+
+// makes reserved pages usable, they are zero the first time
+b8 platform_commit_memory(void *memory, size_t size) {
+#if defined(_WIN32)
+    return VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE) != 0;
+#else
+    return mprotect(memory, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// Maps the whole file read-only, pages get loaded when they are first touched. Returns 0 if the file can't be
+// opened or is empty.
+void *platform_map_file(char *path, size_t *size) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+
+    void *memory = 0;
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping) {
+            memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+        *size = (size_t)file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return memory;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) return 0;
+
+    void *memory = 0;
+    struct stat file_stat;
+    if (fstat(file, &file_stat) == 0 && file_stat.st_size > 0) {
+        memory = mmap(0, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (memory == MAP_FAILED) memory = 0;
+        *size = (size_t)file_stat.st_size;
+    }
+    close(file);
+    return memory;
+#endif
+}
+
+void platform_unmap_file(void *memory, size_t size) {
+#if defined(_WIN32)
+    UnmapViewOfFile(memory);
+#else
+    munmap(memory, size);
+#endif
+}
+
+f64 platform_get_seconds(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (f64)now.tv_sec + (f64)now.tv_nsec * 1e-9;
+#endif
+}
+
+void platform_sleep_ms(int milliseconds) {
+#if defined(_WIN32)
+    Sleep(milliseconds);
+#else
+    struct timespec duration = { milliseconds / 1000, (milliseconds % 1000) * 1000 * 1000 };
+    nanosleep(&duration, 0);
+#endif
+}
+
+int platform_processor_count(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (int)system_info.dwNumberOfProcessors;
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// both return the value before the operation, like the Interlocked functions return the original for the
+// compare exchange
+inline long platform_atomic_increment(volatile long *value) {
+#if defined(_WIN32)
+    return InterlockedIncrement(value) - 1;
+#else
+    return __sync_fetch_and_add(value, 1);
+#endif
+}
+
+inline long platform_atomic_compare_exchange(volatile long *value, long exchange, long comparand) {
+#if defined(_WIN32)
+    return InterlockedCompareExchange(value, exchange, comparand);
+#else
+    return __sync_val_compare_and_swap(value, comparand, exchange);
+#endif
+}
+
+Platform_Semaphore platform_create_semaphore(int maximum_count) {
+#if defined(_WIN32)
+    return CreateSemaphoreA(0, 0, maximum_count, 0);
+#else
+    sem_t *semaphore = (sem_t *)platform_allocate_memory(sizeof(sem_t));
+    sem_init(semaphore, 0, 0);
+    return semaphore;
+#endif
+}
+
+void platform_signal_semaphore(Platform_Semaphore semaphore) {
+#if defined(_WIN32)
+    ReleaseSemaphore(semaphore, 1, 0);
+#else
+    sem_post(semaphore);
+#endif
+}
+
+void platform_wait_semaphore(Platform_Semaphore semaphore) {
+#if defined(_WIN32)
+    WaitForSingleObjectEx(semaphore, INFINITE, FALSE);
+#else
+    while (sem_wait(semaphore) != 0) {
+        // interrupted by a signal
+    }
+#endif
+}
+
+Platform_Thread platform_create_thread(Platform_Thread_Proc *proc, void *parameter) {
+#if defined(_WIN32)
+    return CreateThread(0, 0, proc, parameter, 0, 0);
+#else
+    pthread_t thread;
+    pthread_create(&thread, 0, proc, parameter);
+    return thread;
+#endif
+}
+
+void platform_join_thread(Platform_Thread thread) {
+#if defined(_WIN32)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, 0);
+#endif
+}
+
+void platform_detach_thread(Platform_Thread thread) {
+#if defined(_WIN32)
+    CloseHandle(thread);
+#else
+    pthread_detach(thread);
+#endif
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+* Scoped timing zones.
+*
+*     PROFILE_BEGIN("raster");
+*     ...
+*     PROFILE_END("raster");
+*
+* Every zone boundary is one __rdtsc and one store into a ring buffer that
+* belongs to the calling thread, so there is no locking and no shared cache
+* line between threads. write_chrome_trace() turns the rings into Chrome
+* trace event JSON (chrome://tracing, ui.perfetto.dev). It reads the rings
+* without synchronization, so only call it while no zones are being
+* recorded. Old events get overwritten once a ring is full.
+*
+* Compiled with PROFILER set to 0 (the default) the macros are empty and
+* none of this exists.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifndef PROFILER
+#define PROFILER 0
+#endif
+
+#if PROFILER
+
+#include <stdio.h>
+#include <string.h>
+
+#define PROFILER_MAX_THREADS       80
+#define PROFILER_EVENTS_PER_THREAD (1 << 16) // has to be a power of two
+#define PROFILER_MAX_DEPTH         32
+
+typedef enum Tag_Profile_Event_Type {
+    PROFILE_EVENT_BEGIN,
+    PROFILE_EVENT_END
+} Profile_Event_Type;
+
+typedef struct Tag_Profile_Event {
+    u64 cycles;
+    const char *name; // string literal
+    Profile_Event_Type type;
+} Profile_Event;
+
+typedef struct Tag_Profile_Thread_Log {
+    Profile_Event *events; // [PROFILER_EVENTS_PER_THREAD]
+    u32 event_count;       // total ever written, the ring holds the last PROFILER_EVENTS_PER_THREAD
+    const char *name;
+} Profile_Thread_Log;
+
+typedef struct Tag_Profiler {
+    volatile long thread_count;
+    Profile_Thread_Log threads[PROFILER_MAX_THREADS];
+
+    // to convert cycles to microseconds when exporting
+    u64 start_cycles;
+    f64 start_seconds;
+} Profiler;
+
+static Profiler global_profiler;
+THREAD_LOCAL Profile_Thread_Log *global_profile_thread_log; // not static, profile_event() is inline
+
+void init_profiler(void) {
+    global_profiler.start_cycles = __rdtsc();
+    global_profiler.start_seconds = platform_get_seconds();
+}
+
+Profile_Thread_Log *register_profile_thread(void) {
+    long index = platform_atomic_increment(&global_profiler.thread_count);
+    if (index >= PROFILER_MAX_THREADS) return 0;
+
+    Profile_Thread_Log *log = global_profiler.threads + index;
+    log->events = (Profile_Event *)platform_allocate_memory(PROFILER_EVENTS_PER_THREAD * sizeof(Profile_Event));
+    log->event_count = 0;
+    log->name = "thread";
+    global_profile_thread_log = log;
+    return log;
+}
+
+inline void profile_event(const char *name, Profile_Event_Type type) {
+    Profile_Thread_Log *log = global_profile_thread_log;
+    if (!log) {
+        log = register_profile_thread();
+        if (!log) return;
+    }
+
+    Profile_Event *event = log->events + (log->event_count & (PROFILER_EVENTS_PER_THREAD - 1));
+    event->cycles = __rdtsc();
+    event->name = name;
+    event->type = type;
+    ++log->event_count;
+}
+
+void profile_thread_name(const char *name) {
+    Profile_Thread_Log *log = global_profile_thread_log;
+    if (!log) log = register_profile_thread();
+    if (log) log->name = name;
+}
+
+// Begin and end events get paired up per thread and written as complete ('X') events. Ends whose begin was
+// already overwritten or recorded before init_profiler() and zones that are still open get dropped.
+b8 write_chrome_trace(char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return M_FALSE;
+
+    f64 elapsed_seconds = platform_get_seconds() - global_profiler.start_seconds;
+    f64 cycles_per_microsecond = (f64)(__rdtsc() - global_profiler.start_cycles) / (elapsed_seconds * 1e6);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    b8 first = M_TRUE;
+    int thread_count = (int)MIN(global_profiler.thread_count, PROFILER_MAX_THREADS);
+    for (int thread = 0; thread < thread_count; ++thread) {
+        Profile_Thread_Log *log = global_profiler.threads + thread;
+        if (!log->events) continue;
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", thread, log->name);
+        first = M_FALSE;
+
+        Profile_Event *stack[PROFILER_MAX_DEPTH];
+        int depth = 0;
+        u32 begin = log->event_count > PROFILER_EVENTS_PER_THREAD ? log->event_count - PROFILER_EVENTS_PER_THREAD : 0;
+        for (u32 i = begin; i < log->event_count; ++i) {
+            Profile_Event *event = log->events + (i & (PROFILER_EVENTS_PER_THREAD - 1));
+            if (event->cycles < global_profiler.start_cycles) continue; // from before init_profiler()
+            if (event->type == PROFILE_EVENT_BEGIN) {
+                if (depth < PROFILER_MAX_DEPTH) stack[depth] = event;
+                ++depth;
+                continue;
+            }
+
+            if (depth == 0) continue;
+            --depth;
+            if (depth >= PROFILER_MAX_DEPTH) continue;
+
+            Profile_Event *opened = stack[depth];
+            ASSERT(opened->name == event->name || strcmp(opened->name, event->name) == 0);
+            f64 start = (f64)(opened->cycles - global_profiler.start_cycles) / cycles_per_microsecond;
+            f64 duration = (f64)(event->cycles - opened->cycles) / cycles_per_microsecond;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    opened->name, thread, start, duration);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return M_TRUE;
+}
+
+#define PROFILE_BEGIN(name) profile_event(name, PROFILE_EVENT_BEGIN)
+#define PROFILE_END(name)   profile_event(name, PROFILE_EVENT_END)
+#define PROFILE_THREAD_NAME(name) profile_thread_name(name)
+
+#else
+
+#define PROFILE_BEGIN(name)
+#define PROFILE_END(name)
+#define PROFILE_THREAD_NAME(name)
+
+#endif
+
+#endif
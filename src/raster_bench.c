@@ -0,0 +1,123 @@
+/*
+* Microbenchmark for the triangle rasterizers in renderer.h.
+*
+* Draws the same random triangles into a 1024x1024 buffer on one thread,
+* once with the scalar reference rasterizer and once with the SIMD one,
+* reports the pixels written per second and checks that both leave the
+* same pixels, depths and Hi-Z bounds behind.
+*/
+
+#include "misc.h"
+#include "my_math.h"
+#include "platform.h"
+#include "profiler.h"
+#include "arena.h"
+#include "work_queue.h"
+#include "texture.h"
+#include "renderer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BUFFER_SIZE 1024
+#define TRIANGLE_COUNT 400
+#define TRIANGLE_EXTENT 200 // pixels, every vertex is up to this far from the triangle's center in x and y
+#define REPEAT_COUNT 50
+
+static Projected_Vertex global_triangles[3 * TRIANGLE_COUNT];
+
+u32 random_next(u32 *state) { // xorshift32
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// One at a time into a cleared buffer, counting the depths every triangle changes. Every triangle is nearer
+// than the ones before it, so drawn together they write the same pixels.
+u64 count_written_pixels(Offscreen_Buffer *buffer, u32 triangle_count) {
+    u64 written = 0;
+    for (u32 i = 0; i < triangle_count; ++i) {
+        Projected_Vertex *v = global_triangles + 3 * i;
+        ClearDepthBuffer(buffer, 1.0f);
+        RenderTriangleToBuffer(buffer, v[0], v[1], v[2]);
+        Rect2I bounds = TriangleBounds(v[0], v[1], v[2], BufferRect(buffer));
+        for (int y = bounds.y_min; y <= bounds.y_max; ++y) {
+            for (int x = bounds.x_min; x <= bounds.x_max; ++x) {
+                written += buffer->depth[x + y * buffer->width] != 1.0f;
+            }
+        }
+    }
+    return written;
+}
+
+int main(void) {
+    static Memory_Arena arena;
+    if (!CreateArena(&arena, "bench", PERMANENT_ARENA_RESERVE)) {
+        printf("couldn't reserve memory\n");
+        return FAILURE;
+    }
+    Offscreen_Buffer buffer = {0};
+    CreateFramebuffer(&buffer, &arena, BUFFER_SIZE, BUFFER_SIZE);
+    global_render_mode = RENDER_MODE_SERIAL;
+
+    u32 state = 0x12345678;
+    for (u32 i = 0; i < 3 * TRIANGLE_COUNT; i += 3) {
+        int center_x = (int)(random_next(&state) % BUFFER_SIZE);
+        int center_y = (int)(random_next(&state) % BUFFER_SIZE);
+        for (int j = 0; j < 3; ++j) {
+            Projected_Vertex *v = global_triangles + i + j;
+            int offset_x = (int)(random_next(&state) % (2 * TRIANGLE_EXTENT + 1)) - TRIANGLE_EXTENT;
+            int offset_y = (int)(random_next(&state) % (2 * TRIANGLE_EXTENT + 1)) - TRIANGLE_EXTENT;
+            v->position.x = (center_x + offset_x) * SUBPIXEL_ONE + (int)(random_next(&state) % SUBPIXEL_ONE);
+            v->position.y = (center_y + offset_y) * SUBPIXEL_ONE + (int)(random_next(&state) % SUBPIXEL_ONE);
+            v->z = 1.0f - (f32)(i / 3 + 1) / (f32)(TRIANGLE_COUNT + 1);
+            v->inv_w = 1.0f;
+            v->varying_count = 3;
+            for (int k = 0; k < 3; ++k) {
+                v->varyings[k] = (f32)(random_next(&state) % 256);
+            }
+        }
+    }
+    // drops the degenerate ones and turns them all clockwise like the renderer does before rasterizing
+    Cull_Stats stats = {0};
+    u32 triangle_count = CullTriangles(&buffer, global_triangles, 3 * TRIANGLE_COUNT, CULL_NONE, &stats) / 3;
+    u64 pixels = count_written_pixels(&buffer, triangle_count) * REPEAT_COUNT;
+    printf("%u triangles, %.2f Mpixels per repeat\n", triangle_count, (f64)pixels / (REPEAT_COUNT * 1e6));
+
+    u32 *pixel_copy = ARENA_PUSH_ARRAY(&arena, u32, BUFFER_SIZE * BUFFER_SIZE);
+    int depth_count = BUFFER_SIZE * BUFFER_SIZE + 2 * buffer.hiz_width * buffer.hiz_height; // the Hi-Z bounds follow the depths
+    f32 *depth_copy = ARENA_PUSH_ARRAY(&arena, f32, depth_count);
+
+    f64 baseline = 0.0;
+    for (int simd = 0; simd <= 1; ++simd) {
+        global_raster_simd = (b8)simd;
+        f64 seconds = 0.0;
+        for (int repeat = 0; repeat < REPEAT_COUNT; ++repeat) {
+            ClearFramebuffer(&buffer, 0);
+            ClearDepthBuffer(&buffer, 1.0f);
+            f64 start = platform_get_seconds(); // the clears don't count
+            for (u32 i = 0; i < triangle_count; ++i) {
+                Projected_Vertex *v = global_triangles + 3 * i;
+                RenderTriangleToBuffer(&buffer, v[0], v[1], v[2]);
+            }
+            seconds += platform_get_seconds() - start;
+        }
+        if (!simd) baseline = seconds;
+        printf("%-8s %8.1f Mpixels/s  %5.2fx\n", simd ? "simd" : "scalar", (f64)pixels / (seconds * 1e6), baseline / seconds);
+
+        if (!simd) {
+            memcpy(pixel_copy, buffer.memory, BUFFER_SIZE * BUFFER_SIZE * sizeof(u32));
+            memcpy(depth_copy, buffer.depth, depth_count * sizeof(f32));
+        }
+        else if (memcmp(pixel_copy, buffer.memory, BUFFER_SIZE * BUFFER_SIZE * sizeof(u32)) != 0 ||
+                 memcmp(depth_copy, buffer.depth, depth_count * sizeof(f32)) != 0) {
+            printf("the simd rasterizer does not match the scalar one\n");
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,1802 @@
+/*
+* The platform independent part of the renderer: framebuffer, vertex
+* processing, clipping, culling and the (tiled) rasterizer. Uses
+* platform.h for memory, atomics and the work queue's threads, so it builds
+* for the Win32 platform layer in main.c as well as for the headless
+* driver in headless.c.
+*/
+
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <emmintrin.h>
+#include <float.h>
+#include <string.h>
+
+//
+// constants
+//
+#define TILE_SIZE 64
+#define RASTER_BLOCK_SIZE 8 // has to be a power of two and divide TILE_SIZE
+#define SUBPIXEL_BITS 4       // screen positions are fixed point with this many fractional bits
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define GUARD_BAND_EXTENT 8192.0f // pixels from the screen center, keeps the per-block edge math in 32 bits
+#define MAX_CLIPPED_TRIANGLES 8   // clipping a triangle against 6 planes gives at most 9 vertices
+#define SLIVER_TEST_MAX_PIXELS 16 // triangles with a bounding box this small get their pixel centers tested before setup
+#define STREAMING_CLEAR_MIN_BYTES (1024 * 1024) // clears bigger than this bypass the cache, they wouldn't stay in it anyway
+#define MAX_VARYINGS 8 // floats interpolated across a triangle per vertex
+#define UPSCALE_BAND_ROWS 16 // display rows per work queue entry of UpscaleBuffer()
+
+//
+// structures
+//
+typedef struct Tag_Offscreen_Buffer {
+    void *memory;
+    int width;
+    int height;
+    int pitch;
+    int bytes_per_pixel;
+
+    // depth attachment, 0 is the near plane and 1 the far plane
+    f32 *depth;
+
+    // one entry per RASTER_BLOCK_SIZE x RASTER_BLOCK_SIZE block of the depth buffer. hiz_max is an upper bound
+    // and hiz_min a lower bound of all depth values in the block.
+    f32 *hiz_min;
+    f32 *hiz_max;
+    int hiz_width;
+    int hiz_height;
+
+    // ClearFramebufferLazy() only marks every TILE_SIZE x TILE_SIZE tile. A marked tile gets cleared when the
+    // rasterizer touches it first or in ResolveClears() at the latest, which has to happen before the pixels
+    // are read.
+    u8 *tile_clear_pending;
+    int clear_tiles_x;
+    int clear_tiles_y;
+    b8 clear_pending; // any tile marked
+    volatile long next_clear_tile; // for ResolveClearsWork
+    u32 clear_color;
+    f32 clear_depth;
+} Offscreen_Buffer;
+
+typedef struct Tag_Upscale_Job {
+    Offscreen_Buffer *source;
+    Offscreen_Buffer *target;
+    int scale;
+    // the part of target the scaled image covers (the rest is border), clipped to target
+    int x_min;
+    int y_min;
+    int x_max; // exclusive
+    int y_max;
+    int offset_x; // where source pixel (0, 0) lands in target, negative if source gets cropped
+    int offset_y;
+    u32 border_color;
+    int band_count;
+    volatile long next_band;
+} Upscale_Job;
+
+typedef struct Tag_Color {
+    u8 r;
+    u8 g;
+    u8 b;
+} Color;
+
+typedef struct Tag_Vertex {
+    Vec3 position;
+    Color color;
+} Vertex;
+
+// Varyings are what gets interpolated across a triangle, the first three are the color (r, g, b from 0 to 255).
+// Textured triangles use the first two as u and v instead and take the color from the texture. The ones past
+// varying_count are 0. With perspective set they get interpolated linearly in 3D instead of on
+// the screen, which costs a divide per pixel (no matter how many there are).
+typedef struct Tag_Clip_Vertex {
+    Vec4 position; // homogeneous clip space
+    f32 varyings[MAX_VARYINGS];
+    u8 varying_count;
+    b8 perspective;
+    Texture *texture; // may be 0
+} Clip_Vertex;
+
+typedef struct Tag_Projected_Vertex {
+    Vec2I position; // fixed point, SUBPIXEL_BITS fractional bits
+    f32 z;
+    f32 inv_w; // 1 / clip space w
+    f32 varyings[MAX_VARYINGS];
+    u8 varying_count;
+    b8 perspective;
+    Texture *texture; // may be 0
+} Projected_Vertex;
+
+typedef enum Tag_Index_Type {
+    INDEX_U16 = 0,
+    INDEX_U32 = 1
+} Index_Type;
+
+typedef struct Tag_Mesh_Bounds { // in object space, see ComputeMeshBounds()
+    Vec3 min;
+    Vec3 max;
+    Vec3 center; // of the box
+    f32 radius;  // of the sphere around center that holds every vertex
+} Mesh_Bounds;
+
+typedef struct Tag_Indexed_Mesh {
+    Vertex *vertices;
+    u32 vertex_count;
+    void *indices; // u16 or u32, see index_type. Every three indices make a triangle.
+    u32 index_count;
+    Index_Type index_type;
+
+    // optional, varying_count floats per vertex. Without them (or with just uvs and no texture) the vertex colors
+    // are the varyings.
+    f32 *varyings;
+    u32 varying_count;
+    b8 perspective_varyings;
+    Texture *texture; // optional, see Clip_Vertex
+
+    // optional structure-of-arrays copy of the positions for the batched vertex stage, see BuildPositionStreams()
+    f32 *positions_x;
+    f32 *positions_y;
+    f32 *positions_z;
+
+    Mesh_Bounds bounds; // what the scene culls instances of the mesh with
+
+    // optional, the next coarser level of detail, see BuildMeshLods()
+    struct Tag_Indexed_Mesh *next_lod;
+    f32 lod_error; // in object space, about how far this level is off the full detail mesh
+} Indexed_Mesh;
+
+typedef struct Tag_Transformed_Vertex { // output of the vertex stage, every vertex of a draw is transformed once
+    Clip_Vertex clip;
+    u32 clip_codes;
+    Projected_Vertex projected; // only valid if clip_codes has none of the CLIP_MUST_CLIP bits set
+} Transformed_Vertex;
+
+
+typedef struct Tag_Rect2I { // inclusive on both ends
+    int x_min;
+    int y_min;
+    int x_max;
+    int y_max;
+} Rect2I;
+
+typedef enum Tag_Cull_Mode { // winding as seen on screen
+    CULL_NONE = 0,
+    CULL_CW   = 1,
+    CULL_CCW  = 2
+} Cull_Mode;
+
+typedef struct Tag_Cull_Stats { // how many triangles every test removed
+    u32 submitted;
+    u32 back_facing;
+    u32 degenerate;  // zero area
+    u32 no_coverage; // doesn't contain a single pixel center, includes triangles outside the screen
+    u32 passed;
+    u32 out_of_memory; // dropped before the tests, the arena the triangles go to was full
+} Cull_Stats;
+
+typedef enum Tag_Render_Mode {
+    RENDER_MODE_SERIAL = 0, // one thread walks the mesh, reference path
+    RENDER_MODE_TILED  = 1  // sort-middle: triangles get binned into tiles, tiles are rasterized in parallel
+} Render_Mode;
+
+typedef struct Tag_Tile_Binner {
+    int tiles_x;
+    int tiles_y;
+    u32 *tile_triangle_count;  // [tiles_x * tiles_y]
+    u32 *tile_triangle_offset; // [tiles_x * tiles_y], into triangle_indices
+    u32 *triangle_indices;     // of the current draw, triangle i covers mesh[3*i .. 3*i+2]
+
+    // state of the current draw, read by the worker threads
+    Offscreen_Buffer *buffer;
+    Projected_Vertex *mesh;
+    volatile long next_tile;
+
+    Work_Queue *queue;
+} Tile_Binner;
+
+//
+// globals
+//
+static Tile_Binner global_tile_binner;
+static Render_Mode global_render_mode = RENDER_MODE_TILED;
+static b8 global_raster_simd = M_TRUE; // M_FALSE selects the scalar reference rasterizer
+static Cull_Mode global_cull_mode = CULL_CCW; // the cube's outside faces are clockwise on screen
+static Cull_Stats global_cull_stats;
+
+//
+// clipping
+//
+// Triangles are tested against the view frustum in homogeneous clip space. Triangles completely outside one
+// of the frustum planes are thrown away, everything else is only clipped against near and far. Instead of
+// clipping x and y against the screen edges we let the rasterizer's bounding box clip them, as long as the
+// vertices stay inside the guard band, so x/y clipping only happens for triangles that reach very far off
+// screen. The guard band keeps the pixel coordinates small enough for the int math in EdgeCross.
+//
+enum {
+    CLIP_LEFT         = 1 << 0,
+    CLIP_RIGHT        = 1 << 1,
+    CLIP_BOTTOM       = 1 << 2,
+    CLIP_TOP          = 1 << 3,
+    CLIP_NEAR         = 1 << 4,
+    CLIP_FAR          = 1 << 5,
+    CLIP_GUARD_LEFT   = 1 << 6,
+    CLIP_GUARD_RIGHT  = 1 << 7,
+    CLIP_GUARD_BOTTOM = 1 << 8,
+    CLIP_GUARD_TOP    = 1 << 9,
+    CLIP_PLANE_COUNT  = 10,
+
+    CLIP_FRUSTUM      = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR,
+    CLIP_MUST_CLIP    = CLIP_NEAR | CLIP_FAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP
+};
+
+// signed distance of p to every clip plane, negative means outside
+inline float ClipDistance(Vec4 p, int plane, float guard_x, float guard_y) {
+    switch (plane) {
+        case 0:  return p.value.w + p.value.x;
+        case 1:  return p.value.w - p.value.x;
+        case 2:  return p.value.w + p.value.y;
+        case 3:  return p.value.w - p.value.y;
+        case 4:  return p.value.w + p.value.z;
+        case 5:  return p.value.w - p.value.z;
+        case 6:  return guard_x * p.value.w + p.value.x;
+        case 7:  return guard_x * p.value.w - p.value.x;
+        case 8:  return guard_y * p.value.w + p.value.y;
+        default: return guard_y * p.value.w - p.value.y;
+    }
+}
+
+u32 ClipCodes(Vec4 p, float guard_x, float guard_y) {
+    u32 codes = 0;
+    for (int plane = 0; plane < CLIP_PLANE_COUNT; ++plane) {
+        if (ClipDistance(p, plane, guard_x, guard_y) < 0.0f) codes |= 1 << plane;
+    }
+    return codes;
+}
+
+inline Clip_Vertex ClipVertexLerp(Clip_Vertex a, Clip_Vertex b, float t) {
+    Clip_Vertex result;
+    for (int i = 0; i < 4; ++i) {
+        result.position.e[i] = a.position.e[i] + t * (b.position.e[i] - a.position.e[i]);
+    }
+    for (int i = 0; i < MAX_VARYINGS; ++i) {
+        result.varyings[i] = a.varyings[i] + t * (b.varyings[i] - a.varyings[i]);
+    }
+    result.varying_count = a.varying_count;
+    result.perspective = a.perspective;
+    result.texture = a.texture;
+    return result;
+}
+
+// perspective divide and viewport transform
+Projected_Vertex ProjectClipVertex(Clip_Vertex v, float width, float height) {
+    float inv_w = 1.0f / v.position.value.w; // clipping against near guarantees w > 0
+
+    Vec3 ndc;
+    ndc.x = v.position.value.x * inv_w;
+    ndc.y = -v.position.value.y * inv_w;
+    ndc.z = v.position.value.z * inv_w;
+
+    Vec3 viewport_position = { width / 2 * ndc.x + width / 2,
+                               height / 2 * ndc.y + height / 2,
+                               0.5f * ndc.z + 0.5f }; // depth range [0, 1]
+
+    Projected_Vertex result;
+    result.position.x = (int)floorf(viewport_position.x * SUBPIXEL_ONE + 0.5f);
+    result.position.y = (int)floorf(viewport_position.y * SUBPIXEL_ONE + 0.5f);
+    result.z = MIN(MAX(viewport_position.z, 0.0f), 1.0f); // vertices made by clipping can be off by a few ulps
+    result.inv_w = inv_w;
+    memcpy(result.varyings, v.varyings, sizeof(result.varyings));
+    result.varying_count = v.varying_count;
+    result.perspective = v.perspective;
+    result.texture = v.texture;
+    return result;
+}
+
+// Sutherland-Hodgman against the given planes (a mask of CLIP_MUST_CLIP bits), the resulting polygon gets
+// projected and turned back into a triangle fan. Returns the vertex count written to out.
+u32 ClipPolygon(Clip_Vertex v0, Clip_Vertex v1, Clip_Vertex v2, u32 planes, float width, float height, Projected_Vertex *out) {
+    float guard_x = GUARD_BAND_EXTENT / (0.5f * width);
+    float guard_y = GUARD_BAND_EXTENT / (0.5f * height);
+
+    Clip_Vertex polygons[2][MAX_CLIPPED_TRIANGLES + 2];
+    Clip_Vertex *in_polygon = polygons[0];
+    Clip_Vertex *out_polygon = polygons[1];
+    int vertex_count = 3;
+    in_polygon[0] = v0;
+    in_polygon[1] = v1;
+    in_polygon[2] = v2;
+
+    for (int plane = 0; plane < CLIP_PLANE_COUNT; ++plane) {
+        if (!(planes & (1 << plane))) continue;
+
+        int out_count = 0;
+        Clip_Vertex previous = in_polygon[vertex_count - 1];
+        float previous_distance = ClipDistance(previous.position, plane, guard_x, guard_y);
+        for (int i = 0; i < vertex_count; ++i) {
+            Clip_Vertex current = in_polygon[i];
+            float current_distance = ClipDistance(current.position, plane, guard_x, guard_y);
+
+            if ((previous_distance >= 0.0f) != (current_distance >= 0.0f)) {
+                float t = previous_distance / (previous_distance - current_distance);
+                out_polygon[out_count++] = ClipVertexLerp(previous, current, t);
+            }
+            if (current_distance >= 0.0f) {
+                out_polygon[out_count++] = current;
+            }
+
+            previous = current;
+            previous_distance = current_distance;
+        }
+
+        Clip_Vertex *temp = in_polygon;
+        in_polygon = out_polygon;
+        out_polygon = temp;
+        vertex_count = out_count;
+        if (vertex_count < 3) return 0;
+    }
+
+    // triangle fan
+    Projected_Vertex first = ProjectClipVertex(in_polygon[0], width, height);
+    Projected_Vertex previous = ProjectClipVertex(in_polygon[1], width, height);
+    u32 out_count = 0;
+    for (int i = 2; i < vertex_count; ++i) {
+        Projected_Vertex current = ProjectClipVertex(in_polygon[i], width, height);
+        out[out_count++] = first;
+        out[out_count++] = previous;
+        out[out_count++] = current;
+        previous = current;
+    }
+    return out_count;
+}
+
+// writes the projected triangles to out (at most MAX_CLIPPED_TRIANGLES * 3 vertices), returns the vertex count
+u32 ClipTriangle(Clip_Vertex v0, Clip_Vertex v1, Clip_Vertex v2, float width, float height, Projected_Vertex *out) {
+    float guard_x = GUARD_BAND_EXTENT / (0.5f * width);
+    float guard_y = GUARD_BAND_EXTENT / (0.5f * height);
+
+    u32 codes0 = ClipCodes(v0.position, guard_x, guard_y);
+    u32 codes1 = ClipCodes(v1.position, guard_x, guard_y);
+    u32 codes2 = ClipCodes(v2.position, guard_x, guard_y);
+
+    // trivial reject: all vertices are outside the same frustum plane
+    if (codes0 & codes1 & codes2 & CLIP_FRUSTUM) return 0;
+
+    // trivial accept: inside near/far and inside the guard band
+    if (!((codes0 | codes1 | codes2) & CLIP_MUST_CLIP)) {
+        out[0] = ProjectClipVertex(v0, width, height);
+        out[1] = ProjectClipVertex(v1, width, height);
+        out[2] = ProjectClipVertex(v2, width, height);
+        return 3;
+    }
+
+    return ClipPolygon(v0, v1, v2, (codes0 | codes1 | codes2) & CLIP_MUST_CLIP, width, height, out);
+}
+
+inline b8 IsTopLeft(Vec2I edge) {
+    return edge.y < 0 || (edge.x > 0 && edge.y == 0);
+}
+    
+// positions are fixed point with SUBPIXEL_BITS fractional bits, the products don't fit into 32 bits
+i64 EdgeCross(Vec2I minuend0, Vec2I minuend1, Vec2I subtrahend) {
+    Vec2I difference0 = vec2i_sub(minuend0, subtrahend);
+    Vec2I difference1 = vec2i_sub(minuend1, subtrahend);
+    
+    return (i64)difference0.x * difference1.y - (i64)difference0.y * difference1.x;
+}
+
+// pixel (x, y) is sampled at its center, which is (x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2) in fixed point
+inline Vec2I PixelCenter(int x, int y) {
+    Vec2I result = { x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2, y * SUBPIXEL_ONE + SUBPIXEL_ONE / 2 };
+    return result;
+}
+
+// the pixels whose centers lie inside the bounding box of the triangle
+inline Rect2I TriangleBounds(Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2, Rect2I clip) {
+    int x_min = MIN(MIN(v0.position.x, v1.position.x), v2.position.x);
+    int y_min = MIN(MIN(v0.position.y, v1.position.y), v2.position.y);
+    int x_max = MAX(MAX(v0.position.x, v1.position.x), v2.position.x);
+    int y_max = MAX(MAX(v0.position.y, v1.position.y), v2.position.y);
+
+    Rect2I result;
+    result.x_min = MAX((x_min - SUBPIXEL_ONE / 2 + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, clip.x_min);
+    result.y_min = MAX((y_min - SUBPIXEL_ONE / 2 + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, clip.y_min);
+    result.x_max = MIN((x_max - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS, clip.x_max);
+    result.y_max = MIN((y_max - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS, clip.y_max);
+    return result;
+}
+
+inline Rect2I BufferRect(Offscreen_Buffer *buffer) {
+    Rect2I result = { 0, 0, buffer->width - 1, buffer->height - 1 };
+    return result;
+}
+
+// Edge function of the edge from -> to, evaluated at pixel centers: value(x, y) = origin + x * step_x + y * step_y.
+// The top-left bias is already part of origin.
+typedef struct Tag_Edge {
+    i64 origin;
+    i32 step_x;
+    i32 step_y;
+} Edge;
+
+Edge SetupEdge(Vec2I from, Vec2I to) {
+    Vec2I d = vec2i_sub(to, from);
+    Vec2I p = PixelCenter(0, 0);
+
+    Edge result;
+    result.origin = (i64)d.x * (p.y - from.y) - (i64)d.y * (p.x - from.x) + (IsTopLeft(d) ? 0 : -1);
+    result.step_x = -d.y * SUBPIXEL_ONE;
+    result.step_y =  d.x * SUBPIXEL_ONE;
+    return result;
+}
+
+typedef enum Tag_Block_Coverage {
+    BLOCK_OUTSIDE = 0,
+    BLOCK_PARTIAL = 1,
+    BLOCK_INSIDE  = 2
+} Block_Coverage;
+
+// the edge function is linear, so its extremes over a block are at the corners
+inline Block_Coverage ClassifyBlock(Edge edge, i64 value_at_block) {
+    i64 corner_x = (i64)edge.step_x * (RASTER_BLOCK_SIZE - 1);
+    i64 corner_y = (i64)edge.step_y * (RASTER_BLOCK_SIZE - 1);
+    i64 block_min = value_at_block + MIN(corner_x, 0) + MIN(corner_y, 0);
+    i64 block_max = value_at_block + MAX(corner_x, 0) + MAX(corner_y, 0);
+
+    if (block_max < 0)  return BLOCK_OUTSIDE;
+    if (block_min >= 0) return BLOCK_INSIDE;
+    return BLOCK_PARTIAL;
+}
+
+// value to compare against inside a block, relative to the block's top left pixel. Edges that cover the
+// whole block get a big positive value instead, so only edges that cross the block can fail the test.
+// The guard band keeps step * RASTER_BLOCK_SIZE well inside 32 bits.
+inline i32 BlockTestValue(Block_Coverage coverage, i64 value_at_block) {
+    return coverage == BLOCK_INSIDE ? (1 << 28) : (i32)value_at_block;
+}
+
+inline int HizBlockIndex(Offscreen_Buffer *buffer, int x, int y) {
+    return (x / RASTER_BLOCK_SIZE) + (y / RASTER_BLOCK_SIZE) * buffer->hiz_width;
+}
+
+// @note: called once the triangle is done with a block. If every pixel of the block got written the old
+// depth values are all gone and the new maximum is exact, otherwise the old maximum is still an upper bound.
+inline void UpdateHizBlock(Offscreen_Buffer *buffer, int block_index, int block_x, int block_y,
+                           int written, float written_min, float written_max) {
+    if (written == 0) return;
+
+    int block_width  = MIN(RASTER_BLOCK_SIZE, buffer->width  - block_x);
+    int block_height = MIN(RASTER_BLOCK_SIZE, buffer->height - block_y);
+    if (written == block_width * block_height) {
+        buffer->hiz_max[block_index] = written_max;
+    }
+    if (written_min < buffer->hiz_min[block_index]) {
+        buffer->hiz_min[block_index] = written_min;
+    }
+}
+
+// Every attribute of a triangle is a plane over the screen. Its value at a pixel is
+// (a0 * e0 + a1 * e1 + a2 * e2) / area with the edge functions e at that pixel, so it changes by dx per pixel
+// to the right and dy per pixel down. The rasterizers evaluate it exactly at every block corner and step from
+// there, which costs no divides and keeps the error from growing across big triangles.
+typedef struct Tag_Attribute_Plane {
+    f32 a0;
+    f32 a1;
+    f32 a2;
+    f32 dx;
+    f32 dy;
+} Attribute_Plane;
+
+typedef struct Tag_Triangle_Planes {
+    f32 inv_area;
+    int varying_count; // at least 3 (the color) or 2 with a texture (u and v)
+    b8 perspective;
+    Texture *texture;
+    Attribute_Plane z;
+    Attribute_Plane inv_w;                  // only if perspective
+    Attribute_Plane varyings[MAX_VARYINGS]; // divided by w if perspective
+} Triangle_Planes;
+
+Attribute_Plane SetupPlane(f32 a0, f32 a1, f32 a2, Edge *edge0, Edge *edge1, Edge *edge2, f32 inv_area) {
+    Attribute_Plane result;
+    result.a0 = a0;
+    result.a1 = a1;
+    result.a2 = a2;
+    result.dx = (a0 * (f32)edge0->step_x + a1 * (f32)edge1->step_x + a2 * (f32)edge2->step_x) * inv_area;
+    result.dy = (a0 * (f32)edge0->step_y + a1 * (f32)edge1->step_y + a2 * (f32)edge2->step_y) * inv_area;
+    return result;
+}
+
+void SetupTrianglePlanes(Triangle_Planes *planes, Projected_Vertex *v0, Projected_Vertex *v1, Projected_Vertex *v2,
+                         Edge *edge0, Edge *edge1, Edge *edge2) {
+    f32 inv_area = 1.0f / (f32)EdgeCross(v1->position, v2->position, v0->position);
+    planes->inv_area = inv_area;
+    // varyings past varying_count are 0, so the color channels a mesh doesn't have come out black
+    planes->varying_count = MAX(v0->varying_count, v0->texture ? 2 : 3);
+    planes->perspective = v0->perspective;
+    planes->texture = v0->texture;
+    planes->z = SetupPlane(v0->z, v1->z, v2->z, edge0, edge1, edge2, inv_area);
+
+    if (planes->perspective) {
+        planes->inv_w = SetupPlane(v0->inv_w, v1->inv_w, v2->inv_w, edge0, edge1, edge2, inv_area);
+        for (int i = 0; i < planes->varying_count; ++i) {
+            planes->varyings[i] = SetupPlane(v0->varyings[i] * v0->inv_w, v1->varyings[i] * v1->inv_w,
+                                             v2->varyings[i] * v2->inv_w, edge0, edge1, edge2, inv_area);
+        }
+    }
+    else {
+        for (int i = 0; i < planes->varying_count; ++i) {
+            planes->varyings[i] = SetupPlane(v0->varyings[i], v1->varyings[i], v2->varyings[i], edge0, edge1, edge2, inv_area);
+        }
+    }
+}
+
+inline f32 PlaneAtBlock(Attribute_Plane *plane, f32 e0, f32 e1, f32 e2, f32 inv_area) {
+    return (plane->a0 * e0 + plane->a1 * e1 + plane->a2 * e2) * inv_area;
+}
+
+// The texture level of a raster block, from how far u and v move for one pixel step at the block's center.
+// Both rasterizers use this, so they sample the same level.
+int BlockTextureLevel(Triangle_Planes *planes, f32 *varyings_block, f32 inv_w_block) {
+    f32 center = 0.5f * RASTER_BLOCK_SIZE;
+    f32 sample_x[3] = { center, center + 1.0f, center };
+    f32 sample_y[3] = { center, center, center + 1.0f };
+    f32 u[3];
+    f32 v[3];
+    for (int i = 0; i < 3; ++i) {
+        u[i] = varyings_block[0] + planes->varyings[0].dy * sample_y[i] + planes->varyings[0].dx * sample_x[i];
+        v[i] = varyings_block[1] + planes->varyings[1].dy * sample_y[i] + planes->varyings[1].dx * sample_x[i];
+        if (planes->perspective) {
+            f32 inv_w = inv_w_block + planes->inv_w.dy * sample_y[i] + planes->inv_w.dx * sample_x[i];
+            if (!(inv_w > 0.0f)) return 0; // the center is far outside the triangle, behind the eye
+            u[i] /= inv_w;
+            v[i] /= inv_w;
+        }
+    }
+    return SelectTextureLevel(planes->texture, u[1] - u[0], v[1] - v[0], u[2] - u[0], v[2] - v[0]);
+}
+
+// the first three varyings are the color, r, g and b from 0 to 255
+inline u32 ShadePixel(f32 *varyings) {
+    u32 a = 0xFF;
+    u32 r = (u32)MIN(MAX(varyings[0], 0.0f), 255.0f);
+    u32 g = (u32)MIN(MAX(varyings[1], 0.0f), 255.0f);
+    u32 b = (u32)MIN(MAX(varyings[2], 0.0f), 255.0f);
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+// @note: only pixels inside clip get touched. Blocks are aligned to the screen and everything inside a block
+// is computed relative to the block's corner, so rendering a triangle in pieces with different clip rects
+// produces the same pixels as rendering it at once.
+// This is the reference path, RenderTriangleToBufferClippedSimd has to write the same bits.
+//
+// The bounding box is walked in RASTER_BLOCK_SIZE blocks that are aligned to the screen (and so to the
+// tiles). Every block first checks the triangle's depth range against the coarse depth of the block, then
+// the edge functions at its corners: blocks outside of an edge are skipped, blocks inside all edges are
+// filled without testing the edges per pixel.
+void RenderTriangleToBufferClippedScalar(Offscreen_Buffer *buffer, Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2, Rect2I clip) {
+    Rect2I bounds = TriangleBounds(v0, v1, v2, clip);
+    if (bounds.x_min > bounds.x_max || bounds.y_min > bounds.y_max) return;
+
+    Edge edge0 = SetupEdge(v1.position, v2.position);
+    Edge edge1 = SetupEdge(v2.position, v0.position);
+    Edge edge2 = SetupEdge(v0.position, v1.position);
+
+    Triangle_Planes planes;
+    SetupTrianglePlanes(&planes, &v0, &v1, &v2, &edge0, &edge1, &edge2);
+    int varying_count = planes.varying_count;
+
+    float z_min = MIN(MIN(v0.z, v1.z), v2.z);
+    float z_max = MAX(MAX(v0.z, v1.z), v2.z);
+    
+    u32 *pixel = (u32 *)buffer->memory;
+    f32 *depth = buffer->depth;
+    for (int block_y = bounds.y_min & ~(RASTER_BLOCK_SIZE - 1); block_y <= bounds.y_max; block_y += RASTER_BLOCK_SIZE) {
+        for (int block_x = bounds.x_min & ~(RASTER_BLOCK_SIZE - 1); block_x <= bounds.x_max; block_x += RASTER_BLOCK_SIZE) {
+            int block_index = HizBlockIndex(buffer, block_x, block_y);
+            if (z_min >= buffer->hiz_max[block_index]) continue; // everything in this block is already closer
+            b8 always_closer = z_min >= 0.0f && z_max < buffer->hiz_min[block_index]; // no need to read the depth buffer
+
+            i64 e0 = edge0.origin + (i64)edge0.step_x * block_x + (i64)edge0.step_y * block_y;
+            i64 e1 = edge1.origin + (i64)edge1.step_x * block_x + (i64)edge1.step_y * block_y;
+            i64 e2 = edge2.origin + (i64)edge2.step_x * block_x + (i64)edge2.step_y * block_y;
+            Block_Coverage coverage0 = ClassifyBlock(edge0, e0);
+            Block_Coverage coverage1 = ClassifyBlock(edge1, e1);
+            Block_Coverage coverage2 = ClassifyBlock(edge2, e2);
+            if (coverage0 == BLOCK_OUTSIDE || coverage1 == BLOCK_OUTSIDE || coverage2 == BLOCK_OUTSIDE) continue;
+            b8 full = coverage0 == BLOCK_INSIDE && coverage1 == BLOCK_INSIDE && coverage2 == BLOCK_INSIDE;
+
+            i32 test0 = BlockTestValue(coverage0, e0);
+            i32 test1 = BlockTestValue(coverage1, e1);
+            i32 test2 = BlockTestValue(coverage2, e2);
+
+            // attribute values at the block corner
+            float e0_block = (float)e0;
+            float e1_block = (float)e1;
+            float e2_block = (float)e2;
+            float z_block = PlaneAtBlock(&planes.z, e0_block, e1_block, e2_block, planes.inv_area);
+            float inv_w_block = planes.perspective ? PlaneAtBlock(&planes.inv_w, e0_block, e1_block, e2_block, planes.inv_area) : 1.0f;
+            float varyings_block[MAX_VARYINGS];
+            for (int i = 0; i < varying_count; ++i) {
+                varyings_block[i] = PlaneAtBlock(planes.varyings + i, e0_block, e1_block, e2_block, planes.inv_area);
+            }
+            int texture_level = planes.texture ? BlockTextureLevel(&planes, varyings_block, inv_w_block) : 0;
+
+            int x0 = MAX(block_x, bounds.x_min);
+            int y0 = MAX(block_y, bounds.y_min);
+            int x1 = MIN(block_x + RASTER_BLOCK_SIZE - 1, bounds.x_max);
+            int y1 = MIN(block_y + RASTER_BLOCK_SIZE - 1, bounds.y_max);
+
+            int written = 0;
+            float written_min = FLT_MAX;
+            float written_max = -FLT_MAX;
+            for (int y = y0; y <= y1; ++y) {
+                float row_y = (float)(y - block_y);
+                float z_row = z_block + planes.z.dy * row_y;
+                float inv_w_row = inv_w_block + planes.inv_w.dy * row_y;
+                float varyings_row[MAX_VARYINGS];
+                for (int i = 0; i < varying_count; ++i) {
+                    varyings_row[i] = varyings_block[i] + planes.varyings[i].dy * row_y;
+                }
+
+                for (int x = x0; x <= x1; ++x) {
+                    // edge functions relative to the block corner
+                    i32 w0 = edge0.step_x * (x - block_x) + edge0.step_y * (y - block_y);
+                    i32 w1 = edge1.step_x * (x - block_x) + edge1.step_y * (y - block_y);
+                    i32 w2 = edge2.step_x * (x - block_x) + edge2.step_y * (y - block_y);
+
+                    b8 inside_triangle = full || ((test0 + w0) | (test1 + w1) | (test2 + w2)) >= 0;
+            
+                    if (inside_triangle) {
+                        float column_x = (float)(x - block_x);
+                        // the plane can overshoot the vertices by a few ulps, HiZ relies on z staying in range
+                        float z = MIN(MAX(z_row + planes.z.dx * column_x, z_min), z_max);
+                        int index = x + y * buffer->width;
+                        if (always_closer || z < depth[index]) {
+                            float varyings[MAX_VARYINGS];
+                            if (planes.perspective) {
+                                float w = 1.0f / (inv_w_row + planes.inv_w.dx * column_x);
+                                for (int i = 0; i < varying_count; ++i) {
+                                    varyings[i] = (varyings_row[i] + planes.varyings[i].dx * column_x) * w;
+                                }
+                            }
+                            else {
+                                for (int i = 0; i < varying_count; ++i) {
+                                    varyings[i] = varyings_row[i] + planes.varyings[i].dx * column_x;
+                                }
+                            }
+                
+                            pixel[index] = planes.texture ? SampleTexture(planes.texture, texture_level, varyings[0], varyings[1]) | 0xFF000000
+                                                          : ShadePixel(varyings);
+                            depth[index] = z;
+
+                            ++written;
+                            written_min = MIN(written_min, z);
+                            written_max = MAX(written_max, z);
+                        }
+                    }
+                }
+            }
+
+            UpdateHizBlock(buffer, block_index, block_x, block_y, written, written_min, written_max);
+        }
+    }
+}
+
+inline __m128i ShadePixelsSimd(__m128 *varyings) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 channel_max = _mm_set1_ps(255.0f);
+    __m128i r = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(varyings[0], zero), channel_max));
+    __m128i g = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(varyings[1], zero), channel_max));
+    __m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(varyings[2], zero), channel_max));
+    return _mm_or_si128(_mm_or_si128(_mm_set1_epi32((int)0xFF000000), _mm_slli_epi32(r, 16)),
+                        _mm_or_si128(_mm_slli_epi32(g, 8), b));
+}
+
+// Same math as the scalar path, but for four horizontally adjacent pixels at once (SSE2).
+// Every attribute is evaluated with the same operations in the same order, so the result is bit identical
+// (headless -compare checks the pixels, depths and Hi-Z bounds of every scene).
+void RenderTriangleToBufferClippedSimd(Offscreen_Buffer *buffer, Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2, Rect2I clip) {
+    static const int bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+    Rect2I bounds = TriangleBounds(v0, v1, v2, clip);
+    if (bounds.x_min > bounds.x_max || bounds.y_min > bounds.y_max) return;
+
+    Edge edge0 = SetupEdge(v1.position, v2.position);
+    Edge edge1 = SetupEdge(v2.position, v0.position);
+    Edge edge2 = SetupEdge(v0.position, v1.position);
+
+    Triangle_Planes planes;
+    SetupTrianglePlanes(&planes, &v0, &v1, &v2, &edge0, &edge1, &edge2);
+    int varying_count = planes.varying_count;
+
+    float z_min = MIN(MIN(v0.z, v1.z), v2.z);
+    float z_max = MAX(MAX(v0.z, v1.z), v2.z);
+
+    __m128i w0_lane_offset = _mm_setr_epi32(0, edge0.step_x, 2 * edge0.step_x, 3 * edge0.step_x);
+    __m128i w1_lane_offset = _mm_setr_epi32(0, edge1.step_x, 2 * edge1.step_x, 3 * edge1.step_x);
+    __m128i w2_lane_offset = _mm_setr_epi32(0, edge2.step_x, 2 * edge2.step_x, 3 * edge2.step_x);
+    __m128i w0_step = _mm_set1_epi32(4 * edge0.step_x);
+    __m128i w1_step = _mm_set1_epi32(4 * edge1.step_x);
+    __m128i w2_step = _mm_set1_epi32(4 * edge2.step_x);
+
+    __m128 z_dx = _mm_set1_ps(planes.z.dx);
+    __m128 inv_w_dx = _mm_set1_ps(planes.inv_w.dx);
+    __m128 varyings_dx[MAX_VARYINGS];
+    for (int i = 0; i < varying_count; ++i) {
+        varyings_dx[i] = _mm_set1_ps(planes.varyings[i].dx);
+    }
+    __m128 z_min_wide = _mm_set1_ps(z_min);
+    __m128 z_max_wide = _mm_set1_ps(z_max);
+    __m128 column_step = _mm_set1_ps(4.0f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 plus_max  = _mm_set1_ps(FLT_MAX);
+    __m128 minus_max = _mm_set1_ps(-FLT_MAX);
+    __m128 all_lanes = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+    u32 *pixel = (u32 *)buffer->memory;
+    f32 *depth = buffer->depth;
+    for (int block_y = bounds.y_min & ~(RASTER_BLOCK_SIZE - 1); block_y <= bounds.y_max; block_y += RASTER_BLOCK_SIZE) {
+        for (int block_x = bounds.x_min & ~(RASTER_BLOCK_SIZE - 1); block_x <= bounds.x_max; block_x += RASTER_BLOCK_SIZE) {
+            int block_index = HizBlockIndex(buffer, block_x, block_y);
+            if (z_min >= buffer->hiz_max[block_index]) continue; // everything in this block is already closer
+            b8 always_closer = z_min >= 0.0f && z_max < buffer->hiz_min[block_index]; // no need to read the depth buffer
+
+            i64 e0 = edge0.origin + (i64)edge0.step_x * block_x + (i64)edge0.step_y * block_y;
+            i64 e1 = edge1.origin + (i64)edge1.step_x * block_x + (i64)edge1.step_y * block_y;
+            i64 e2 = edge2.origin + (i64)edge2.step_x * block_x + (i64)edge2.step_y * block_y;
+            Block_Coverage coverage0 = ClassifyBlock(edge0, e0);
+            Block_Coverage coverage1 = ClassifyBlock(edge1, e1);
+            Block_Coverage coverage2 = ClassifyBlock(edge2, e2);
+            if (coverage0 == BLOCK_OUTSIDE || coverage1 == BLOCK_OUTSIDE || coverage2 == BLOCK_OUTSIDE) continue;
+            b8 full = coverage0 == BLOCK_INSIDE && coverage1 == BLOCK_INSIDE && coverage2 == BLOCK_INSIDE;
+
+            __m128i test0 = _mm_set1_epi32(BlockTestValue(coverage0, e0));
+            __m128i test1 = _mm_set1_epi32(BlockTestValue(coverage1, e1));
+            __m128i test2 = _mm_set1_epi32(BlockTestValue(coverage2, e2));
+
+            // attribute values at the block corner
+            float e0_block = (float)e0;
+            float e1_block = (float)e1;
+            float e2_block = (float)e2;
+            float z_block = PlaneAtBlock(&planes.z, e0_block, e1_block, e2_block, planes.inv_area);
+            float inv_w_block = planes.perspective ? PlaneAtBlock(&planes.inv_w, e0_block, e1_block, e2_block, planes.inv_area) : 1.0f;
+            float varyings_block[MAX_VARYINGS];
+            for (int i = 0; i < varying_count; ++i) {
+                varyings_block[i] = PlaneAtBlock(planes.varyings + i, e0_block, e1_block, e2_block, planes.inv_area);
+            }
+            int texture_level = planes.texture ? BlockTextureLevel(&planes, varyings_block, inv_w_block) : 0;
+
+            int x0 = MAX(block_x, bounds.x_min);
+            int y0 = MAX(block_y, bounds.y_min);
+            int x1 = MIN(block_x + RASTER_BLOCK_SIZE - 1, bounds.x_max);
+            int y1 = MIN(block_y + RASTER_BLOCK_SIZE - 1, bounds.y_max);
+
+            int written = 0;
+            __m128 written_min = plus_max;
+            __m128 written_max = minus_max;
+            for (int y = y0; y <= y1; ++y) {
+                // edge functions relative to the block corner
+                __m128i w0 = _mm_add_epi32(_mm_set1_epi32(edge0.step_x * (x0 - block_x) + edge0.step_y * (y - block_y)), w0_lane_offset);
+                __m128i w1 = _mm_add_epi32(_mm_set1_epi32(edge1.step_x * (x0 - block_x) + edge1.step_y * (y - block_y)), w1_lane_offset);
+                __m128i w2 = _mm_add_epi32(_mm_set1_epi32(edge2.step_x * (x0 - block_x) + edge2.step_y * (y - block_y)), w2_lane_offset);
+
+                float row_y = (float)(y - block_y);
+                __m128 z_row = _mm_set1_ps(z_block + planes.z.dy * row_y);
+                __m128 inv_w_row = _mm_set1_ps(inv_w_block + planes.inv_w.dy * row_y);
+                __m128 varyings_row[MAX_VARYINGS];
+                for (int i = 0; i < varying_count; ++i) {
+                    varyings_row[i] = _mm_set1_ps(varyings_block[i] + planes.varyings[i].dy * row_y);
+                }
+                // x - block_x of every lane, small integers so adding 4 stays exact
+                __m128 column_x = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x0 - block_x), _mm_setr_epi32(0, 1, 2, 3)));
+
+                for (int x = x0; x <= x1; x += 4) {
+                    __m128 inside = all_lanes;
+                    if (!full) {
+                        // a pixel is outside if any of the edge functions is negative, so or-ing them and looking at the sign is enough
+                        __m128i outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(_mm_add_epi32(test0, w0),
+                                                                                   _mm_add_epi32(test1, w1)),
+                                                                      _mm_add_epi32(test2, w2)), 31);
+                        inside = _mm_andnot_ps(_mm_castsi128_ps(outside), all_lanes);
+                    }
+
+                    if (_mm_movemask_ps(inside) != 0) {
+                        __m128 z = _mm_min_ps(_mm_max_ps(_mm_add_ps(z_row, _mm_mul_ps(z_dx, column_x)), z_min_wide), z_max_wide);
+
+                        int index = x + y * buffer->width;
+                        b8 full_group = x + 3 <= x1;
+                        __m128 pass = inside;
+                        if (!full_group) {
+                            // the lanes past x1 aren't this block's to write or count, even when always_closer skips the depth test
+                            pass = _mm_and_ps(pass, _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(x1 - x + 1))));
+                        }
+                        if (!always_closer) {
+                            __m128 old_depth;
+                            if (full_group) {
+                                old_depth = _mm_loadu_ps(depth + index);
+                            }
+                            else {
+                                // @note: the lanes past x1 may belong to a tile another thread is working on, don't touch them
+                                float lanes[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                                for (int i = 0; i <= x1 - x; ++i) lanes[i] = depth[index + i];
+                                old_depth = _mm_loadu_ps(lanes);
+                            }
+                            pass = _mm_and_ps(pass, _mm_cmplt_ps(z, old_depth));
+                        }
+                        int pass_bits = _mm_movemask_ps(pass);
+
+                        if (pass_bits) {
+                            __m128 varyings[MAX_VARYINGS];
+                            if (planes.perspective) {
+                                __m128 w = _mm_div_ps(one, _mm_add_ps(inv_w_row, _mm_mul_ps(inv_w_dx, column_x)));
+                                for (int i = 0; i < varying_count; ++i) {
+                                    varyings[i] = _mm_mul_ps(_mm_add_ps(varyings_row[i], _mm_mul_ps(varyings_dx[i], column_x)), w);
+                                }
+                            }
+                            else {
+                                for (int i = 0; i < varying_count; ++i) {
+                                    varyings[i] = _mm_add_ps(varyings_row[i], _mm_mul_ps(varyings_dx[i], column_x));
+                                }
+                            }
+                            __m128i color;
+                            if (planes.texture) {
+                                color = _mm_or_si128(SampleTextureSimd(planes.texture, texture_level, varyings[0], varyings[1]),
+                                                     _mm_set1_epi32((int)0xFF000000));
+                            }
+                            else {
+                                color = ShadePixelsSimd(varyings);
+                            }
+
+                            if (full_group && pass_bits == 0xF) {
+                                _mm_storeu_si128((__m128i *)(pixel + index), color);
+                                _mm_storeu_ps(depth + index, z);
+                            }
+                            else if (full_group) {
+                                __m128i pass_mask = _mm_castps_si128(pass);
+                                __m128i old_color = _mm_loadu_si128((__m128i *)(pixel + index));
+                                __m128 old_depth = _mm_loadu_ps(depth + index);
+                                color = _mm_or_si128(_mm_and_si128(pass_mask, color), _mm_andnot_si128(pass_mask, old_color));
+                                _mm_storeu_si128((__m128i *)(pixel + index), color);
+                                _mm_storeu_ps(depth + index, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old_depth)));
+                            }
+                            else {
+                                u32 colors[4];
+                                float depths[4];
+                                _mm_storeu_si128((__m128i *)colors, color);
+                                _mm_storeu_ps(depths, z);
+                                for (int i = 0; i <= x1 - x; ++i) {
+                                    if (pass_bits & (1 << i)) {
+                                        pixel[index + i] = colors[i];
+                                        depth[index + i] = depths[i];
+                                    }
+                                }
+                            }
+
+                            written += bit_count[pass_bits];
+                            written_min = _mm_min_ps(written_min, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, plus_max)));
+                            written_max = _mm_max_ps(written_max, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, minus_max)));
+                        }
+                    }
+
+                    w0 = _mm_add_epi32(w0, w0_step);
+                    w1 = _mm_add_epi32(w1, w1_step);
+                    w2 = _mm_add_epi32(w2, w2_step);
+                    column_x = _mm_add_ps(column_x, column_step);
+                }
+            }
+
+            if (written) {
+                float mins[4];
+                float maxs[4];
+                _mm_storeu_ps(mins, written_min);
+                _mm_storeu_ps(maxs, written_max);
+                UpdateHizBlock(buffer, block_index, block_x, block_y, written,
+                               MIN(MIN(mins[0], mins[1]), MIN(mins[2], mins[3])),
+                               MAX(MAX(maxs[0], maxs[1]), MAX(maxs[2], maxs[3])));
+            }
+        }
+    }
+}
+
+void RenderTriangleToBufferClipped(Offscreen_Buffer *buffer, Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2, Rect2I clip) {
+    if (global_raster_simd) {
+        RenderTriangleToBufferClippedSimd(buffer, v0, v1, v2, clip);
+    }
+    else {
+        RenderTriangleToBufferClippedScalar(buffer, v0, v1, v2, clip);
+    }
+}
+
+void RenderTriangleToBuffer(Offscreen_Buffer *buffer, Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2) {
+    RenderTriangleToBufferClipped(buffer, v0, v1, v2, BufferRect(buffer));
+}
+
+//
+// clearing
+//
+// Streaming uses non-temporal stores, the memory doesn't have to be aligned. Those stores are weakly ordered,
+// so the caller has to _mm_sfence() before anyone else looks at the memory (once, it isn't cheap).
+void Fill32(u32 *memory, u32 value, size_t count, b8 streaming) {
+    size_t i = 0;
+    for (; i < count && ((size_t)(memory + i) & 15); ++i) {
+        memory[i] = value;
+    }
+
+    __m128i wide = _mm_set1_epi32((int)value);
+    if (streaming) {
+        for (; i + 16 <= count; i += 16) {
+            _mm_stream_si128((__m128i *)(memory + i), wide);
+            _mm_stream_si128((__m128i *)(memory + i + 4), wide);
+            _mm_stream_si128((__m128i *)(memory + i + 8), wide);
+            _mm_stream_si128((__m128i *)(memory + i + 12), wide);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        _mm_store_si128((__m128i *)(memory + i), wide);
+    }
+    for (; i < count; ++i) {
+        memory[i] = value;
+    }
+}
+
+inline u32 FloatBits(f32 value) {
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// clears color, depth and HiZ of one tile to the values given to ClearFramebufferLazy(). Streaming is for tiles
+// nothing is going to draw to.
+void ClearTile(Offscreen_Buffer *buffer, int tile_x, int tile_y, b8 streaming) {
+    int x_min = tile_x * TILE_SIZE;
+    int y_min = tile_y * TILE_SIZE;
+    int x_max = MIN(x_min + TILE_SIZE, buffer->width);
+    int y_max = MIN(y_min + TILE_SIZE, buffer->height);
+    u32 depth_bits = FloatBits(buffer->clear_depth);
+
+    for (int y = y_min; y < y_max; ++y) {
+        Fill32((u32 *)buffer->memory + y * buffer->width + x_min, buffer->clear_color, x_max - x_min, streaming);
+        Fill32((u32 *)buffer->depth + y * buffer->width + x_min, depth_bits, x_max - x_min, streaming);
+    }
+
+    // TILE_SIZE is a multiple of RASTER_BLOCK_SIZE, so the tile covers whole HiZ blocks
+    for (int block_y = y_min / RASTER_BLOCK_SIZE; block_y * RASTER_BLOCK_SIZE < y_max; ++block_y) {
+        for (int block_x = x_min / RASTER_BLOCK_SIZE; block_x * RASTER_BLOCK_SIZE < x_max; ++block_x) {
+            buffer->hiz_min[block_x + block_y * buffer->hiz_width] = buffer->clear_depth;
+            buffer->hiz_max[block_x + block_y * buffer->hiz_width] = buffer->clear_depth;
+        }
+    }
+
+    buffer->tile_clear_pending[tile_x + tile_y * buffer->clear_tiles_x] = 0;
+}
+
+// clears every tile a triangle of mesh touches, for the serial path
+void ClearTilesTouchedBy(Offscreen_Buffer *buffer, Projected_Vertex mesh[], u32 size) {
+    if (!buffer->clear_pending) return;
+
+    Rect2I buffer_rect = BufferRect(buffer);
+    for (u32 i = 0; i + 2 < size; i += 3) {
+        Rect2I bounds = TriangleBounds(mesh[i], mesh[i + 1], mesh[i + 2], buffer_rect);
+        if (bounds.x_min > bounds.x_max || bounds.y_min > bounds.y_max) continue;
+
+        for (int tile_y = bounds.y_min / TILE_SIZE; tile_y <= bounds.y_max / TILE_SIZE; ++tile_y) {
+            for (int tile_x = bounds.x_min / TILE_SIZE; tile_x <= bounds.x_max / TILE_SIZE; ++tile_x) {
+                if (buffer->tile_clear_pending[tile_x + tile_y * buffer->clear_tiles_x]) {
+                    ClearTile(buffer, tile_x, tile_y, M_FALSE);
+                }
+            }
+        }
+    }
+}
+
+WORK_QUEUE_CALLBACK(ResolveClearsWork) {
+    Offscreen_Buffer *buffer = (Offscreen_Buffer *)data;
+    int tile_count = buffer->clear_tiles_x * buffer->clear_tiles_y;
+
+    for (;;) {
+        int tile_index = platform_atomic_increment(&buffer->next_clear_tile);
+        if (tile_index >= tile_count) break;
+
+        if (buffer->tile_clear_pending[tile_index]) {
+            ClearTile(buffer, tile_index % buffer->clear_tiles_x, tile_index / buffer->clear_tiles_x, M_TRUE);
+        }
+    }
+    _mm_sfence();
+}
+
+// clears the tiles nothing was drawn to since ClearFramebufferLazy(), on the tile binner's threads if there are any
+void ResolveClears(Offscreen_Buffer *buffer) {
+    if (!buffer->clear_pending) return;
+
+    PROFILE_BEGIN("resolve clears");
+    buffer->next_clear_tile = 0;
+    Work_Queue *queue = global_render_mode == RENDER_MODE_TILED ? global_tile_binner.queue : 0;
+    if (queue) {
+        for (int i = 0; i < queue->thread_count; ++i) {
+            AddWorkQueueEntry(queue, ResolveClearsWork, buffer);
+        }
+    }
+    ResolveClearsWork(queue, buffer);
+    if (queue) {
+        CompleteAllWork(queue);
+    }
+    buffer->clear_pending = M_FALSE;
+    PROFILE_END("resolve clears");
+}
+
+void RenderMeshToBufferSerial(Offscreen_Buffer *buffer, Projected_Vertex mesh[], u32 size) {
+    PROFILE_BEGIN("raster");
+    ClearTilesTouchedBy(buffer, mesh, size);
+    Projected_Vertex triangle[3];
+
+    triangle[0] = mesh[0]; // dont call RenderTriangleToBuffer with i == 0
+    for (u32 i = 1; i < size; ++i) {
+        if (i % 3 == 0) {
+            RenderTriangleToBuffer(buffer, triangle[0], triangle[1], triangle[2]);
+        }
+        triangle[i % 3] = mesh[i];
+    }
+    RenderTriangleToBuffer(buffer, triangle[0], triangle[1], triangle[2]);
+    PROFILE_END("raster");
+}
+
+void CreateTileBinner(Tile_Binner *binner, Memory_Arena *arena, Work_Queue *queue, int width, int height) {
+    binner->tiles_x = (width  + TILE_SIZE - 1) / TILE_SIZE;
+    binner->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    binner->queue = queue;
+
+    int tile_count = binner->tiles_x * binner->tiles_y;
+    binner->tile_triangle_count  = ARENA_PUSH_ARRAY(arena, u32, tile_count);
+    binner->tile_triangle_offset = ARENA_PUSH_ARRAY(arena, u32, tile_count);
+    binner->triangle_indices = NULL;
+}
+
+WORK_QUEUE_CALLBACK(RenderTilesWork) {
+    Tile_Binner *binner = (Tile_Binner *)data;
+    Offscreen_Buffer *buffer = binner->buffer;
+    int tile_count = binner->tiles_x * binner->tiles_y;
+
+    PROFILE_BEGIN("raster");
+    // @note: every thread keeps grabbing the next tile until none are left, so one entry per thread is enough
+    for (;;) {
+        int tile_index = platform_atomic_increment(&binner->next_tile);
+        if (tile_index >= tile_count) break;
+
+        u32 triangle_count = binner->tile_triangle_count[tile_index];
+        if (triangle_count == 0) continue;
+
+        int tile_x = tile_index % binner->tiles_x;
+        int tile_y = tile_index / binner->tiles_x;
+        // the binner's tiles are the buffer's clear tiles, so every tile gets cleared by exactly one thread
+        if (buffer->clear_pending && buffer->tile_clear_pending[tile_x + tile_y * buffer->clear_tiles_x]) {
+            ClearTile(buffer, tile_x, tile_y, M_FALSE);
+        }
+
+        Rect2I clip;
+        clip.x_min = tile_x * TILE_SIZE;
+        clip.y_min = tile_y * TILE_SIZE;
+        clip.x_max = MIN(clip.x_min + TILE_SIZE - 1, buffer->width - 1);
+        clip.y_max = MIN(clip.y_min + TILE_SIZE - 1, buffer->height - 1);
+
+        // triangles were binned in submission order, so every pixel ends up the same as in the serial path
+        u32 *triangle_indices = binner->triangle_indices + binner->tile_triangle_offset[tile_index];
+        for (u32 i = 0; i < triangle_count; ++i) {
+            Projected_Vertex *triangle = binner->mesh + 3 * triangle_indices[i];
+            RenderTriangleToBufferClipped(buffer, triangle[0], triangle[1], triangle[2], clip);
+        }
+    }
+    PROFILE_END("raster");
+}
+
+// the bins come from arena and are gone afterwards
+void RenderMeshToBufferTiled(Tile_Binner *binner, Offscreen_Buffer *buffer, Memory_Arena *arena, Projected_Vertex mesh[], u32 size) {
+    ASSERT(size % 3 == 0);
+    ASSERT(binner->tiles_x * TILE_SIZE >= buffer->width && binner->tiles_y * TILE_SIZE >= buffer->height);
+
+    int tile_count = binner->tiles_x * binner->tiles_y;
+    u32 triangle_count = size / 3;
+    Rect2I buffer_rect = BufferRect(buffer);
+
+    PROFILE_BEGIN("binning");
+    // pass 1: count how many triangles touch every tile
+    for (int i = 0; i < tile_count; ++i) {
+        binner->tile_triangle_count[i] = 0;
+    }
+    u32 total = 0;
+    for (u32 triangle = 0; triangle < triangle_count; ++triangle) {
+        Projected_Vertex *v = mesh + 3 * triangle;
+        Rect2I bounds = TriangleBounds(v[0], v[1], v[2], buffer_rect);
+        if (bounds.x_min > bounds.x_max || bounds.y_min > bounds.y_max) continue;
+
+        for (int tile_y = bounds.y_min / TILE_SIZE; tile_y <= bounds.y_max / TILE_SIZE; ++tile_y) {
+            for (int tile_x = bounds.x_min / TILE_SIZE; tile_x <= bounds.x_max / TILE_SIZE; ++tile_x) {
+                ++binner->tile_triangle_count[tile_x + tile_y * binner->tiles_x];
+                ++total;
+            }
+        }
+    }
+
+    Arena_Marker marker = BeginArenaTemp(arena);
+    binner->triangle_indices = (u32 *)ArenaTryPushSize(arena, total * sizeof(u32), ARENA_DEFAULT_ALIGNMENT);
+    if (!binner->triangle_indices) { // no room left for the bins, one thread gets the same pixels without them
+        PROFILE_END("binning");
+        EndArenaTemp(marker);
+        RenderMeshToBufferSerial(buffer, mesh, size);
+        return;
+    }
+
+    u32 offset = 0;
+    for (int i = 0; i < tile_count; ++i) {
+        binner->tile_triangle_offset[i] = offset;
+        offset += binner->tile_triangle_count[i];
+        binner->tile_triangle_count[i] = 0;
+    }
+
+    // pass 2: write the triangle indices into the bins, in submission order
+    for (u32 triangle = 0; triangle < triangle_count; ++triangle) {
+        Projected_Vertex *v = mesh + 3 * triangle;
+        Rect2I bounds = TriangleBounds(v[0], v[1], v[2], buffer_rect);
+        if (bounds.x_min > bounds.x_max || bounds.y_min > bounds.y_max) continue;
+
+        for (int tile_y = bounds.y_min / TILE_SIZE; tile_y <= bounds.y_max / TILE_SIZE; ++tile_y) {
+            for (int tile_x = bounds.x_min / TILE_SIZE; tile_x <= bounds.x_max / TILE_SIZE; ++tile_x) {
+                int tile_index = tile_x + tile_y * binner->tiles_x;
+                binner->triangle_indices[binner->tile_triangle_offset[tile_index] +
+                                         binner->tile_triangle_count[tile_index]++] = triangle;
+            }
+        }
+    }
+
+    PROFILE_END("binning");
+
+    // rasterize: tiles don't overlap, so the pixel writes need no locks
+    binner->buffer = buffer;
+    binner->mesh = mesh;
+    binner->next_tile = 0;
+    for (int i = 0; i < binner->queue->thread_count; ++i) {
+        AddWorkQueueEntry(binner->queue, RenderTilesWork, binner);
+    }
+    RenderTilesWork(binner->queue, binner);
+    CompleteAllWork(binner->queue);
+
+    binner->triangle_indices = NULL;
+    EndArenaTemp(marker);
+}
+
+// exact test for small triangles, same sample positions and fill rule as the rasterizer
+b8 CoversAnyPixelCenter(Projected_Vertex v0, Projected_Vertex v1, Projected_Vertex v2, Rect2I bounds) {
+    Edge edge0 = SetupEdge(v1.position, v2.position);
+    Edge edge1 = SetupEdge(v2.position, v0.position);
+    Edge edge2 = SetupEdge(v0.position, v1.position);
+
+    for (int y = bounds.y_min; y <= bounds.y_max; ++y) {
+        for (int x = bounds.x_min; x <= bounds.x_max; ++x) {
+            i64 w0 = edge0.origin + (i64)edge0.step_x * x + (i64)edge0.step_y * y;
+            i64 w1 = edge1.origin + (i64)edge1.step_x * x + (i64)edge1.step_y * y;
+            i64 w2 = edge2.origin + (i64)edge2.step_x * x + (i64)edge2.step_y * y;
+            if (w0 >= 0 && w1 >= 0 && w2 >= 0) return M_TRUE;
+        }
+    }
+    return M_FALSE;
+}
+
+// Triangle setup, before any binning or rasterization happens. Removes back facing, degenerate and
+// sub-pixel triangles from the mesh in place and returns the new size. The rasterizer only fills
+// triangles with a positive area, so with CULL_NONE counter clockwise triangles get their winding flipped.
+u32 CullTriangles(Offscreen_Buffer *buffer, Projected_Vertex mesh[], u32 size, Cull_Mode cull_mode, Cull_Stats *stats) {
+    Rect2I buffer_rect = BufferRect(buffer);
+    u32 out_size = 0;
+
+    for (u32 i = 0; i + 2 < size; i += 3) {
+        Projected_Vertex v0 = mesh[i];
+        Projected_Vertex v1 = mesh[i + 1];
+        Projected_Vertex v2 = mesh[i + 2];
+        ++stats->submitted;
+
+        // @note: y points down on screen, so a positive area means clockwise
+        i64 area = EdgeCross(v1.position, v2.position, v0.position);
+        if (area == 0) {
+            ++stats->degenerate;
+            continue;
+        }
+        if ((area > 0 && cull_mode == CULL_CW) || (area < 0 && cull_mode == CULL_CCW)) {
+            ++stats->back_facing;
+            continue;
+        }
+        if (area < 0) {
+            Projected_Vertex temp = v1;
+            v1 = v2;
+            v2 = temp;
+        }
+
+        Rect2I bounds = TriangleBounds(v0, v1, v2, buffer_rect);
+        int bounds_width  = bounds.x_max - bounds.x_min + 1;
+        int bounds_height = bounds.y_max - bounds.y_min + 1;
+        if (bounds_width <= 0 || bounds_height <= 0 ||
+            (bounds_width * bounds_height <= SLIVER_TEST_MAX_PIXELS && !CoversAnyPixelCenter(v0, v1, v2, bounds))) {
+            ++stats->no_coverage;
+            continue;
+        }
+
+        mesh[out_size++] = v0;
+        mesh[out_size++] = v1;
+        mesh[out_size++] = v2;
+        ++stats->passed;
+    }
+
+    return out_size;
+}
+
+// rasterizes triangles that already went through CullTriangles(), arena is scratch for the bins
+void RasterizeTriangles(Offscreen_Buffer *buffer, Memory_Arena *arena, Projected_Vertex mesh[], u32 size) {
+    if (size == 0) return;
+
+    if (global_render_mode == RENDER_MODE_TILED && global_tile_binner.queue && size % 3 == 0) {
+        RenderMeshToBufferTiled(&global_tile_binner, buffer, arena, mesh, size);
+    }
+    else {
+        RenderMeshToBufferSerial(buffer, mesh, size);
+    }
+}
+
+void RenderMeshToBuffer(Offscreen_Buffer *buffer, Memory_Arena *arena, Projected_Vertex mesh[], u32 size) {
+    ASSERT(size % 3 == 0);
+    PROFILE_BEGIN("cull");
+    size = CullTriangles(buffer, mesh, size, global_cull_mode, &global_cull_stats);
+    PROFILE_END("cull");
+    RasterizeTriangles(buffer, arena, mesh, size);
+}
+
+// the streams are padded to a multiple of 4 so TransformPositionsBatch never needs a scalar tail
+void BuildPositionStreams(Indexed_Mesh *mesh, Memory_Arena *arena) {
+    u32 padded_count = (mesh->vertex_count + 3) & ~3u;
+    f32 *memory = ARENA_PUSH_ARRAY(arena, f32, 3 * padded_count);
+    memset(memory, 0, 3 * padded_count * sizeof(f32)); // the padding gets transformed too
+    mesh->positions_x = memory;
+    mesh->positions_y = memory + padded_count;
+    mesh->positions_z = memory + 2 * padded_count;
+
+    for (u32 i = 0; i < mesh->vertex_count; ++i) {
+        mesh->positions_x[i] = mesh->vertices[i].position.x;
+        mesh->positions_y[i] = mesh->vertices[i].position.y;
+        mesh->positions_z[i] = mesh->vertices[i].position.z;
+    }
+}
+
+void ComputeMeshBounds(Indexed_Mesh *mesh) {
+    Mesh_Bounds bounds = {0};
+    if (mesh->vertex_count) {
+        bounds.min = bounds.max = mesh->vertices[0].position;
+    }
+    for (u32 i = 1; i < mesh->vertex_count; ++i) {
+        Vec3 p = mesh->vertices[i].position;
+        bounds.min.x = MIN(bounds.min.x, p.x);
+        bounds.min.y = MIN(bounds.min.y, p.y);
+        bounds.min.z = MIN(bounds.min.z, p.z);
+        bounds.max.x = MAX(bounds.max.x, p.x);
+        bounds.max.y = MAX(bounds.max.y, p.y);
+        bounds.max.z = MAX(bounds.max.z, p.z);
+    }
+    bounds.center = vec3_scale(0.5f, vec3_add(bounds.min, bounds.max));
+
+    // usually tighter than half the box diagonal
+    f32 radius_squared = 0.0f;
+    for (u32 i = 0; i < mesh->vertex_count; ++i) {
+        Vec3 d = vec3_sub(mesh->vertices[i].position, bounds.center);
+        radius_squared = MAX(radius_squared, vec3_dot(d, d));
+    }
+    bounds.radius = sqrtf(radius_squared);
+    mesh->bounds = bounds;
+}
+
+inline __m128 FloorSse2(__m128 x) {
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+// Batched vertex stage: transforms four vertices per iteration from structure-of-arrays positions, computes
+// their clip codes and fuses the perspective divide (one reciprocal per vertex) and the viewport transform
+// into the same pass. Does the same float operations in the same order as mat4_vec4_mul, ClipCodes and
+// ProjectClipVertex, so the output matches the one vertex at a time path exactly. Colors are not touched.
+// count gets rounded up to a multiple of 4, out needs room for that many vertices.
+void TransformPositionsBatch(Mat4 *m, f32 *xs, f32 *ys, f32 *zs, u32 count, float width, float height, Transformed_Vertex *out) {
+    float guard_x = GUARD_BAND_EXTENT / (0.5f * width);
+    float guard_y = GUARD_BAND_EXTENT / (0.5f * height);
+
+    __m128 m00 = _mm_set1_ps(m->e[0][0]), m01 = _mm_set1_ps(m->e[0][1]), m02 = _mm_set1_ps(m->e[0][2]), m03 = _mm_set1_ps(m->e[0][3]);
+    __m128 m10 = _mm_set1_ps(m->e[1][0]), m11 = _mm_set1_ps(m->e[1][1]), m12 = _mm_set1_ps(m->e[1][2]), m13 = _mm_set1_ps(m->e[1][3]);
+    __m128 m20 = _mm_set1_ps(m->e[2][0]), m21 = _mm_set1_ps(m->e[2][1]), m22 = _mm_set1_ps(m->e[2][2]), m23 = _mm_set1_ps(m->e[2][3]);
+    __m128 m30 = _mm_set1_ps(m->e[3][0]), m31 = _mm_set1_ps(m->e[3][1]), m32 = _mm_set1_ps(m->e[3][2]), m33 = _mm_set1_ps(m->e[3][3]);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 sign_bit = _mm_set1_ps(-0.0f);
+    __m128 half_width = _mm_set1_ps(width / 2);
+    __m128 half_height = _mm_set1_ps(height / 2);
+    __m128 subpixel_one = _mm_set1_ps((float)SUBPIXEL_ONE);
+    __m128 guard_x_wide = _mm_set1_ps(guard_x);
+    __m128 guard_y_wide = _mm_set1_ps(guard_y);
+
+    for (u32 i = 0; i < count; i += 4) {
+        __m128 x = _mm_load_ps(xs + i);
+        __m128 y = _mm_load_ps(ys + i);
+        __m128 z = _mm_load_ps(zs + i);
+
+        // w of the input is 1
+        __m128 clip_x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m01, y)), _mm_mul_ps(m02, z)), m03);
+        __m128 clip_y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, x), _mm_mul_ps(m11, y)), _mm_mul_ps(m12, z)), m13);
+        __m128 clip_z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, x), _mm_mul_ps(m21, y)), _mm_mul_ps(m22, z)), m23);
+        __m128 clip_w = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m30, x), _mm_mul_ps(m31, y)), _mm_mul_ps(m32, z)), m33);
+
+        // clip codes, same planes and bit order as ClipDistance
+        __m128 distances[CLIP_PLANE_COUNT];
+        distances[0] = _mm_add_ps(clip_w, clip_x);
+        distances[1] = _mm_sub_ps(clip_w, clip_x);
+        distances[2] = _mm_add_ps(clip_w, clip_y);
+        distances[3] = _mm_sub_ps(clip_w, clip_y);
+        distances[4] = _mm_add_ps(clip_w, clip_z);
+        distances[5] = _mm_sub_ps(clip_w, clip_z);
+        distances[6] = _mm_add_ps(_mm_mul_ps(guard_x_wide, clip_w), clip_x);
+        distances[7] = _mm_sub_ps(_mm_mul_ps(guard_x_wide, clip_w), clip_x);
+        distances[8] = _mm_add_ps(_mm_mul_ps(guard_y_wide, clip_w), clip_y);
+        distances[9] = _mm_sub_ps(_mm_mul_ps(guard_y_wide, clip_w), clip_y);
+        __m128i codes = _mm_setzero_si128();
+        for (int plane = 0; plane < CLIP_PLANE_COUNT; ++plane) {
+            __m128i outside = _mm_castps_si128(_mm_cmplt_ps(distances[plane], zero));
+            codes = _mm_or_si128(codes, _mm_and_si128(outside, _mm_set1_epi32(1 << plane)));
+        }
+
+        // perspective divide and viewport transform, garbage for vertices that need clipping but those never get used
+        __m128 inv_w = _mm_div_ps(one, clip_w);
+        __m128 ndc_x = _mm_mul_ps(clip_x, inv_w);
+        __m128 ndc_y = _mm_mul_ps(_mm_xor_ps(clip_y, sign_bit), inv_w);
+        __m128 ndc_z = _mm_mul_ps(clip_z, inv_w);
+        __m128 screen_x = _mm_add_ps(_mm_mul_ps(half_width, ndc_x), half_width);
+        __m128 screen_y = _mm_add_ps(_mm_mul_ps(half_height, ndc_y), half_height);
+        __m128 depth = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(half, ndc_z), half), zero), one);
+        __m128i fixed_x = _mm_cvttps_epi32(FloorSse2(_mm_add_ps(_mm_mul_ps(screen_x, subpixel_one), half)));
+        __m128i fixed_y = _mm_cvttps_epi32(FloorSse2(_mm_add_ps(_mm_mul_ps(screen_y, subpixel_one), half)));
+
+        // back to one struct per vertex for the triangle assembly
+        _MM_TRANSPOSE4_PS(clip_x, clip_y, clip_z, clip_w);
+        u32 lane_codes[4];
+        i32 lane_x[4];
+        i32 lane_y[4];
+        f32 lane_z[4];
+        f32 lane_inv_w[4];
+        _mm_storeu_si128((__m128i *)lane_codes, codes);
+        _mm_storeu_si128((__m128i *)lane_x, fixed_x);
+        _mm_storeu_si128((__m128i *)lane_y, fixed_y);
+        _mm_storeu_ps(lane_z, depth);
+        _mm_storeu_ps(lane_inv_w, inv_w);
+
+        _mm_storeu_ps(out[i + 0].clip.position.e, clip_x);
+        _mm_storeu_ps(out[i + 1].clip.position.e, clip_y);
+        _mm_storeu_ps(out[i + 2].clip.position.e, clip_z);
+        _mm_storeu_ps(out[i + 3].clip.position.e, clip_w);
+        for (int lane = 0; lane < 4; ++lane) {
+            Transformed_Vertex *transformed = out + i + lane;
+            transformed->clip_codes = lane_codes[lane];
+            transformed->projected.position.x = lane_x[lane];
+            transformed->projected.position.y = lane_y[lane];
+            transformed->projected.z = lane_z[lane];
+            transformed->projected.inv_w = lane_inv_w[lane];
+        }
+    }
+}
+
+void LoadVertexVaryings(Indexed_Mesh *mesh, u32 i, Clip_Vertex *out) {
+    u32 count = 3;
+    if (mesh->varyings && (mesh->texture || mesh->varying_count >= 3)) {
+        count = MIN(mesh->varying_count, MAX_VARYINGS);
+        memcpy(out->varyings, mesh->varyings + (size_t)i * mesh->varying_count, count * sizeof(f32));
+    }
+    else {
+        out->varyings[0] = (f32)mesh->vertices[i].color.r;
+        out->varyings[1] = (f32)mesh->vertices[i].color.g;
+        out->varyings[2] = (f32)mesh->vertices[i].color.b;
+    }
+    for (u32 j = count; j < MAX_VARYINGS; ++j) {
+        out->varyings[j] = 0.0f;
+    }
+    out->varying_count = (u8)count;
+    out->perspective = mesh->perspective_varyings;
+    out->texture = mesh->texture;
+}
+
+inline u32 MeshIndex(Indexed_Mesh *mesh, u32 i) {
+    return mesh->index_type == INDEX_U16 ? ((u16 *)mesh->indices)[i] : ((u32 *)mesh->indices)[i];
+}
+
+// The varyings only depend on the mesh, they are loaded once per draw. The position transform below only writes
+// the positions, so instances can reuse them.
+void LoadMeshVaryings(Indexed_Mesh *mesh, Transformed_Vertex *transformed_vertices) {
+    for (u32 i = 0; i < mesh->vertex_count; ++i) {
+        Transformed_Vertex *transformed = transformed_vertices + i;
+        LoadVertexVaryings(mesh, i, &transformed->clip);
+        memcpy(transformed->projected.varyings, transformed->clip.varyings, sizeof(transformed->clip.varyings));
+        transformed->projected.varying_count = transformed->clip.varying_count;
+        transformed->projected.perspective = transformed->clip.perspective;
+        transformed->projected.texture = transformed->clip.texture;
+    }
+}
+
+// Every vertex is transformed, classified against the clip planes and (if it doesn't need clipping) projected.
+// Returns the clip codes all of the vertices have in common.
+u32 TransformMeshPositions(Mat4 *mvp, Indexed_Mesh *mesh, float width, float height, Transformed_Vertex *transformed_vertices) {
+    float guard_x = GUARD_BAND_EXTENT / (0.5f * width);
+    float guard_y = GUARD_BAND_EXTENT / (0.5f * height);
+
+    if (mesh->positions_x) {
+        TransformPositionsBatch(mvp, mesh->positions_x, mesh->positions_y, mesh->positions_z, mesh->vertex_count,
+                                width, height, transformed_vertices);
+    }
+    else for (u32 i = 0; i < mesh->vertex_count; ++i) {
+        Vertex *vertex = mesh->vertices + i;
+        Transformed_Vertex *transformed = transformed_vertices + i;
+
+        Vec4 position = { vertex->position.x, vertex->position.y, vertex->position.z, 1.0f };
+        mat4_vec4_mul_ptr(&transformed->clip.position, mvp, &position);
+        transformed->clip_codes = ClipCodes(transformed->clip.position, guard_x, guard_y);
+        if (!(transformed->clip_codes & CLIP_MUST_CLIP)) {
+            transformed->projected = ProjectClipVertex(transformed->clip, width, height);
+        }
+    }
+
+    u32 common_codes = CLIP_FRUSTUM;
+    for (u32 i = 0; i < mesh->vertex_count; ++i) {
+        common_codes &= transformed_vertices[i].clip_codes;
+    }
+    return common_codes;
+}
+
+// The triangles are assembled by index from the transformed vertices and clipped if needed. They get appended
+// at the top of out one by one, so they continue whatever array ended there. Returns the number of vertices.
+// If out runs full the rest of the mesh is left out and counted in stats->out_of_memory, also in debug builds.
+u32 AssembleTriangles(Indexed_Mesh *mesh, Transformed_Vertex *transformed_vertices, float width, float height,
+                      Memory_Arena *out, Cull_Stats *stats) {
+    u32 triangles_size = 0;
+    for (u32 i = 0; i + 2 < mesh->index_count; i += 3) {
+        Transformed_Vertex *t0 = transformed_vertices + MeshIndex(mesh, i);
+        Transformed_Vertex *t1 = transformed_vertices + MeshIndex(mesh, i + 1);
+        Transformed_Vertex *t2 = transformed_vertices + MeshIndex(mesh, i + 2);
+
+        if (t0->clip_codes & t1->clip_codes & t2->clip_codes & CLIP_FRUSTUM) continue;
+
+        u32 planes = (t0->clip_codes | t1->clip_codes | t2->clip_codes) & CLIP_MUST_CLIP;
+        if (!planes) {
+            Projected_Vertex *triangle = (Projected_Vertex *)ArenaTryPushSize(out, 3 * sizeof(Projected_Vertex), 1);
+            if (!triangle) {
+                stats->out_of_memory += (mesh->index_count - i) / 3;
+                break;
+            }
+            triangle[0] = t0->projected;
+            triangle[1] = t1->projected;
+            triangle[2] = t2->projected;
+            triangles_size += 3;
+        }
+        else {
+            size_t worst_case = 3 * MAX_CLIPPED_TRIANGLES * sizeof(Projected_Vertex);
+            Projected_Vertex *clipped = (Projected_Vertex *)ArenaTryPushSize(out, worst_case, 1);
+            if (!clipped) {
+                stats->out_of_memory += (mesh->index_count - i) / 3;
+                break;
+            }
+            u32 clipped_size = ClipPolygon(t0->clip, t1->clip, t2->clip, planes, width, height, clipped);
+            ArenaPop(out, worst_case - clipped_size * sizeof(Projected_Vertex));
+            triangles_size += clipped_size;
+        }
+    }
+    return triangles_size;
+}
+
+// Every vertex is transformed exactly once, then the triangles are assembled. The transformed vertices get
+// pushed onto scratch and stay there, the triangles are appended at the top of out (which may be scratch).
+// Returns the first triangle vertex and the number of them in size.
+Projected_Vertex *TransformAndClipIndexedMesh(Offscreen_Buffer *buffer, Memory_Arena *scratch, Memory_Arena *out,
+                                              Mat4 *mvp, Indexed_Mesh *mesh, u32 *size, Cull_Stats *stats) {
+    float width = (float)buffer->width;
+    float height = (float)buffer->height;
+
+    // the batched vertex stage writes whole groups of 4
+    Transformed_Vertex *transformed_vertices = ARENA_PUSH_ARRAY(scratch, Transformed_Vertex, (mesh->vertex_count + 3) & ~3u);
+
+    PROFILE_BEGIN("vertex");
+    LoadMeshVaryings(mesh, transformed_vertices);
+    u32 common_codes = TransformMeshPositions(mvp, mesh, width, height, transformed_vertices);
+    PROFILE_END("vertex");
+
+    PROFILE_BEGIN("setup");
+    Projected_Vertex *triangles = (Projected_Vertex *)ArenaTop(out);
+    u32 triangles_size = 0;
+    if (!common_codes) { // otherwise every triangle is outside the same plane
+        triangles_size = AssembleTriangles(mesh, transformed_vertices, width, height, out, stats);
+    }
+    PROFILE_END("setup");
+
+    *size = triangles_size;
+    return triangles;
+}
+
+// proj * (view * model) for every model, in the same order as for a single draw so the results are the same
+void ComposeInstanceMvps(Mat4 *mvps, Mat4 *proj, Mat3x4 *view, Mat3x4 *models, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        Mat3x4 model_view;
+        mat3x4_mul(&model_view, view, models + i);
+        mat4_mul_mat3x4(mvps + i, proj, &model_view);
+    }
+}
+
+// everything it pushes onto arena is gone afterwards
+void DrawIndexedMesh(Offscreen_Buffer *buffer, Memory_Arena *arena, Mat4 *mvp, Indexed_Mesh *mesh) {
+    Arena_Marker marker = BeginArenaTemp(arena);
+    u32 triangles_size;
+    Projected_Vertex *triangles = TransformAndClipIndexedMesh(buffer, arena, arena, mvp, mesh, &triangles_size,
+                                                              &global_cull_stats);
+    RenderMeshToBuffer(buffer, arena, triangles, triangles_size);
+    EndArenaTemp(marker);
+}
+
+void ClearFramebuffer(Offscreen_Buffer *buffer, u32 color) {
+    if (!buffer->memory) return;
+    // a lazy clear still pending would overwrite this one later on
+    ResolveClears(buffer);
+    
+    size_t bitmap_size = (size_t)buffer->width * buffer->height;
+    
+    PROFILE_BEGIN("clear color");
+    Fill32((u32 *)buffer->memory, color, bitmap_size, bitmap_size * sizeof(u32) >= STREAMING_CLEAR_MIN_BYTES);
+    _mm_sfence();
+    PROFILE_END("clear color");
+}
+
+void ClearDepthBuffer(Offscreen_Buffer *buffer, f32 value) {
+    if (!buffer->depth) return;
+    ResolveClears(buffer);
+
+    PROFILE_BEGIN("clear depth");
+    size_t bitmap_size = (size_t)buffer->width * buffer->height;
+    Fill32((u32 *)buffer->depth, FloatBits(value), bitmap_size, bitmap_size * sizeof(f32) >= STREAMING_CLEAR_MIN_BYTES);
+    _mm_sfence();
+
+    int block_count = buffer->hiz_width * buffer->hiz_height;
+    for (int i = 0; i < block_count; ++i) {
+        buffer->hiz_min[i] = value;
+        buffer->hiz_max[i] = value;
+    }
+    PROFILE_END("clear depth");
+}
+
+// Clears color and depth only where it is needed: the tiles the rasterizer touches get cleared right before
+// it draws into them (while they are about to be in the cache anyway) and ResolveClears() clears the rest.
+// Pixels that are covered right after the clear cost no extra pass over memory.
+void ClearFramebufferLazy(Offscreen_Buffer *buffer, u32 color, f32 depth) {
+    buffer->clear_color = color;
+    buffer->clear_depth = depth;
+    memset(buffer->tile_clear_pending, 1, buffer->clear_tiles_x * buffer->clear_tiles_y);
+    buffer->clear_pending = M_TRUE;
+}
+
+void CreateFramebuffer(Offscreen_Buffer *buffer, Memory_Arena *arena, int width, int height) {
+    if (buffer->memory) {
+        return;
+    }
+    
+    buffer->width  = width;
+    buffer->height = height;
+    buffer->bytes_per_pixel = 4;
+
+    int bitmap_memory_size = buffer->bytes_per_pixel * buffer->width * buffer->height;
+    buffer->memory = ArenaPushSize(arena, bitmap_memory_size, 64); // the clears want whole cache lines
+
+    buffer->pitch = buffer->width * buffer->bytes_per_pixel;
+
+    buffer->hiz_width  = (buffer->width  + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE;
+    buffer->hiz_height = (buffer->height + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE;
+    int depth_memory_size = sizeof(f32) * (buffer->width * buffer->height + 2 * buffer->hiz_width * buffer->hiz_height);
+    buffer->depth = (f32 *)ArenaPushSize(arena, depth_memory_size, 64);
+    buffer->hiz_min = buffer->depth + buffer->width * buffer->height;
+    buffer->hiz_max = buffer->hiz_min + buffer->hiz_width * buffer->hiz_height;
+
+    buffer->clear_tiles_x = (buffer->width  + TILE_SIZE - 1) / TILE_SIZE;
+    buffer->clear_tiles_y = (buffer->height + TILE_SIZE - 1) / TILE_SIZE;
+    buffer->tile_clear_pending = ARENA_PUSH_ARRAY(arena, u8, buffer->clear_tiles_x * buffer->clear_tiles_y);
+    buffer->clear_pending = M_FALSE;
+
+    ClearFramebuffer(buffer, 0);
+    ClearDepthBuffer(buffer, 1.0f);
+}
+
+//
+// presenting
+//
+// A color only buffer for UpscaleBuffer() to write to, (re)allocated when the size changes. The contents are
+// undefined afterwards. Not in an arena since it follows the window size and the old one has to go.
+void ResizeDisplayBuffer(Offscreen_Buffer *buffer, int width, int height) {
+    width = MAX(width, 1);
+    height = MAX(height, 1);
+    if (buffer->memory && buffer->width == width && buffer->height == height) return;
+
+    if (buffer->memory) {
+        platform_free_memory(buffer->memory, (size_t)buffer->pitch * buffer->height);
+    }
+    Offscreen_Buffer zero_buffer = {0};
+    *buffer = zero_buffer;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->bytes_per_pixel = 4;
+    buffer->pitch = width * buffer->bytes_per_pixel;
+    buffer->memory = platform_allocate_memory((size_t)buffer->pitch * height);
+}
+
+// writes count * scale pixels, every input pixel scale times
+void ExpandRow(u32 *out, u32 *in, int count, int scale) {
+    if (scale == 1) {
+        memcpy(out, in, count * sizeof(u32));
+    }
+    else if (scale == 2) {
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128i pixels = _mm_loadu_si128((__m128i *)(in + i));
+            _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128((__m128i *)(out + 2 * i + 4), _mm_unpackhi_epi32(pixels, pixels));
+        }
+        for (; i < count; ++i) {
+            out[2 * i] = in[i];
+            out[2 * i + 1] = in[i];
+        }
+    }
+    else {
+        for (int i = 0; i < count; ++i) {
+            __m128i pixel = _mm_set1_epi32((int)in[i]);
+            int j = 0;
+            for (; j + 4 <= scale; j += 4) {
+                _mm_storeu_si128((__m128i *)(out + j), pixel);
+            }
+            for (; j < scale; ++j) {
+                out[j] = in[i];
+            }
+            out += scale;
+        }
+    }
+}
+
+WORK_QUEUE_CALLBACK(UpscaleBandsWork) {
+    Upscale_Job *job = (Upscale_Job *)data;
+    Offscreen_Buffer *source = job->source;
+    Offscreen_Buffer *target = job->target;
+    int scaled_width = job->x_max - job->x_min;
+    int source_x = (job->x_min - job->offset_x) / job->scale;
+
+    for (;;) {
+        int band = platform_atomic_increment(&job->next_band);
+        if (band >= job->band_count) break;
+
+        int band_y_min = band * UPSCALE_BAND_ROWS;
+        int band_y_max = MIN(band_y_min + UPSCALE_BAND_ROWS, target->height);
+        for (int y = band_y_min; y < band_y_max; ++y) {
+            u32 *row = (u32 *)target->memory + y * target->width;
+            if (y < job->y_min || y >= job->y_max) {
+                Fill32(row, job->border_color, target->width, M_FALSE);
+                continue;
+            }
+
+            Fill32(row, job->border_color, job->x_min, M_FALSE);
+            Fill32(row + job->x_max, job->border_color, target->width - job->x_max, M_FALSE);
+            // all rows from the same source row look the same, only the first one in the band gets expanded
+            if (y > band_y_min && (y - job->offset_y) % job->scale != 0) {
+                memcpy(row + job->x_min, row - target->width + job->x_min, scaled_width * sizeof(u32));
+            }
+            else {
+                u32 *source_row = (u32 *)source->memory + ((y - job->offset_y) / job->scale) * source->width;
+                ExpandRow(row + job->x_min, source_row + source_x, scaled_width / job->scale, job->scale);
+            }
+        }
+    }
+}
+
+// Scales source up by the biggest integer factor that fits into target (nearest neighbor, so pixels stay
+// square and sharp), centers it and fills the rest with border_color. A source bigger than target gets
+// cropped instead. Bands of rows are spread over queue's threads if queue isn't 0.
+void UpscaleBuffer(Offscreen_Buffer *target, Offscreen_Buffer *source, u32 border_color, Work_Queue *queue) {
+    if (!source->memory || !target->memory) return;
+
+    PROFILE_BEGIN("upscale");
+    Upscale_Job job;
+    job.source = source;
+    job.target = target;
+    job.scale = MAX(MIN(target->width / source->width, target->height / source->height), 1);
+    job.offset_x = (target->width  - job.scale * source->width)  / 2;
+    job.offset_y = (target->height - job.scale * source->height) / 2;
+    job.x_min = MAX(job.offset_x, 0);
+    job.y_min = MAX(job.offset_y, 0);
+    job.x_max = MIN(job.offset_x + job.scale * source->width,  target->width);
+    job.y_max = MIN(job.offset_y + job.scale * source->height, target->height);
+    job.border_color = border_color;
+    job.band_count = (target->height + UPSCALE_BAND_ROWS - 1) / UPSCALE_BAND_ROWS;
+    job.next_band = 0;
+
+    if (queue) {
+        for (int i = 0; i < queue->thread_count; ++i) {
+            AddWorkQueueEntry(queue, UpscaleBandsWork, &job);
+        }
+    }
+    UpscaleBandsWork(queue, &job);
+    if (queue) {
+        CompleteAllWork(queue);
+    }
+    PROFILE_END("upscale");
+}
+
+//
+// test geometry
+//
+static Vertex global_cube_vertices[] = {{{ -1.0f, -1.0f, -1.0f }, { 255, 0, 0 }},
+                                        {{  1.0f, -1.0f, -1.0f }, { 255, 0, 0 }},
+                                        {{ -1.0f,  1.0f, -1.0f }, { 255, 0, 0 }},
+                                        {{  1.0f,  1.0f, -1.0f }, { 255, 0, 0 }},
+
+                                        {{  1.0f, -1.0f, -1.0f }, { 255, 255, 0 }},
+                                        {{  1.0f, -1.0f,  1.0f }, { 255, 255, 0 }},
+                                        {{  1.0f,  1.0f, -1.0f }, { 255, 255, 0 }},
+                                        {{  1.0f,  1.0f,  1.0f }, { 255, 255, 0 }},
+
+                                        {{  1.0f, -1.0f,  1.0f }, { 255, 0, 255 }},
+                                        {{ -1.0f, -1.0f,  1.0f }, { 255, 0, 255 }},
+                                        {{  1.0f,  1.0f,  1.0f }, { 255, 0, 255 }},
+                                        {{ -1.0f,  1.0f,  1.0f }, { 255, 0, 255 }},
+
+                                        {{ -1.0f, -1.0f,  1.0f }, { 0, 255, 0 }},
+                                        {{ -1.0f, -1.0f, -1.0f }, { 0, 255, 0 }},
+                                        {{ -1.0f,  1.0f,  1.0f }, { 0, 255, 0 }},
+                                        {{ -1.0f,  1.0f, -1.0f }, { 0, 255, 0 }},
+
+                                        {{  1.0f,  1.0f,  1.0f }, { 0, 255, 255 }},
+                                        {{ -1.0f,  1.0f,  1.0f }, { 0, 255, 255 }},
+                                        {{  1.0f,  1.0f, -1.0f }, { 0, 255, 255 }},
+                                        {{ -1.0f,  1.0f, -1.0f }, { 0, 255, 255 }},
+
+                                        {{  1.0f, -1.0f, -1.0f }, { 0, 0, 255 }},
+                                        {{ -1.0f, -1.0f, -1.0f }, { 0, 0, 255 }},
+                                        {{  1.0f, -1.0f,  1.0f }, { 0, 0, 255 }},
+                                        {{ -1.0f, -1.0f,  1.0f }, { 0, 0, 255 }}};
+
+static u16 global_cube_indices[] = { 0, 1, 2, 1, 3, 2,
+                                     4, 5, 6, 5, 7, 6,
+                                     8, 9, 10, 9, 11, 10,
+                                     12, 13, 14, 13, 15, 14,
+                                     16, 17, 18, 17, 19, 18,
+                                     20, 21, 22, 21, 23, 22 };
+
+// the unit cube from -1 to 1 with one color per face, outside faces are clockwise on screen
+Indexed_Mesh CreateCubeMesh(Memory_Arena *arena) {
+    Indexed_Mesh cube = {0};
+    cube.vertices = global_cube_vertices;
+    cube.vertex_count = SIZE(global_cube_vertices);
+    cube.indices = global_cube_indices;
+    cube.index_count = SIZE(global_cube_indices);
+    cube.index_type = INDEX_U16;
+    BuildPositionStreams(&cube, arena);
+    ComputeMeshBounds(&cube);
+    return cube;
+}
+
+// every face gets the whole texture once
+static f32 global_cube_uvs[] = { 0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f,
+                                 0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f,
+                                 0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f,
+                                 0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f,
+                                 0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f,
+                                 0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f };
+
+// CreateCubeMesh() with the texture on every face, perspective correct
+void TextureCubeMesh(Indexed_Mesh *cube, Texture *texture) {
+    cube->varyings = global_cube_uvs;
+    cube->varying_count = 2;
+    cube->perspective_varyings = M_TRUE;
+    cube->texture = texture;
+}
+
+#endif
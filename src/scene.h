@@ -0,0 +1,449 @@
+/*
+* Scenes.
+*
+* A Scene is a list of instances, a mesh and where it is. Every instance
+* keeps world space bounds, a sphere and a box made from the mesh's
+* bounds whenever it moves. DrawScene() tests them against the planes of
+* the view frustum before a single vertex gets transformed, so the vertex
+* stage only sees instances that can end up on the screen.
+*
+* Static instances are put into a bounding volume hierarchy by
+* BuildSceneBvh(). A subtree outside the frustum is dropped with one box
+* test and the planes a subtree is completely inside of aren't tested for
+* anything below it, so culling costs about as much as the visible part of
+* the scene instead of all of it. Dynamic instances are tested one by one,
+* they are meant to be the few that move every frame.
+*
+* With occluders and an occlusion buffer (see occlusion.h) the instances
+* left after frustum culling also get tested against the occluders, the
+* ones completely behind them are dropped.
+*
+* Instances of a mesh with levels of detail (see mesh_lod.h) get drawn
+* with the level that fits their size on the screen.
+*/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#define BVH_LEAF_SIZE 4  // instances per leaf at most
+#define BVH_MAX_DEPTH 64 // of the traversal stack, median splits stay far below it
+
+#define SCENE_FULL 0xFFFFFFFF // AddSceneInstance() without room left
+
+#define FRUSTUM_PLANE_COUNT 6
+#define FRUSTUM_ALL_PLANES 0x3F
+
+typedef struct Tag_Scene_Instance {
+    Indexed_Mesh *mesh;
+    Mat3x4 model;
+    b8 is_static;
+    Indexed_Mesh *occluder; // optional, see SetSceneOccluder()
+
+    // world space, see UpdateInstanceBounds()
+    Vec3 center;
+    f32 radius;
+    Vec3 box_min;
+    Vec3 box_max;
+} Scene_Instance;
+
+typedef struct Tag_Bvh_Node {
+    Vec3 box_min;
+    Vec3 box_max;
+    u32 first; // inner nodes: the left child, the right one is next to it. Leaves: into bvh_instances
+    u32 count; // instances in a leaf, 0 for inner nodes
+} Bvh_Node;
+
+typedef struct Tag_Frustum {
+    // left, right, bottom, top, near, far. p is inside a plane if dot(plane.xyz, p) + plane.w >= 0, the planes
+    // are normalized so that is the distance.
+    Vec4 planes[FRUSTUM_PLANE_COUNT];
+} Frustum;
+
+typedef struct Tag_Scene_Stats { // of the last DrawScene()
+    u32 nodes_visited;
+    u32 instances_tested;
+    u32 drawn;
+    u32 draws; // instanced, one for every run of instances with the same mesh
+    u32 simplified; // drawn with a coarser level of detail than the full one
+    u32 occluders;  // rasterized into the occlusion buffer
+    u32 occluded;   // in the frustum but hidden behind the occluders
+} Scene_Stats;
+
+typedef struct Tag_Scene {
+    Scene_Instance *instances;
+    u32 instance_count;
+    u32 instance_capacity;
+
+    u32 *bvh_instances; // the static ones, every leaf covers a range of them
+    u32 bvh_instance_count;
+    u32 *dynamic_instances;
+    u32 dynamic_count;
+
+    Bvh_Node *nodes; // nodes[0] is the root
+    u32 node_count;
+    b8 bvh_valid; // static instances added or moved since BuildSceneBvh() get tested one by one until the next
+
+    Occlusion_Buffer occlusion; // optional, see CreateOcclusionBuffer()
+    u32 occluder_count;
+
+    Scene_Stats stats;
+} Scene;
+
+static b8 global_frustum_culling = M_TRUE; // M_FALSE draws every instance (in the same order), to compare
+
+b8 CreateScene(Scene *scene, Memory_Arena *arena, u32 capacity) {
+    Scene zero_scene = {0};
+    *scene = zero_scene;
+    scene->instances = ARENA_PUSH_ARRAY(arena, Scene_Instance, capacity);
+    scene->bvh_instances = ARENA_PUSH_ARRAY(arena, u32, capacity);
+    scene->dynamic_instances = ARENA_PUSH_ARRAY(arena, u32, capacity);
+    scene->nodes = ARENA_PUSH_ARRAY(arena, Bvh_Node, 2 * capacity); // a binary tree with capacity leaves at most
+    if (!scene->instances || !scene->bvh_instances || !scene->dynamic_instances || !scene->nodes) return M_FALSE;
+    scene->instance_capacity = capacity;
+    return M_TRUE;
+}
+
+// The box of the transformed box (Arvo) and the sphere scaled by the largest axis scale of the model.
+void UpdateInstanceBounds(Scene_Instance *instance) {
+    Mesh_Bounds *bounds = &instance->mesh->bounds;
+    Mat3x4 *m = &instance->model;
+    Vec3 extent = vec3_scale(0.5f, vec3_sub(bounds->max, bounds->min));
+
+    f32 world_center[3];
+    f32 world_extent[3];
+    f32 axis_scale_squared[3] = {0};
+    for (int row = 0; row < 3; ++row) {
+        world_center[row] = m->e[row][0] * bounds->center.x + m->e[row][1] * bounds->center.y +
+                            m->e[row][2] * bounds->center.z + m->e[row][3];
+        world_extent[row] = fabsf(m->e[row][0]) * extent.x + fabsf(m->e[row][1]) * extent.y +
+                            fabsf(m->e[row][2]) * extent.z;
+        for (int column = 0; column < 3; ++column) {
+            axis_scale_squared[column] += m->e[row][column] * m->e[row][column];
+        }
+    }
+    instance->box_min = vec3_make(world_center[0] - world_extent[0], world_center[1] - world_extent[1],
+                                  world_center[2] - world_extent[2]);
+    instance->box_max = vec3_make(world_center[0] + world_extent[0], world_center[1] + world_extent[1],
+                                  world_center[2] + world_extent[2]);
+
+    f32 max_scale_squared = MAX(MAX(axis_scale_squared[0], axis_scale_squared[1]), axis_scale_squared[2]);
+    instance->center = mat3x4_transform_point(m, bounds->center);
+    instance->radius = bounds->radius * sqrtf(max_scale_squared);
+}
+
+// Returns the index to move the instance with or SCENE_FULL. Static instances only get culled through the BVH
+// after the next BuildSceneBvh().
+u32 AddSceneInstance(Scene *scene, Indexed_Mesh *mesh, Mat3x4 *model, b8 is_static) {
+    if (scene->instance_count == scene->instance_capacity) {
+        ASSERT(!"scene full");
+        return SCENE_FULL;
+    }
+
+    u32 index = scene->instance_count++;
+    Scene_Instance *instance = scene->instances + index;
+    instance->mesh = mesh;
+    instance->model = *model;
+    instance->is_static = is_static;
+    instance->occluder = 0;
+    UpdateInstanceBounds(instance);
+
+    if (is_static) {
+        scene->bvh_instances[scene->bvh_instance_count++] = index;
+        scene->bvh_valid = M_FALSE;
+    }
+    else {
+        scene->dynamic_instances[scene->dynamic_count++] = index;
+    }
+    return index;
+}
+
+void MoveSceneInstance(Scene *scene, u32 index, Mat3x4 *model) {
+    Scene_Instance *instance = scene->instances + index;
+    instance->model = *model;
+    UpdateInstanceBounds(instance);
+    if (instance->is_static) scene->bvh_valid = M_FALSE; // it may have left its node
+}
+
+// The instance hides what's behind it with occluder, which moves with the instance. The occluder mustn't reach
+// outside the instance's mesh, it can be the mesh itself or a simpler one that fits inside of it (the walls of
+// a building without the windows). 0 makes it a normal instance again.
+void SetSceneOccluder(Scene *scene, u32 index, Indexed_Mesh *occluder) {
+    Scene_Instance *instance = scene->instances + index;
+    if (instance->occluder) --scene->occluder_count;
+    if (occluder) ++scene->occluder_count;
+    instance->occluder = occluder;
+}
+
+inline f32 InstanceBoxCenter(Scene *scene, u32 index, int axis) {
+    Scene_Instance *instance = scene->instances + index;
+    switch (axis) {
+        case 0:  return instance->box_min.x + instance->box_max.x;
+        case 1:  return instance->box_min.y + instance->box_max.y;
+        default: return instance->box_min.z + instance->box_max.z;
+    }
+}
+
+// Hoare's selection: afterwards indices[k] is the one that would be there if they were sorted by their box
+// center along axis, the ones before it are not greater and the ones after it not less.
+void SelectInstanceByCenter(Scene *scene, u32 *indices, int count, int k, int axis) {
+    int left = 0;
+    int right = count - 1;
+    while (left < right) {
+        f32 pivot = InstanceBoxCenter(scene, indices[k], axis);
+        int i = left;
+        int j = right;
+        do {
+            while (InstanceBoxCenter(scene, indices[i], axis) < pivot) ++i;
+            while (pivot < InstanceBoxCenter(scene, indices[j], axis)) --j;
+            if (i <= j) {
+                u32 swap = indices[i];
+                indices[i] = indices[j];
+                indices[j] = swap;
+                ++i;
+                --j;
+            }
+        } while (i <= j);
+        if (j < k) left = i;
+        if (k < i) right = j;
+    }
+}
+
+// The node's box holds all of its instances, inner nodes split them in half along the longest axis of their
+// box centers. The median keeps the tree balanced however the instances are spread out.
+void BuildBvhNode(Scene *scene, u32 node_index, u32 first, u32 count) {
+    Bvh_Node *node = scene->nodes + node_index;
+    Scene_Instance *instance = scene->instances + scene->bvh_instances[first];
+    node->box_min = instance->box_min;
+    node->box_max = instance->box_max;
+    Vec3 center_min = vec3_scale(0.5f, vec3_add(instance->box_min, instance->box_max));
+    Vec3 center_max = center_min;
+    for (u32 i = 1; i < count; ++i) {
+        instance = scene->instances + scene->bvh_instances[first + i];
+        node->box_min.x = MIN(node->box_min.x, instance->box_min.x);
+        node->box_min.y = MIN(node->box_min.y, instance->box_min.y);
+        node->box_min.z = MIN(node->box_min.z, instance->box_min.z);
+        node->box_max.x = MAX(node->box_max.x, instance->box_max.x);
+        node->box_max.y = MAX(node->box_max.y, instance->box_max.y);
+        node->box_max.z = MAX(node->box_max.z, instance->box_max.z);
+
+        Vec3 center = vec3_scale(0.5f, vec3_add(instance->box_min, instance->box_max));
+        center_min.x = MIN(center_min.x, center.x);
+        center_min.y = MIN(center_min.y, center.y);
+        center_min.z = MIN(center_min.z, center.z);
+        center_max.x = MAX(center_max.x, center.x);
+        center_max.y = MAX(center_max.y, center.y);
+        center_max.z = MAX(center_max.z, center.z);
+    }
+
+    if (count <= BVH_LEAF_SIZE) {
+        node->first = first;
+        node->count = count;
+        return;
+    }
+
+    Vec3 spread = vec3_sub(center_max, center_min);
+    int axis = 0;
+    if (spread.y > spread.x) axis = 1;
+    if (spread.z > MAX(spread.x, spread.y)) axis = 2;
+
+    u32 half = count / 2;
+    SelectInstanceByCenter(scene, scene->bvh_instances + first, (int)count, (int)half, axis);
+
+    u32 children = scene->node_count;
+    scene->node_count += 2;
+    node->first = children;
+    node->count = 0;
+    BuildBvhNode(scene, children, first, half);
+    BuildBvhNode(scene, children + 1, first + half, count - half);
+}
+
+// after the static instances are added, again whenever one of them moved
+void BuildSceneBvh(Scene *scene) {
+    scene->node_count = 0;
+    if (scene->bvh_instance_count) {
+        scene->node_count = 1;
+        BuildBvhNode(scene, 0, 0, scene->bvh_instance_count);
+    }
+    scene->bvh_valid = M_TRUE;
+}
+
+// Gribb and Hartmann: for clip = m * p every plane is the last row of m plus or minus one of the others, with
+// -w <= z <= w like perspective_projection() makes it.
+Frustum FrustumFromMatrix(Mat4 *m) {
+    Frustum frustum;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int column = 0; column < 4; ++column) {
+            frustum.planes[2 * axis].e[column]     = m->e[3][column] + m->e[axis][column];
+            frustum.planes[2 * axis + 1].e[column] = m->e[3][column] - m->e[axis][column];
+        }
+    }
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        Vec4 *plane = frustum.planes + i;
+        f32 length = sqrtf(plane->e[0] * plane->e[0] + plane->e[1] * plane->e[1] + plane->e[2] * plane->e[2]);
+        f32 inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+        for (int column = 0; column < 4; ++column) plane->e[column] *= inv_length;
+    }
+    return frustum;
+}
+
+// Only the planes in *mask are tested. Returns M_FALSE if the sphere is outside one of them, otherwise clears
+// the planes it is completely inside of from *mask.
+inline b8 SphereInFrustum(Frustum *frustum, Vec3 center, f32 radius, u32 *mask) {
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        if (!(*mask & (1u << i))) continue;
+        Vec4 *plane = frustum->planes + i;
+        f32 distance = plane->e[0] * center.x + plane->e[1] * center.y + plane->e[2] * center.z + plane->e[3];
+        if (distance < -radius) return M_FALSE;
+        if (distance >= radius) *mask &= ~(1u << i);
+    }
+    return M_TRUE;
+}
+
+// the same for a box, its projection onto the plane normal is the radius
+inline b8 BoxInFrustum(Frustum *frustum, Vec3 box_min, Vec3 box_max, u32 *mask) {
+    Vec3 center = vec3_scale(0.5f, vec3_add(box_min, box_max));
+    Vec3 extent = vec3_scale(0.5f, vec3_sub(box_max, box_min));
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        if (!(*mask & (1u << i))) continue;
+        Vec4 *plane = frustum->planes + i;
+        f32 distance = plane->e[0] * center.x + plane->e[1] * center.y + plane->e[2] * center.z + plane->e[3];
+        f32 radius = fabsf(plane->e[0]) * extent.x + fabsf(plane->e[1]) * extent.y + fabsf(plane->e[2]) * extent.z;
+        if (distance < -radius) return M_FALSE;
+        if (distance >= radius) *mask &= ~(1u << i);
+    }
+    return M_TRUE;
+}
+
+// the sphere is cheaper and rejects most, the box is tighter for the ones that get through
+inline b8 InstanceInFrustum(Scene *scene, u32 index, Frustum *frustum, u32 mask) {
+    Scene_Instance *instance = scene->instances + index;
+    ++scene->stats.instances_tested;
+    return SphereInFrustum(frustum, instance->center, instance->radius, &mask) &&
+           BoxInFrustum(frustum, instance->box_min, instance->box_max, &mask);
+}
+
+// Appends the instances that may be visible to visible, static ones first in BVH order. Returns their count.
+u32 CullScene(Scene *scene, Frustum *frustum, u32 *visible) {
+    u32 visible_count = 0;
+    u32 all_planes = global_frustum_culling ? FRUSTUM_ALL_PLANES : 0; // no planes left to test lets everything in
+
+    if (scene->bvh_valid && scene->node_count) {
+        u32 stack_nodes[BVH_MAX_DEPTH];
+        u32 stack_masks[BVH_MAX_DEPTH];
+        int stack_size = 0;
+        stack_nodes[stack_size] = 0;
+        stack_masks[stack_size++] = all_planes;
+
+        while (stack_size) {
+            --stack_size;
+            Bvh_Node *node = scene->nodes + stack_nodes[stack_size];
+            u32 mask = stack_masks[stack_size];
+            ++scene->stats.nodes_visited;
+            if (mask && !BoxInFrustum(frustum, node->box_min, node->box_max, &mask)) continue;
+
+            if (node->count) {
+                for (u32 i = 0; i < node->count; ++i) {
+                    u32 index = scene->bvh_instances[node->first + i];
+                    // a node completely inside doesn't need its instances tested
+                    if (!mask || InstanceInFrustum(scene, index, frustum, mask)) visible[visible_count++] = index;
+                }
+            }
+            else {
+                ASSERT(stack_size + 2 <= BVH_MAX_DEPTH);
+                // the left child gets popped first
+                stack_nodes[stack_size] = node->first + 1;
+                stack_masks[stack_size++] = mask;
+                stack_nodes[stack_size] = node->first;
+                stack_masks[stack_size++] = mask;
+            }
+        }
+    }
+    else {
+        for (u32 i = 0; i < scene->bvh_instance_count; ++i) {
+            u32 index = scene->bvh_instances[i];
+            if (!all_planes || InstanceInFrustum(scene, index, frustum, all_planes)) visible[visible_count++] = index;
+        }
+    }
+
+    for (u32 i = 0; i < scene->dynamic_count; ++i) {
+        u32 index = scene->dynamic_instances[i];
+        if (!all_planes || InstanceInFrustum(scene, index, frustum, all_planes)) visible[visible_count++] = index;
+    }
+    return visible_count;
+}
+
+// Rasterizes the occluders among the visible instances and drops the instances hidden behind them, occluders
+// included (one building behind another). Keeps the order, returns how many are left.
+u32 CullOccludedInstances(Scene *scene, Memory_Arena *scratch, Mat4 *view_proj, u32 *visible, u32 visible_count) {
+    Occlusion_Buffer *occlusion = &scene->occlusion;
+    ClearOcclusionBuffer(occlusion);
+    for (u32 i = 0; i < visible_count; ++i) {
+        Scene_Instance *instance = scene->instances + visible[i];
+        if (!instance->occluder) continue;
+        Mat4 mvp;
+        mat4_mul_mat3x4(&mvp, view_proj, &instance->model);
+        RasterizeOccluder(occlusion, scratch, &mvp, instance->occluder);
+        ++scene->stats.occluders;
+    }
+
+    u32 kept_count = 0;
+    for (u32 i = 0; i < visible_count; ++i) {
+        Scene_Instance *instance = scene->instances + visible[i];
+        if (BoxMayBeVisible(occlusion, view_proj, instance->box_min, instance->box_max)) visible[kept_count++] = visible[i];
+    }
+    scene->stats.occluded = visible_count - kept_count;
+    return kept_count;
+}
+
+// culls the scene with the frustum of proj * view and records what is left into the packet, instanced
+void DrawScene(Frame_Packet *packet, Offscreen_Buffer *buffer, Scene *scene, Mat4 *proj, Mat3x4 *view) {
+    Scene_Stats zero_stats = {0};
+    scene->stats = zero_stats;
+
+    Arena_Marker marker = BeginArenaTemp(packet->scratch);
+    u32 *visible = ARENA_PUSH_ARRAY(packet->scratch, u32, scene->instance_count);
+
+    PROFILE_BEGIN("scene cull");
+    Mat4 view_proj;
+    mat4_mul_mat3x4(&view_proj, proj, view);
+    Frustum frustum = FrustumFromMatrix(&view_proj);
+    u32 visible_count = CullScene(scene, &frustum, visible);
+    PROFILE_END("scene cull");
+
+    if (global_occlusion_culling && scene->occlusion.depth && scene->occluder_count) {
+        PROFILE_BEGIN("occlusion cull");
+        visible_count = CullOccludedInstances(scene, packet->scratch, &view_proj, visible, visible_count);
+        PROFILE_END("occlusion cull");
+    }
+
+    // the level of detail of every instance from how big it is on the screen
+    Indexed_Mesh **meshes = ARENA_PUSH_ARRAY(packet->scratch, Indexed_Mesh *, visible_count);
+    for (u32 i = 0; i < visible_count; ++i) {
+        Scene_Instance *instance = scene->instances + visible[i];
+        meshes[i] = instance->mesh;
+        if (instance->mesh->next_lod) {
+            f32 projected_radius = ProjectedSphereRadius(proj, view, instance->center, instance->radius, (f32)buffer->height);
+            meshes[i] = SelectMeshLod(instance->mesh, projected_radius);
+            if (meshes[i] != instance->mesh) ++scene->stats.simplified;
+        }
+    }
+
+    // runs of the same mesh become one instanced draw, that keeps the order
+    Mat3x4 *models = ARENA_PUSH_ARRAY(packet->scratch, Mat3x4, visible_count);
+    u32 run_start = 0;
+    while (run_start < visible_count) {
+        Indexed_Mesh *mesh = meshes[run_start];
+        u32 run_end = run_start;
+        while (run_end < visible_count && meshes[run_end] == mesh) {
+            models[run_end - run_start] = scene->instances[visible[run_end]].model;
+            ++run_end;
+        }
+        RecordInstancedMesh(packet, buffer, proj, view, models, run_end - run_start, mesh);
+        ++scene->stats.draws;
+        run_start = run_end;
+    }
+    scene->stats.drawn = visible_count;
+    EndArenaTemp(marker);
+}
+
+#endif
@@ -0,0 +1,294 @@
+/*
+* Textures for the rasterizer.
+*
+* Every mip level is stored in tiles of 4x4 texels, 64 bytes or one cache
+* line. The tiles are row-major and the texels inside a tile are in Morton
+* (Z) order. A triangle that is rotated on screen walks through the
+* texture diagonally. With row-major storage every texel row it crosses is
+* a new cache line, with tiles neighbours in both directions mostly share
+* one.
+*
+* Sizes have to be powers of two and coordinates wrap around, u and v of 1
+* are one repeat of the texture. The mip chain goes down to 1x1 and gets
+* box filtered when the texture is created.
+*
+* The samplers work in fixed point with TEXEL_FRACTION_BITS below the
+* texel, so the scalar and the SSE2 versions return the same bits.
+*/
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <emmintrin.h>
+#include <math.h>
+
+#define TEXTURE_TILE_SHIFT 2 // 4x4 texels per tile
+#define TEXTURE_MAX_LEVELS 16
+#define TEXEL_FRACTION_BITS 8
+#define TEXEL_COORDINATE_LIMIT 1073741824.0f // 2^30, keeps the fixed point coordinates in an i32
+
+typedef enum Tag_Texture_Filter {
+    TEXTURE_FILTER_POINT,
+    TEXTURE_FILTER_BILINEAR
+} Texture_Filter;
+
+typedef struct Tag_Texture_Level {
+    u32 *texels; // 0xAARRGGBB, tiled, see TexelOffset()
+    int width;
+    int height;
+    int tiles_x_shift; // log2 of the tiles in a row
+} Texture_Level;
+
+typedef struct Tag_Texture {
+    Texture_Level levels[TEXTURE_MAX_LEVELS];
+    int level_count;
+    Texture_Filter filter;
+} Texture;
+
+inline int Log2PowerOfTwo(int value) {
+    int result = 0;
+    while ((1 << result) < value) ++result;
+    return result;
+}
+
+// x and y have to be inside the level
+inline u32 TexelOffset(Texture_Level *level, u32 x, u32 y) {
+    u32 tile = ((y >> TEXTURE_TILE_SHIFT) << level->tiles_x_shift) + (x >> TEXTURE_TILE_SHIFT);
+    u32 morton = (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2;
+    return tile << (2 * TEXTURE_TILE_SHIFT) | morton;
+}
+
+// rounds every channel of the average of four texels
+inline u32 AverageTexels(u32 a, u32 b, u32 c, u32 d) {
+    u32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        u32 sum = (a >> shift & 0xFF) + (b >> shift & 0xFF) + (c >> shift & 0xFF) + (d >> shift & 0xFF);
+        result |= ((sum + 2) >> 2) << shift;
+    }
+    return result;
+}
+
+// Copies the row-major pixels (pitch is width) into the tiled layout and builds the mip chain, the texels are
+// pushed onto arena. Fails if the size isn't a power of two.
+b8 CreateTexture(Texture *texture, Memory_Arena *arena, u32 *pixels, int width, int height, Texture_Filter filter) {
+    if (width < 1 || height < 1 || (width & (width - 1)) || (height & (height - 1))) return M_FALSE;
+
+    Texture zero_texture = {0};
+    *texture = zero_texture;
+    texture->filter = filter;
+    texture->level_count = 1 + MAX(Log2PowerOfTwo(width), Log2PowerOfTwo(height));
+    if (texture->level_count > TEXTURE_MAX_LEVELS) return M_FALSE;
+
+    // all levels in one allocation, every level is padded to whole tiles
+    size_t texel_counts[TEXTURE_MAX_LEVELS];
+    size_t total_texel_count = 0;
+    int tile_size = 1 << TEXTURE_TILE_SHIFT;
+    for (int i = 0; i < texture->level_count; ++i) {
+        Texture_Level *level = texture->levels + i;
+        level->width = MAX(width >> i, 1);
+        level->height = MAX(height >> i, 1);
+        int tiles_x = MAX(level->width / tile_size, 1);
+        int tiles_y = MAX(level->height / tile_size, 1);
+        level->tiles_x_shift = Log2PowerOfTwo(tiles_x);
+        texel_counts[i] = (size_t)tiles_x * tiles_y * tile_size * tile_size;
+        total_texel_count += texel_counts[i];
+    }
+
+    // 64 so every tile is a cache line aligned block
+    u32 *memory = (u32 *)ArenaPushSize(arena, total_texel_count * sizeof(u32), 64);
+    if (!memory) return M_FALSE;
+    for (int i = 0; i < texture->level_count; ++i) {
+        texture->levels[i].texels = memory;
+        memory += texel_counts[i];
+    }
+
+    Texture_Level *base = texture->levels;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            base->texels[TexelOffset(base, x, y)] = pixels[y * width + x];
+        }
+    }
+
+    for (int i = 1; i < texture->level_count; ++i) {
+        Texture_Level *source = texture->levels + i - 1;
+        Texture_Level *level = texture->levels + i;
+        for (int y = 0; y < level->height; ++y) {
+            // a side that is already 1 texel doesn't get halved any more
+            u32 y0 = MIN(2 * y, source->height - 1);
+            u32 y1 = MIN(2 * y + 1, source->height - 1);
+            for (int x = 0; x < level->width; ++x) {
+                u32 x0 = MIN(2 * x, source->width - 1);
+                u32 x1 = MIN(2 * x + 1, source->width - 1);
+                level->texels[TexelOffset(level, x, y)] = AverageTexels(source->texels[TexelOffset(source, x0, y0)],
+                                                                        source->texels[TexelOffset(source, x1, y0)],
+                                                                        source->texels[TexelOffset(source, x0, y1)],
+                                                                        source->texels[TexelOffset(source, x1, y1)]);
+            }
+        }
+    }
+    return M_TRUE;
+}
+
+// size by size texels of checks by checks squares, for testing, the pixels are only on scratch while it's built
+b8 CreateCheckerTexture(Texture *texture, Memory_Arena *arena, Memory_Arena *scratch, int size, int checks,
+                        u32 color0, u32 color1, Texture_Filter filter) {
+    Arena_Marker marker = BeginArenaTemp(scratch);
+    u32 *pixels = ARENA_PUSH_ARRAY(scratch, u32, size * size);
+    if (!pixels) return M_FALSE;
+
+    int check_size = MAX(size / checks, 1);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            pixels[y * size + x] = ((x / check_size + y / check_size) & 1) ? color1 : color0;
+        }
+    }
+    b8 result = CreateTexture(texture, arena, pixels, size, size, filter);
+    EndArenaTemp(marker);
+    return result;
+}
+
+// The level where one pixel step covers about one texel. The derivatives are in u and v per pixel, the larger
+// of the two axes decides, so minified surfaces at an angle get blurry rather than aliased.
+int SelectTextureLevel(Texture *texture, f32 du_dx, f32 dv_dx, f32 du_dy, f32 dv_dy) {
+    f32 width = (f32)texture->levels[0].width;
+    f32 height = (f32)texture->levels[0].height;
+    du_dx *= width;
+    du_dy *= width;
+    dv_dx *= height;
+    dv_dy *= height;
+    f32 rho_squared = MAX(du_dx * du_dx + dv_dx * dv_dx, du_dy * du_dy + dv_dy * dv_dy);
+    if (!(rho_squared >= 1.0f)) return 0; // magnified, or NaN
+
+    // floor(log2(rho)) from the exponent of rho squared
+    int exponent;
+    frexpf(rho_squared, &exponent);
+    int level = (exponent - 1) >> 1;
+    return MIN(level, texture->level_count - 1);
+}
+
+// texture coordinate to fixed point texels, rounded towards negative infinity
+inline i32 TexelFixed(f32 coordinate, int size) {
+    f32 scaled = coordinate * (f32)(size << TEXEL_FRACTION_BITS);
+    scaled = MIN(MAX(scaled, -TEXEL_COORDINATE_LIMIT), TEXEL_COORDINATE_LIMIT); // NaN ends up at the lower limit
+    i32 result = (i32)scaled;
+    if ((f32)result > scaled) --result;
+    return result;
+}
+
+inline __m128i TexelFixedSimd(__m128 coordinate, int size) {
+    __m128 scaled = _mm_mul_ps(coordinate, _mm_set1_ps((f32)(size << TEXEL_FRACTION_BITS)));
+    scaled = _mm_min_ps(_mm_max_ps(scaled, _mm_set1_ps(-TEXEL_COORDINATE_LIMIT)), _mm_set1_ps(TEXEL_COORDINATE_LIMIT));
+    __m128i result = _mm_cvttps_epi32(scaled);
+    // truncation rounded a negative value up, the compare is all ones (-1) in those lanes
+    return _mm_add_epi32(result, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(result), scaled)));
+}
+
+inline __m128i TexelOffsetSimd(Texture_Level *level, __m128i x, __m128i y) {
+    __m128i one = _mm_set1_epi32(1);
+    __m128i two = _mm_set1_epi32(2);
+    __m128i tile = _mm_add_epi32(_mm_sll_epi32(_mm_srli_epi32(y, TEXTURE_TILE_SHIFT), _mm_cvtsi32_si128(level->tiles_x_shift)),
+                                 _mm_srli_epi32(x, TEXTURE_TILE_SHIFT));
+    __m128i morton = _mm_or_si128(_mm_or_si128(_mm_and_si128(x, one), _mm_slli_epi32(_mm_and_si128(y, one), 1)),
+                                  _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, two), 1), _mm_slli_epi32(_mm_and_si128(y, two), 2)));
+    return _mm_or_si128(_mm_slli_epi32(tile, 2 * TEXTURE_TILE_SHIFT), morton);
+}
+
+// SSE2 has no gather
+inline __m128i GatherTexels(u32 *texels, __m128i offsets) {
+    u32 lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, offsets);
+    return _mm_setr_epi32((int)texels[lanes[0]], (int)texels[lanes[1]], (int)texels[lanes[2]], (int)texels[lanes[3]]);
+}
+
+u32 SampleTexturePoint(Texture_Level *level, f32 u, f32 v) {
+    u32 x = (u32)(TexelFixed(u, level->width) >> TEXEL_FRACTION_BITS) & (level->width - 1);
+    u32 y = (u32)(TexelFixed(v, level->height) >> TEXEL_FRACTION_BITS) & (level->height - 1);
+    return level->texels[TexelOffset(level, x, y)];
+}
+
+// (a * (256 - f) + b * f) / 256 per channel, both steps fit 16 bits so the SIMD version can use 16 bit lanes
+inline u32 LerpTexels(u32 a, u32 b, u32 f) {
+    u32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        u32 channel = ((a >> shift & 0xFF) * ((1 << TEXEL_FRACTION_BITS) - f) + (b >> shift & 0xFF) * f) >> TEXEL_FRACTION_BITS;
+        result |= channel << shift;
+    }
+    return result;
+}
+
+u32 SampleTextureBilinear(Texture_Level *level, f32 u, f32 v) {
+    // texel centers are at half texels
+    i32 fixed_x = TexelFixed(u, level->width) - (1 << (TEXEL_FRACTION_BITS - 1));
+    i32 fixed_y = TexelFixed(v, level->height) - (1 << (TEXEL_FRACTION_BITS - 1));
+    u32 fraction_mask = (1 << TEXEL_FRACTION_BITS) - 1;
+    u32 x0 = (u32)(fixed_x >> TEXEL_FRACTION_BITS) & (level->width - 1);
+    u32 y0 = (u32)(fixed_y >> TEXEL_FRACTION_BITS) & (level->height - 1);
+    u32 x1 = (x0 + 1) & (level->width - 1);
+    u32 y1 = (y0 + 1) & (level->height - 1);
+
+    u32 top = LerpTexels(level->texels[TexelOffset(level, x0, y0)], level->texels[TexelOffset(level, x1, y0)],
+                         (u32)fixed_x & fraction_mask);
+    u32 bottom = LerpTexels(level->texels[TexelOffset(level, x0, y1)], level->texels[TexelOffset(level, x1, y1)],
+                            (u32)fixed_x & fraction_mask);
+    return LerpTexels(top, bottom, (u32)fixed_y & fraction_mask);
+}
+
+u32 SampleTexture(Texture *texture, int level, f32 u, f32 v) {
+    if (texture->filter == TEXTURE_FILTER_BILINEAR) return SampleTextureBilinear(texture->levels + level, u, v);
+    return SampleTexturePoint(texture->levels + level, u, v);
+}
+
+// four texels as 16 bit channels: pixel 0 and 1 in low, 2 and 3 in high
+inline __m128i LerpTexelsSimd(__m128i a, __m128i b, __m128i f) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi32(1 << TEXEL_FRACTION_BITS);
+    // every pixel's fraction into its 4 channels
+    __m128i f16 = _mm_packs_epi32(f, f);
+    f16 = _mm_unpacklo_epi16(f16, f16);
+    __m128i f_low = _mm_unpacklo_epi32(f16, f16);
+    __m128i f_high = _mm_unpackhi_epi32(f16, f16);
+    __m128i g16 = _mm_packs_epi32(_mm_sub_epi32(one, f), zero);
+    g16 = _mm_unpacklo_epi16(g16, g16);
+    __m128i g_low = _mm_unpacklo_epi32(g16, g16);
+    __m128i g_high = _mm_unpackhi_epi32(g16, g16);
+
+    __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), g_low),
+                                _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), f_low));
+    __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), g_high),
+                                 _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), f_high));
+    return _mm_packus_epi16(_mm_srli_epi16(low, TEXEL_FRACTION_BITS), _mm_srli_epi16(high, TEXEL_FRACTION_BITS));
+}
+
+// four pixels, same bits as SampleTexture() per lane
+__m128i SampleTextureSimd(Texture *texture, int level_index, __m128 u, __m128 v) {
+    Texture_Level *level = texture->levels + level_index;
+    __m128i x_mask = _mm_set1_epi32(level->width - 1);
+    __m128i y_mask = _mm_set1_epi32(level->height - 1);
+    __m128i fixed_x = TexelFixedSimd(u, level->width);
+    __m128i fixed_y = TexelFixedSimd(v, level->height);
+
+    if (texture->filter != TEXTURE_FILTER_BILINEAR) {
+        __m128i x = _mm_and_si128(_mm_srai_epi32(fixed_x, TEXEL_FRACTION_BITS), x_mask);
+        __m128i y = _mm_and_si128(_mm_srai_epi32(fixed_y, TEXEL_FRACTION_BITS), y_mask);
+        return GatherTexels(level->texels, TexelOffsetSimd(level, x, y));
+    }
+
+    __m128i half = _mm_set1_epi32(1 << (TEXEL_FRACTION_BITS - 1));
+    __m128i fraction_mask = _mm_set1_epi32((1 << TEXEL_FRACTION_BITS) - 1);
+    __m128i one = _mm_set1_epi32(1);
+    fixed_x = _mm_sub_epi32(fixed_x, half);
+    fixed_y = _mm_sub_epi32(fixed_y, half);
+    __m128i x0 = _mm_and_si128(_mm_srai_epi32(fixed_x, TEXEL_FRACTION_BITS), x_mask);
+    __m128i y0 = _mm_and_si128(_mm_srai_epi32(fixed_y, TEXEL_FRACTION_BITS), y_mask);
+    __m128i x1 = _mm_and_si128(_mm_add_epi32(x0, one), x_mask);
+    __m128i y1 = _mm_and_si128(_mm_add_epi32(y0, one), y_mask);
+
+    __m128i fraction_x = _mm_and_si128(fixed_x, fraction_mask);
+    __m128i top = LerpTexelsSimd(GatherTexels(level->texels, TexelOffsetSimd(level, x0, y0)),
+                                 GatherTexels(level->texels, TexelOffsetSimd(level, x1, y0)), fraction_x);
+    __m128i bottom = LerpTexelsSimd(GatherTexels(level->texels, TexelOffsetSimd(level, x0, y1)),
+                                    GatherTexels(level->texels, TexelOffsetSimd(level, x1, y1)), fraction_x);
+    return LerpTexelsSimd(top, bottom, _mm_and_si128(fixed_y, fraction_mask));
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+* A very small multi-consumer work queue in the spirit of the one from
+* Handmade Hero. The OS parts come from platform.h.
+*
+* One thread (the main thread) adds entries with AddWorkQueueEntry().
+* The worker threads created by InitWorkQueue() sleep on a semaphore and
+* grab entries with an interlocked compare exchange. CompleteAllWork()
+* lets the calling thread help out until every entry that was added so
+* far is finished, so it can be used as a barrier at the end of a stage.
+*/
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#define WORK_QUEUE_SIZE        256 // has to be a power of two
+#define WORK_QUEUE_MAX_THREADS 64
+
+typedef struct Tag_Work_Queue Work_Queue;
+
+#define WORK_QUEUE_CALLBACK(name) void name(Work_Queue *queue, void *data)
+typedef WORK_QUEUE_CALLBACK(Work_Queue_Callback);
+
+typedef struct Tag_Work_Queue_Entry {
+    Work_Queue_Callback *callback;
+    void *data;
+} Work_Queue_Entry;
+
+struct Tag_Work_Queue {
+    volatile long completion_goal;
+    volatile long completion_count;
+
+    volatile long next_entry_to_write;
+    volatile long next_entry_to_read;
+
+    Platform_Semaphore semaphore;
+    int thread_count; // worker threads, not counting the thread that adds entries
+
+    Work_Queue_Entry entries[WORK_QUEUE_SIZE];
+};
+
+void AddWorkQueueEntry(Work_Queue *queue, Work_Queue_Callback *callback, void *data) {
+    long entry_to_write = queue->next_entry_to_write;
+    ASSERT(entry_to_write - queue->next_entry_to_read < WORK_QUEUE_SIZE);
+
+    Work_Queue_Entry *entry = queue->entries + ((u32)entry_to_write & (WORK_QUEUE_SIZE - 1));
+    entry->callback = callback;
+    entry->data = data;
+    ++queue->completion_goal;
+
+    // the entry has to be visible before the workers can see the new write index
+    COMPILER_BARRIER();
+    _mm_sfence();
+
+    queue->next_entry_to_write = entry_to_write + 1;
+    platform_signal_semaphore(queue->semaphore);
+}
+
+// returns M_TRUE if there was nothing to do and the thread may go to sleep
+b8 DoNextWorkQueueEntry(Work_Queue *queue) {
+    b8 should_sleep = M_FALSE;
+
+    long original_next_entry_to_read = queue->next_entry_to_read;
+    if (original_next_entry_to_read != queue->next_entry_to_write) {
+        long index = platform_atomic_compare_exchange(&queue->next_entry_to_read,
+                                                      original_next_entry_to_read + 1,
+                                                      original_next_entry_to_read);
+        if (index == original_next_entry_to_read) {
+            Work_Queue_Entry entry = queue->entries[(u32)index & (WORK_QUEUE_SIZE - 1)];
+            entry.callback(queue, entry.data);
+            platform_atomic_increment(&queue->completion_count);
+        }
+    }
+    else {
+        should_sleep = M_TRUE;
+    }
+
+    return should_sleep;
+}
+
+void CompleteAllWork(Work_Queue *queue) {
+    while (queue->completion_goal != queue->completion_count) {
+        DoNextWorkQueueEntry(queue);
+    }
+
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+}
+
+PLATFORM_THREAD_PROC(WorkQueueThreadProc) {
+    Work_Queue *queue = (Work_Queue *)parameter;
+    PROFILE_THREAD_NAME("worker");
+
+    for (;;) {
+        if (DoNextWorkQueueEntry(queue)) {
+            platform_wait_semaphore(queue->semaphore);
+        }
+    }
+}
+
+void InitWorkQueue(Work_Queue *queue, int thread_count) {
+    if (thread_count > WORK_QUEUE_MAX_THREADS) thread_count = WORK_QUEUE_MAX_THREADS;
+    if (thread_count < 0) thread_count = 0;
+
+    queue->completion_goal = 0;
+    queue->completion_count = 0;
+    queue->next_entry_to_write = 0;
+    queue->next_entry_to_read = 0;
+    queue->thread_count = thread_count;
+    queue->semaphore = platform_create_semaphore(thread_count > 0 ? thread_count : 1);
+
+    for (int i = 0; i < thread_count; ++i) {
+        platform_detach_thread(platform_create_thread(WorkQueueThreadProc, queue));
+    }
+}
+
+#endif